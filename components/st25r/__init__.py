@@ -3,14 +3,24 @@ import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import binary_sensor as binary_sensor_
 from esphome.components import sensor as sensor_
+from esphome.core import CORE, HexInt
 from esphome.const import (
     CONF_ID,
+    CONF_INTERVAL,
+    CONF_RAW_DATA_ID,
     CONF_ON_TAG,
     CONF_ON_TAG_REMOVED,
     CONF_TRIGGER_ID,
     CONF_IRQ_PIN,
     CONF_RESET_PIN,
     CONF_STATUS,
+    CONF_UPDATE_INTERVAL,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_BYTES,
+    UNIT_MICROSECOND,
+    UNIT_MILLISECOND,
 )
 
 CODEOWNERS = ["@JohnMcLear"]
@@ -20,17 +30,301 @@ MULTI_CONF = True
 CONF_ST25R_ID = "st25r_id"
 CONF_RF_FIELD_ENABLED = "rf_field_enabled"
 CONF_RF_POWER = "rf_power"
+CONF_VARIANT = "variant"
 CONF_FIELD_STRENGTH = "field_strength"
+CONF_ALLOWLIST = "allowlist"
+CONF_ALLOWLIST_FILE = "allowlist_file"
+CONF_ON_AUTHORIZED = "on_authorized"
+CONF_ON_DENIED = "on_denied"
+CONF_FAST_POLL = "fast_poll"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_MAX_INTERVAL = "max_interval"
+CONF_HOLD_TIME = "hold_time"
+CONF_WAKE_UP = "wake_up"
+CONF_PRESENCE_CHECK = "presence_check"
+CONF_EVENT_FILTER = "event_filter"
+CONF_WINDOW = "window"
+CONF_MAX_EVENTS = "max_events"
+CONF_PERIOD = "period"
+CONF_SUPPRESSED_TAPS = "suppressed_taps"
+CONF_DEBOUNCE = "debounce"
+CONF_NDEF_CACHE_SIZE = "ndef_cache_size"
+CONF_NFC_V = "nfc_v"
+CONF_NFC_F = "nfc_f"
+CONF_BIT_RATE = "bit_rate"
+CONF_TIME_SLOTS = "time_slots"
+CONF_ISO_DEP = "iso_dep"
+CONF_MAX_BIT_RATE = "max_bit_rate"
+CONF_MIFARE_CLASSIC = "mifare_classic"
+CONF_KEYS = "keys"
+CONF_CACHE_SIZE = "cache_size"
+CONF_STATS = "stats"
+CONF_ROUND_TIME = "round_time"
+CONF_TAG_READ_TIME = "tag_read_time"
+CONF_LOOP_TIME = "loop_time"
+CONF_BUS_TRANSACTIONS = "bus_transactions"
+CONF_FIFO_BYTES = "fifo_bytes"
+CONF_TIMEOUTS = "timeouts"
+CONF_ON_FINISHED_WRITE = "on_finished_write"
+CONF_URI = "uri"
+CONF_TEXT = "text"
+CONF_LOCK = "lock"
+CONF_IRQ_ERRORS = "irq_errors"
+CONF_COLLISIONS = "collisions"
+CONF_TRACE = "trace"
+CONF_BUFFER_SIZE = "buffer_size"
+CONF_STOP_WHEN_FULL = "stop_when_full"
+CONF_AMPLITUDE_DELTA = "amplitude_delta"
+CONF_PHASE_DELTA = "phase_delta"
+CONF_CAPACITANCE_DELTA = "capacitance_delta"
+
+# Allowlist table record: length byte followed by the UID zero-padded to 10 bytes
+ALLOWLIST_UID_MAX = 10
+
+def validate_uid(value):
+    value = cv.string_strict(value)
+    for x in value.split("-"):
+        if len(x) != 2:
+            raise cv.Invalid(
+                "Each part (separated by '-') of the UID must be two characters long."
+            )
+        try:
+            x = int(x, 16)
+        except ValueError as err:
+            raise cv.Invalid(
+                "Valid characters for parts of a UID are 0123456789ABCDEF."
+            ) from err
+        if x < 0 or x > 255:
+            raise cv.Invalid(
+                "Valid values for UID parts (separated by '-') are 00 to FF"
+            )
+    return value
+
+
+def validate_fast_poll(config):
+    if config[CONF_MIN_INTERVAL] > config[CONF_MAX_INTERVAL]:
+        raise cv.Invalid(f"{CONF_MIN_INTERVAL} must not be larger than {CONF_MAX_INTERVAL}")
+    return config
+
+
+FAST_POLL_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Optional(
+                CONF_MIN_INTERVAL, default="20ms"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_MAX_INTERVAL, default="50ms"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_HOLD_TIME, default="5s"): cv.positive_time_period_milliseconds,
+        }
+    ),
+    validate_fast_poll,
+)
+
+
+PRESENCE_CHECK_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_INTERVAL, default="25ms"): cv.positive_time_period_milliseconds,
+        # How long a tag may go unanswered before it is reported removed
+        cv.Optional(CONF_DEBOUNCE, default="75ms"): cv.positive_time_period_milliseconds,
+    }
+)
+
+
+def validate_event_filter(config):
+    if config[CONF_WINDOW].total_milliseconds == 0 and config[CONF_MAX_EVENTS] == 0:
+        raise cv.Invalid(f"Set {CONF_WINDOW}, {CONF_MAX_EVENTS} or both")
+    if config[CONF_PERIOD].total_milliseconds < config[CONF_MAX_EVENTS]:
+        raise cv.Invalid(f"{CONF_PERIOD} must be at least 1ms per event")
+    return config
+
+
+EVENT_FILTER_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            # The same UID is reported again only this long after its last reported tap
+            cv.Optional(CONF_WINDOW, default="2s"): cv.positive_time_period_milliseconds,
+            # Tag events of all UIDs together; 0 disables the cap
+            cv.Optional(CONF_MAX_EVENTS, default=0): cv.int_range(min=0, max=1000),
+            cv.Optional(CONF_PERIOD, default="60s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_SUPPRESSED_TAPS): sensor_.sensor_schema(
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+            ),
+        }
+    ),
+    validate_event_filter,
+)
+
+
+def validate_wake_up_interval(value):
+    value = cv.positive_time_period_milliseconds(value)
+    ms = value.total_milliseconds
+    # The wake-up timer counts 1..8 periods of either 10 ms or 100 ms.
+    if not ((ms <= 80 and ms % 10 == 0) or (ms <= 800 and ms % 100 == 0)):
+        raise cv.Invalid(
+            "Wake-up interval must be 10-80ms in 10ms steps or 100-800ms in 100ms steps"
+        )
+    return value
+
+
+def validate_wake_up(config):
+    if not any(
+        config[key] > 0
+        for key in (CONF_AMPLITUDE_DELTA, CONF_PHASE_DELTA, CONF_CAPACITANCE_DELTA)
+    ):
+        raise cv.Invalid("At least one wake-up measurement needs a non-zero delta")
+    return config
+
+
+WAKE_UP_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Optional(CONF_INTERVAL, default="100ms"): validate_wake_up_interval,
+            cv.Optional(CONF_AMPLITUDE_DELTA, default=4): cv.int_range(min=0, max=15),
+            cv.Optional(CONF_PHASE_DELTA, default=0): cv.int_range(min=0, max=15),
+            cv.Optional(CONF_CAPACITANCE_DELTA, default=0): cv.int_range(min=0, max=15),
+        }
+    ),
+    validate_wake_up,
+)
+
+
+NFC_F_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_BIT_RATE, default=212): cv.one_of(212, 424, int=True),
+        # SENSF_REQ time slots; cards answer in a slot of their choosing
+        cv.Optional(CONF_TIME_SLOTS, default=4): cv.one_of(1, 2, 4, 8, 16, int=True),
+    }
+)
+
+ISO_DEP_SCHEMA = cv.Schema(
+    {
+        # Highest rate offered in PPS; the card's ATS may allow less
+        cv.Optional(CONF_MAX_BIT_RATE, default=424): cv.one_of(106, 212, 424, 848, int=True),
+    }
+)
+
+def validate_mifare_classic_key(value):
+    value = validate_uid(value)
+    if len(value.split("-")) != 6:
+        raise cv.Invalid("Mifare Classic keys must be 6 bytes long, e.g. FF-FF-FF-FF-FF-FF.")
+    return value
+
+
+# Factory default, MAD key A, NFC Forum key A, all zeros
+MIFARE_CLASSIC_DEFAULT_KEYS = [
+    "FF-FF-FF-FF-FF-FF",
+    "A0-A1-A2-A3-A4-A5",
+    "D3-F7-D3-F7-D3-F7",
+    "00-00-00-00-00-00",
+]
+
+MIFARE_CLASSIC_SCHEMA = cv.Schema(
+    {
+        # Tried on every sector in order, as key A, then as key B
+        cv.Optional(CONF_KEYS, default=MIFARE_CLASSIC_DEFAULT_KEYS): cv.All(
+            cv.ensure_list(validate_mifare_classic_key), cv.Length(min=1, max=32)
+        ),
+        # Cards whose sectors and keys are remembered
+        cv.Optional(CONF_CACHE_SIZE, default=4): cv.int_range(min=1, max=16),
+    }
+)
+
+
+def _stats_sensor(unit, accuracy, state_class):
+    return sensor_.sensor_schema(
+        unit_of_measurement=unit,
+        accuracy_decimals=accuracy,
+        state_class=state_class,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    )
+
+
+STATS_SCHEMA = cv.Schema(
+    {
+        # Sensors are published and the histograms restarted once per interval
+        cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+        # 95th percentile of the interval
+        cv.Optional(CONF_ROUND_TIME): _stats_sensor(UNIT_MILLISECOND, 1, STATE_CLASS_MEASUREMENT),
+        cv.Optional(CONF_TAG_READ_TIME): _stats_sensor(UNIT_MILLISECOND, 1, STATE_CLASS_MEASUREMENT),
+        # Longest loop() of the interval
+        cv.Optional(CONF_LOOP_TIME): _stats_sensor(UNIT_MICROSECOND, 0, STATE_CLASS_MEASUREMENT),
+        # Average per discovery round
+        cv.Optional(CONF_BUS_TRANSACTIONS): _stats_sensor(None, 1, STATE_CLASS_MEASUREMENT),
+        cv.Optional(CONF_FIFO_BYTES): _stats_sensor(UNIT_BYTES, 1, STATE_CLASS_MEASUREMENT),
+        # Since boot
+        cv.Optional(CONF_TIMEOUTS): _stats_sensor(None, 0, STATE_CLASS_TOTAL_INCREASING),
+        cv.Optional(CONF_IRQ_ERRORS): _stats_sensor(None, 0, STATE_CLASS_TOTAL_INCREASING),
+        cv.Optional(CONF_COLLISIONS): _stats_sensor(None, 0, STATE_CLASS_TOTAL_INCREASING),
+    }
+)
+
+STATS_SENSORS = {
+    CONF_ROUND_TIME: "set_round_time_sensor",
+    CONF_TAG_READ_TIME: "set_tag_read_time_sensor",
+    CONF_LOOP_TIME: "set_loop_time_sensor",
+    CONF_BUS_TRANSACTIONS: "set_bus_transactions_sensor",
+    CONF_FIFO_BYTES: "set_fifo_bytes_sensor",
+    CONF_TIMEOUTS: "set_timeouts_sensor",
+    CONF_IRQ_ERRORS: "set_irq_errors_sensor",
+    CONF_COLLISIONS: "set_collisions_sensor",
+}
+
+TRACE_SCHEMA = cv.Schema(
+    {
+        # Records are 8 bytes plus their data, about 10 bytes on average
+        cv.Optional(CONF_BUFFER_SIZE, default=4096): cv.int_range(min=256, max=65536),
+        # Keep the start of a capture from boot instead of the most recent records
+        cv.Optional(CONF_STOP_WHEN_FULL, default=False): cv.boolean,
+    }
+)
+
+
+def validate_allowlist_uid(value):
+    value = validate_uid(value)
+    if len(value.split("-")) not in (4, 7, 8, 10):
+        raise cv.Invalid("Allowlist UIDs must be 4, 7, 8 (NFC-V, NFC-F) or 10 bytes long.")
+    return value
+
+
+def validate_allowlist_file(value):
+    value = cv.file_(value)
+    uids = []
+    with open(CORE.relative_config_path(value), encoding="utf-8") as f:
+        for line_no, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            try:
+                uids.append(validate_allowlist_uid(line))
+            except cv.Invalid as err:
+                raise cv.Invalid(f"{value}:{line_no}: {err}") from err
+    return uids
+
 
 st25r_ns = cg.esphome_ns.namespace("st25r")
 ST25R = st25r_ns.class_("ST25R", cg.PollingComponent)
 
+ST25RVariant = st25r_ns.enum("ST25RVariant")
+VARIANTS = {
+    "st25r3916": ST25RVariant.VARIANT_ST25R3916,
+    "st25r3916b": ST25RVariant.VARIANT_ST25R3916B,
+}
+
 ST25RTagTrigger = st25r_ns.class_(
     "ST25RTagTrigger", automation.Trigger.template(cg.std_string)
 )
 ST25RTagRemovedTrigger = st25r_ns.class_(
     "ST25RTagRemovedTrigger", automation.Trigger.template(cg.std_string)
 )
+ST25RWriteNdefAction = st25r_ns.class_("ST25RWriteNdefAction", automation.Action)
+ST25RFormatAction = st25r_ns.class_("ST25RFormatAction", automation.Action)
+ST25REraseAction = st25r_ns.class_("ST25REraseAction", automation.Action)
+ST25RIsWritingCondition = st25r_ns.class_(
+    "ST25RIsWritingCondition", automation.Condition
+)
 
 ST25R_SCHEMA = cv.Schema(
     {
@@ -39,8 +333,21 @@ ST25R_SCHEMA = cv.Schema(
         cv.Optional(CONF_RESET_PIN): pins.gpio_output_pin_schema,
         cv.Optional(CONF_RF_FIELD_ENABLED, default=True): cv.boolean,
         cv.Optional(CONF_RF_POWER, default=15): cv.int_range(min=0, max=15),
+        # Checked against IC_IDENTITY on every reset
+        cv.Optional(CONF_VARIANT, default="st25r3916"): cv.enum(VARIANTS, lower=True),
         cv.Optional(CONF_STATUS): binary_sensor_.binary_sensor_schema(),
         cv.Optional(CONF_FIELD_STRENGTH): sensor_.sensor_schema(),
+        cv.Optional(CONF_FAST_POLL): FAST_POLL_SCHEMA,
+        cv.Optional(CONF_WAKE_UP): WAKE_UP_SCHEMA,
+        cv.Optional(CONF_PRESENCE_CHECK): PRESENCE_CHECK_SCHEMA,
+        cv.Optional(CONF_EVENT_FILTER): EVENT_FILTER_SCHEMA,
+        cv.Optional(CONF_NDEF_CACHE_SIZE, default=4): cv.int_range(min=0, max=32),
+        cv.Optional(CONF_NFC_V, default=False): cv.boolean,
+        cv.Optional(CONF_NFC_F): NFC_F_SCHEMA,
+        cv.Optional(CONF_ISO_DEP, default={}): ISO_DEP_SCHEMA,
+        cv.Optional(CONF_MIFARE_CLASSIC): MIFARE_CLASSIC_SCHEMA,
+        cv.Optional(CONF_STATS): STATS_SCHEMA,
+        cv.Optional(CONF_TRACE): TRACE_SCHEMA,
         cv.Optional(CONF_ON_TAG): automation.validate_automation(
             {
                 cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(ST25RTagTrigger),
@@ -51,10 +358,40 @@ ST25R_SCHEMA = cv.Schema(
                 cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(ST25RTagRemovedTrigger),
             }
         ),
+        cv.GenerateID(CONF_RAW_DATA_ID): cv.declare_id(cg.uint8),
+        cv.Optional(CONF_ALLOWLIST): cv.ensure_list(validate_allowlist_uid),
+        cv.Optional(CONF_ALLOWLIST_FILE): validate_allowlist_file,
+        cv.Optional(CONF_ON_AUTHORIZED): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(ST25RTagTrigger),
+            }
+        ),
+        cv.Optional(CONF_ON_DENIED): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(ST25RTagTrigger),
+            }
+        ),
+        cv.Optional(CONF_ON_FINISHED_WRITE): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(ST25RTagTrigger),
+            }
+        ),
     }
 ).extend(cv.polling_component_schema("1s"))
 
 
+def allowlist_table(uids):
+    """Sorted fixed-width records so the firmware can binary search the table in flash."""
+    keys = set()
+    for uid in uids:
+        data = [int(x, 16) for x in uid.split("-")]
+        keys.add(tuple([len(data)] + data + [0] * (ALLOWLIST_UID_MAX - len(data))))
+    table = []
+    for key in sorted(keys):
+        table.extend(HexInt(x) for x in key)
+    return table, len(keys)
+
+
 async def setup_st25r(var, config):
     await cg.register_component(var, config)
     
@@ -68,6 +405,55 @@ async def setup_st25r(var, config):
     
     cg.add(var.set_rf_field_enabled(config[CONF_RF_FIELD_ENABLED]))
     cg.add(var.set_rf_power(config[CONF_RF_POWER]))
+    cg.add(var.set_variant(config[CONF_VARIANT]))
+    cg.add(var.set_ndef_cache_size(config[CONF_NDEF_CACHE_SIZE]))
+    cg.add(var.set_nfc_v(config[CONF_NFC_V]))
+
+    if CONF_NFC_F in config:
+        conf = config[CONF_NFC_F]
+        cg.add(var.set_nfc_f(conf[CONF_BIT_RATE], conf[CONF_TIME_SLOTS]))
+
+    cg.add(var.set_iso_dep_max_bit_rate(config[CONF_ISO_DEP][CONF_MAX_BIT_RATE]))
+
+    if CONF_MIFARE_CLASSIC in config:
+        conf = config[CONF_MIFARE_CLASSIC]
+        for key in conf[CONF_KEYS]:
+            cg.add(var.add_mifare_classic_key(cg.RawExpression(f"0x{key.replace('-', '')}ULL")))
+        cg.add(var.set_mifare_classic_cache_size(conf[CONF_CACHE_SIZE]))
+
+    if CONF_FAST_POLL in config:
+        conf = config[CONF_FAST_POLL]
+        cg.add(
+            var.set_fast_poll(
+                conf[CONF_MIN_INTERVAL], conf[CONF_MAX_INTERVAL], conf[CONF_HOLD_TIME]
+            )
+        )
+
+    if CONF_WAKE_UP in config:
+        conf = config[CONF_WAKE_UP]
+        cg.add(
+            var.set_wake_up(
+                conf[CONF_INTERVAL],
+                conf[CONF_AMPLITUDE_DELTA],
+                conf[CONF_PHASE_DELTA],
+                conf[CONF_CAPACITANCE_DELTA],
+            )
+        )
+
+    if CONF_PRESENCE_CHECK in config:
+        conf = config[CONF_PRESENCE_CHECK]
+        cg.add(var.set_presence_check(conf[CONF_INTERVAL], conf[CONF_DEBOUNCE]))
+
+    if CONF_EVENT_FILTER in config:
+        conf = config[CONF_EVENT_FILTER]
+        cg.add(
+            var.set_event_filter(
+                conf[CONF_WINDOW], conf[CONF_MAX_EVENTS], conf[CONF_PERIOD]
+            )
+        )
+        if CONF_SUPPRESSED_TAPS in conf:
+            sens = await sensor_.new_sensor(conf[CONF_SUPPRESSED_TAPS])
+            cg.add(var.set_suppressed_taps_sensor(sens))
 
     if CONF_STATUS in config:
         sens = await binary_sensor_.new_binary_sensor(config[CONF_STATUS])
@@ -77,6 +463,20 @@ async def setup_st25r(var, config):
         sens = await sensor_.new_sensor(config[CONF_FIELD_STRENGTH])
         cg.add(var.set_field_strength_sensor(sens))
 
+    if CONF_STATS in config:
+        conf = config[CONF_STATS]
+        cg.add(var.set_stats_interval(conf[CONF_UPDATE_INTERVAL]))
+        for key, setter in STATS_SENSORS.items():
+            if key in conf:
+                sens = await sensor_.new_sensor(conf[key])
+                cg.add(getattr(var, setter)(sens))
+
+    if CONF_TRACE in config:
+        conf = config[CONF_TRACE]
+        # The recorder is compiled out of builds that do not use it
+        cg.add_define("USE_ST25R_TRACE")
+        cg.add(var.set_trace(conf[CONF_BUFFER_SIZE], conf[CONF_STOP_WHEN_FULL]))
+
     for conf in config.get(CONF_ON_TAG, []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
         cg.add(var.register_on_tag_trigger(trigger))
@@ -90,3 +490,83 @@ async def setup_st25r(var, config):
         await automation.build_automation(
             trigger, [(cg.std_string, "x")], conf
         )
+
+    uids = config.get(CONF_ALLOWLIST, []) + config.get(CONF_ALLOWLIST_FILE, [])
+    if uids:
+        table, count = allowlist_table(uids)
+        arr = cg.progmem_array(config[CONF_RAW_DATA_ID], table)
+        cg.add(var.set_allowlist(arr, count))
+
+    for conf in config.get(CONF_ON_AUTHORIZED, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        cg.add(var.register_on_authorized_trigger(trigger))
+        await automation.build_automation(
+            trigger, [(cg.std_string, "x")], conf
+        )
+
+    for conf in config.get(CONF_ON_DENIED, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        cg.add(var.register_on_denied_trigger(trigger))
+        await automation.build_automation(
+            trigger, [(cg.std_string, "x")], conf
+        )
+
+    for conf in config.get(CONF_ON_FINISHED_WRITE, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        cg.add(var.register_on_finished_write_trigger(trigger))
+        await automation.build_automation(
+            trigger, [(cg.std_string, "x")], conf
+        )
+
+
+@automation.register_action(
+    "st25r.write_ndef",
+    ST25RWriteNdefAction,
+    cv.All(
+        cv.Schema(
+            {
+                cv.GenerateID(): cv.use_id(ST25R),
+                cv.Optional(CONF_URI): cv.templatable(cv.string),
+                cv.Optional(CONF_TEXT): cv.templatable(cv.string),
+                # Read-only in the capability container plus the static lock bits; irreversible
+                cv.Optional(CONF_LOCK, default=False): cv.boolean,
+            }
+        ),
+        cv.has_exactly_one_key(CONF_URI, CONF_TEXT),
+    ),
+)
+async def st25r_write_ndef_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    if CONF_URI in config:
+        template_ = await cg.templatable(config[CONF_URI], args, cg.std_string)
+        cg.add(var.set_uri(template_))
+    if CONF_TEXT in config:
+        template_ = await cg.templatable(config[CONF_TEXT], args, cg.std_string)
+        cg.add(var.set_text(template_))
+    cg.add(var.set_lock(config[CONF_LOCK]))
+    return var
+
+
+ST25R_ACTION_SCHEMA = automation.maybe_simple_id(
+    {
+        cv.GenerateID(): cv.use_id(ST25R),
+    }
+)
+
+
+@automation.register_action("st25r.format", ST25RFormatAction, ST25R_ACTION_SCHEMA)
+@automation.register_action("st25r.erase", ST25REraseAction, ST25R_ACTION_SCHEMA)
+async def st25r_simple_action_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+
+@automation.register_condition(
+    "st25r.is_writing", ST25RIsWritingCondition, ST25R_ACTION_SCHEMA
+)
+async def st25r_is_writing_to_code(config, condition_id, template_arg, args):
+    var = cg.new_Pvariable(condition_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
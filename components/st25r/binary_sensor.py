@@ -4,31 +4,11 @@ import esphome.config_validation as cv
 from esphome.const import CONF_UID
 from esphome.core import HexInt
 
-from . import CONF_ST25R_ID, ST25R, st25r_ns
+from . import CONF_ST25R_ID, ST25R, st25r_ns, validate_uid
 
 DEPENDENCIES = ["st25r"]
 
 
-def validate_uid(value):
-    value = cv.string_strict(value)
-    for x in value.split("-"):
-        if len(x) != 2:
-            raise cv.Invalid(
-                "Each part (separated by '-') of the UID must be two characters long."
-            )
-        try:
-            x = int(x, 16)
-        except ValueError as err:
-            raise cv.Invalid(
-                "Valid characters for parts of a UID are 0123456789ABCDEF."
-            ) from err
-        if x < 0 or x > 255:
-            raise cv.Invalid(
-                "Valid values for UID parts (separated by '-') are 00 to FF"
-            )
-    return value
-
-
 ST25RBinarySensor = st25r_ns.class_("ST25RBinarySensor", binary_sensor.BinarySensor)
 
 CONFIG_SCHEMA = binary_sensor.binary_sensor_schema(ST25RBinarySensor).extend(
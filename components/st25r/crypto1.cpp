@@ -0,0 +1,70 @@
+#include "crypto1.h"
+
+namespace esphome {
+namespace st25r {
+
+// Feedback taps of the 48-bit LFSR, split into odd and even bit positions
+static const uint32_t LF_POLY_ODD = 0x29CE5C;
+static const uint32_t LF_POLY_EVEN = 0x870804;
+
+static uint32_t swap_endian(uint32_t x) {
+  x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+void Crypto1::init(uint64_t key) {
+  this->odd_ = 0;
+  this->even_ = 0;
+  for (int i = 47; i > 0; i -= 2) {
+    this->odd_ = (this->odd_ << 1) | ((key >> ((i - 1) ^ 7)) & 1);
+    this->even_ = (this->even_ << 1) | ((key >> (i ^ 7)) & 1);
+  }
+}
+
+uint8_t Crypto1::bit(uint8_t in, bool encrypted) {
+  uint8_t ret = filter_(this->odd_);
+  uint32_t feedin = (encrypted ? ret : 0) ^ (in & 1);
+  feedin ^= LF_POLY_ODD & this->odd_;
+  feedin ^= LF_POLY_EVEN & this->even_;
+  uint32_t even = (this->even_ << 1) | __builtin_parity(feedin);
+  // The new bit lands in the even half, which becomes the odd half for the next clock.
+  this->even_ = this->odd_;
+  this->odd_ = even;
+  return ret;
+}
+
+uint8_t Crypto1::byte(uint8_t in, bool encrypted) {
+  uint8_t ret = 0;
+  for (int i = 0; i < 8; i++)
+    ret |= this->bit(in >> i, encrypted) << i;
+  return ret;
+}
+
+uint32_t Crypto1::word(uint32_t in, bool encrypted) {
+  uint32_t ret = 0;
+  for (int i = 0; i < 32; i++)
+    ret |= (uint32_t) this->bit(in >> (i ^ 24), encrypted) << (i ^ 24);
+  return ret;
+}
+
+void Crypto1::encrypt(const uint8_t *plain, uint8_t *data, uint8_t *parity, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    data[i] = plain[i] ^ this->byte(0, false);
+    parity[i] = odd_parity(plain[i]) ^ this->peek();
+  }
+}
+
+void Crypto1::decrypt(uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    data[i] ^= this->byte(0, false);
+}
+
+uint32_t Crypto1::prng_successor(uint32_t x, uint32_t n) {
+  x = swap_endian(x);
+  while (n--)
+    x = (x >> 1) | (((x >> 16) ^ (x >> 18) ^ (x >> 19) ^ (x >> 21)) << 31);
+  return swap_endian(x);
+}
+
+}  // namespace st25r
+}  // namespace esphome
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace st25r {
+
+/// Crypto1 stream cipher of Mifare Classic.
+///
+/// The 48-bit LFSR is kept as two 24-bit halves holding the odd and the even bits, so the filter
+/// function reads its 20 input bits from one word: five 4-bit lookups packed into constants and a
+/// final 5-bit lookup, no bit gathering. Feedback is the parity of both halves masked with the
+/// feedback polynomial. Nonces and words are big-endian, i.e. the first byte on air in bits 31:24.
+class Crypto1 {
+ public:
+  /// Load a 6-byte key, first byte in bits 47:40.
+  void init(uint64_t key);
+  /// Clock once, feeding in (XORed with the keystream bit if encrypted); returns the keystream bit.
+  uint8_t bit(uint8_t in, bool encrypted);
+  /// Eight clocks, LSB first.
+  uint8_t byte(uint8_t in, bool encrypted);
+  /// 32 clocks, first byte on air first.
+  uint32_t word(uint32_t in, bool encrypted);
+  /// Keystream bit of the next clock without clocking; encrypts the parity bit after each byte.
+  uint8_t peek() const { return filter_(this->odd_); }
+
+  /// Encrypt plain bytes that are not fed back into the cipher. parity gets the encrypted odd
+  /// parity bit of each byte.
+  void encrypt(const uint8_t *plain, uint8_t *data, uint8_t *parity, size_t len);
+  /// Decrypt received bytes in place.
+  void decrypt(uint8_t *data, size_t len);
+
+  /// The card's 16-bit LFSR nonce generator, n steps on.
+  static uint32_t prng_successor(uint32_t x, uint32_t n);
+  static uint8_t odd_parity(uint8_t x) { return !__builtin_parity(x); }
+
+ protected:
+  static uint8_t filter_(uint32_t x) {
+    uint32_t f = (0xf22c0 >> (x & 0xf)) & 16;
+    f |= (0x6c9c0 >> ((x >> 4) & 0xf)) & 8;
+    f |= (0x3c8b0 >> ((x >> 8) & 0xf)) & 4;
+    f |= (0x1e458 >> ((x >> 12) & 0xf)) & 2;
+    f |= (0x0d938 >> ((x >> 16) & 0xf)) & 1;
+    return (0xEC57E80A >> f) & 1;
+  }
+
+  uint32_t odd_{0};
+  uint32_t even_{0};
+};
+
+}  // namespace st25r
+}  // namespace esphome
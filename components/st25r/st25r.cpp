@@ -1,8 +1,10 @@
 #include "st25r.h"
 #include "esphome/core/log.h"
 #include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
 #include "esphome/components/nfc/nfc_tag.h"
 #include <cinttypes>
+#include <cstring>
 #include <algorithm>
 
 namespace esphome {
@@ -10,6 +12,260 @@ namespace st25r {
 
 static const char *const TAG = "st25r";
 
+// WAKE_UP_TIMER_CONTROL
+static const uint8_t WUT_WUR = 0x80;  // 10 ms timer resolution instead of 100 ms
+static const uint8_t WUT_WAM = 0x04;
+static const uint8_t WUT_WPH = 0x02;
+static const uint8_t WUT_WCAP = 0x01;
+// Field on 5 ms before the first command (ISO14443-3 guard time)
+static const uint32_t FIELD_GUARD_TIME_MS = 5;
+// The crystal oscillator is typically stable within 1 ms of being enabled.
+static const uint32_t OSCILLATOR_TIMEOUT_MS = 10;
+// Time loop() spends dispatching queued events before it goes back to the state machine
+static const uint32_t EVENT_DISPATCH_BUDGET_US = 5000;
+
+// Type 2 commands
+static const uint8_t T2_READ = 0x30;
+static const uint8_t T2_GET_VERSION = 0x60;
+static const uint8_t T2_FAST_READ = 0x3A;
+static const uint8_t T2_CC_PAGE = 3;
+static const uint8_t T2_PAGE_SIZE = 4;
+static const uint8_t T2_FIRST_CHUNK_PAGES = 16;
+static const uint8_t T2_WRITE = 0xA2;
+// ACK and NAK are 4-bit frames without CRC
+static const uint8_t T2_ACK = 0x0A;
+// Page programming takes up to 4.1 ms on NTAG21x
+static const uint32_t T2_WRITE_TIMEOUT_US = 10000;
+// Static lock bytes in bytes 2-3; the first two bytes of the page are not writable.
+static const uint8_t T2_LOCK_PAGE = 2;
+static const uint8_t T2_STATIC_LOCK[4] = {0x00, 0x00, 0xFF, 0xFF};
+// The TLV area starts at page 4
+static const uint32_t T2_DATA_ADDRESS = 16;
+// Capability container: magic, version 1.0, data area size / 8, read/write access
+static const uint8_t T2_CC_MAGIC = 0xE1;
+static const uint8_t T2_CC_VERSION = 0x10;
+static const uint8_t T2_CC_READ_ONLY = 0x0F;
+
+// ISO14443-4 (ISO-DEP)
+static const uint8_t ISO_DEP_RATS = 0xE0;
+static const uint8_t ISO_DEP_PPSS = 0xD0;
+// FSDI 8: the card may send frames of up to 256 bytes
+static const uint8_t ISO_DEP_FSDI = 8;
+static const uint16_t ISO_DEP_FSC_TABLE[] = {16, 24, 32, 40, 48, 64, 96, 128, 256, 512, 1024, 2048, 4096};
+static const uint8_t ISO_DEP_PCB_I = 0x02;
+static const uint8_t ISO_DEP_PCB_CHAINING = 0x10;
+static const uint8_t ISO_DEP_PCB_R_ACK = 0xA2;
+static const uint8_t ISO_DEP_PCB_R_NAK = 0xB2;
+static const uint8_t ISO_DEP_PCB_S_DESELECT = 0xC2;
+static const uint8_t ISO_DEP_PCB_S_WTX = 0xF2;
+// PCB and CRC around the INF field
+static const uint8_t ISO_DEP_BLOCK_OVERHEAD = 3;
+static const uint8_t ISO_DEP_MAX_RETRIES = 2;
+// Frame waiting time: 256*16/fc << FWI; FWI 4 until the ATS tells, 14 at most
+static const uint32_t ISO_DEP_FWT_UNIT_US = 302;
+static const uint8_t ISO_DEP_DEFAULT_FWI = 4;
+static const uint32_t ISO_DEP_FWT_MAX_US = 4949000;
+// Activation frame waiting time, 65536/fc
+static const uint32_t ISO_DEP_ACTIVATION_US = 4833;
+
+// NFC Forum Type 4: NDEF tag application, capability container file, largest short Le
+static const uint8_t T4_NDEF_APP[] = {0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01};
+static const uint16_t T4_CC_FILE = 0xE103;
+static const uint8_t T4_CC_LENGTH = 15;
+static const uint8_t T4_MAX_LE = 0xFF;
+static const char *const NFC_FORUM_TYPE_4 = "NFC Forum Type 4";
+
+// Mifare Classic
+static const uint8_t MFC_AUTH_A = 0x60;
+static const uint8_t MFC_AUTH_B = 0x61;
+static const uint8_t MFC_READ = 0x30;
+static const uint8_t MFC_BLOCK_SIZE = 16;
+static const uint32_t MFC_TIMEOUT_US = 2500;
+// ISO14443A_CONF no_tx_par/no_rx_par: parity bits go through the FIFO. AUX no_crc_rx.
+static const uint8_t MFC_RAW_ISO14443A_CONF = 0xC0;
+static const uint8_t MFC_RAW_AUX = 0x90;
+// MAD application ID of NDEF sectors, as stored
+static const uint8_t MFC_NDEF_AID[2] = {0x03, 0xE1};
+
+// ISO15693 request flags and commands
+static const uint8_t V_FLAG_HIGH_RATE = 0x02;
+static const uint8_t V_FLAG_INVENTORY = 0x04;
+static const uint8_t V_FLAG_ADDRESS = 0x20;
+static const uint8_t V_RESPONSE_ERROR = 0x01;
+static const uint8_t V_INVENTORY = 0x01;
+static const uint8_t V_READ_MULTIPLE_BLOCKS = 0x23;
+static const uint8_t V_UID_LENGTH = 8;
+static const uint8_t V_MAX_BLOCKS_PER_READ = 32;
+// Capability container and the start of the TLV area on tags with 4-byte blocks
+static const uint8_t V_FIRST_CHUNK_BLOCKS = 8;
+// Mask bits after which a slot collision is given up on (UID is 64 bits)
+static const uint8_t V_MAX_MASK_LENGTH = 60;
+// VICC SOF and EOF in stream bits, 5 bits each: one bit per 256/fc half bit, 1 = subcarrier present
+static const uint8_t V_STREAM_SOF = 0x17;
+static const uint8_t V_STREAM_EOF = 0x1D;
+static const char *const NFC_FORUM_TYPE_5 = "NFC Forum Type 5";
+
+// FeliCa commands and NFC Forum Type 3 parameters
+static const uint8_t F_SENSF_REQ = 0x00;
+static const uint8_t F_SENSF_RES = 0x01;
+static const uint8_t F_READ_WITHOUT_ENCRYPTION = 0x06;
+// SENSF_REQ request code: append the system code to the answer
+static const uint8_t F_REQUEST_SYSTEM_CODE = 0x01;
+static const uint16_t F_SYSTEM_CODE_NDEF = 0x12FC;
+static const uint16_t F_SERVICE_NDEF_READ = 0x000B;
+static const uint8_t F_IDM_LENGTH = 8;
+static const uint8_t F_BLOCK_SIZE = 16;
+// LEN, response code, IDm, status flags 1 and 2, number of blocks
+static const uint8_t F_READ_HEADER = 13;
+// The response LEN byte counts at most 255 bytes: 13 + 15 blocks
+static const uint8_t F_MAX_BLOCKS_PER_READ = 15;
+// Attribute information block plus the first data blocks, what a FeliCa Lite-S returns at once
+static const uint8_t F_FIRST_CHUNK_BLOCKS = 4;
+// SENSF_RES slot 0 opens 512*64/fc after the request, every slot lasts 256*64/fc
+static const uint32_t F_FIRST_SLOT_US = 2417;
+static const uint32_t F_SLOT_US = 1208;
+static const uint32_t F_MIN_LISTEN_US = 400;
+// SENSF_REQ repeated within a round while cards keep picking the same slot
+static const uint8_t F_MAX_POLLS = 3;
+static const char *const NFC_FORUM_TYPE_3 = "NFC Forum Type 3";
+static const char *const FELICA = "FeliCa";
+
+// CRC_A (ISO14443-3A): reflected 0x1021, preset 0x6363
+static uint16_t crc_a(const uint8_t *data, size_t len) {
+  uint16_t crc = 0x6363;
+  for (size_t i = 0; i < len; i++) {
+    uint8_t b = data[i] ^ (crc & 0xFF);
+    b ^= b << 4;
+    crc = (crc >> 8) ^ ((uint16_t) b << 8) ^ ((uint16_t) b << 3) ^ (b >> 4);
+  }
+  return crc;
+}
+
+// MAD CRC-8: polynomial 0x1D, preset 0xC7
+static uint8_t crc_mad(const uint8_t *data, size_t len) {
+  uint8_t crc = 0xC7;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1;
+  }
+  return crc;
+}
+
+// Sectors 0-31 have 4 blocks, sectors 32-39 of a 4K card 16; the last block is the trailer.
+static uint8_t mfc_first_block(uint8_t sector) { return sector < 32 ? sector * 4 : 128 + (sector - 32) * 16; }
+static uint8_t mfc_block_count(uint8_t sector) { return sector < 32 ? 4 : 16; }
+
+// CRC-16/ISO15693: reflected 0x1021, preset 0xFFFF, inverted
+static uint16_t crc_15693(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 0x0001) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+  }
+  return ~crc;
+}
+
+std::string ST25RUid::to_string() const {
+  static const char HEX_CHARS[] = "0123456789ABCDEF";
+  std::string out(this->length * 2, '0');
+  for (uint8_t i = 0; i < this->length; i++) {
+    out[i * 2] = HEX_CHARS[this->data[i] >> 4];
+    out[i * 2 + 1] = HEX_CHARS[this->data[i] & 0x0F];
+  }
+  return out;
+}
+
+const char *tag_model_to_string(ST25RTagModel model) {
+  switch (model) {
+    case TAG_MODEL_MIFARE_CLASSIC:
+      return "Mifare Classic";
+    case TAG_MODEL_ISO_DEP:
+      return "ISO14443-4";
+    case TAG_MODEL_TYPE_2:
+      return "Type 2";
+    case TAG_MODEL_ULTRALIGHT_EV1:
+      return "Ultralight EV1";
+    case TAG_MODEL_NTAG213:
+      return "NTAG213";
+    case TAG_MODEL_NTAG215:
+      return "NTAG215";
+    case TAG_MODEL_NTAG216:
+      return "NTAG216";
+    case TAG_MODEL_TYPE_5:
+      return "ISO15693";
+    case TAG_MODEL_FELICA:
+      return "FeliCa";
+    default:
+      return "Unknown";
+  }
+}
+
+const char *timing_to_string(ST25RTiming timing) {
+  switch (timing) {
+    case TIMING_UPDATE:
+      return "update()";
+    case TIMING_LOOP:
+      return "loop()";
+    case TIMING_EXCHANGE:
+      return "Exchange";
+    case TIMING_ROUND:
+      return "Discovery round";
+    case TIMING_ACTIVATE:
+      return "WUPA/REQA";
+    case TIMING_CASCADE_1:
+      return "Cascade level 1";
+    case TIMING_CASCADE_2:
+      return "Cascade level 2";
+    case TIMING_CASCADE_3:
+      return "Cascade level 3";
+    case TIMING_SELECT:
+      return "SELECT";
+    case TIMING_TAG_READ:
+      return "Tag read";
+    default:
+      return "Unknown";
+  }
+}
+
+void ST25RHistogram::add(uint32_t value) {
+  if (this->count == 0 || value < this->min)
+    this->min = value;
+  if (value > this->max)
+    this->max = value;
+  this->count++;
+  this->sum += value;
+  uint8_t bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+  this->buckets[std::min<uint8_t>(bucket, BUCKETS - 1)]++;
+}
+
+uint32_t ST25RHistogram::percentile(uint8_t p) const {
+  if (this->count == 0)
+    return 0;
+  uint32_t rank = std::max<uint32_t>(1, ((uint64_t) this->count * p + 99) / 100);
+  uint32_t below = 0;
+  for (uint8_t i = 0; i < BUCKETS; i++) {
+    if (below + this->buckets[i] < rank) {
+      below += this->buckets[i];
+      continue;
+    }
+    if (i == 0)
+      return 0;
+    uint32_t low = std::max<uint32_t>(1u << (i - 1), this->min);
+    uint32_t high = i == BUCKETS - 1 ? this->max : std::min<uint32_t>((1u << i) - 1, this->max);
+    return low + (uint64_t) (high - low) * (rank - below) / this->buckets[i];
+  }
+  return this->max;
+}
+
+nfc::NfcTagUid ST25RUid::to_nfc_uid() const {
+  nfc::NfcTagUid uid;
+  for (uint8_t i = 0; i < this->length; i++)
+    uid.push_back(this->data[i]);
+  return uid;
+}
+
 void ST25R::isr(ST25R *arg) {
   arg->irq_triggered_ = true;
 }
@@ -27,8 +283,14 @@ void ST25R::setup() {
   if (this->irq_pin_ != nullptr) {
     this->irq_pin_->setup();
     this->irq_pin_->attach_interrupt(ST25R::isr, this, gpio::INTERRUPT_RISING_EDGE);
+    this->irq_polling_ = false;
   }
 
+  this->ndef_buffer_.reserve(NDEF_BUFFER_SIZE);
+#ifdef USE_ST25R_TRACE
+  // Allocated before the reset so the trace of a capture from boot starts with it.
+  this->trace_.init(this->trace_size_, this->trace_stop_when_full_);
+#endif
   if (!this->reset_()) {
     ESP_LOGE(TAG, "Failed to reset chip");
     if (this->status_binary_sensor_ != nullptr) {
@@ -40,14 +302,46 @@ void ST25R::setup() {
   if (this->status_binary_sensor_ != nullptr) {
     this->status_binary_sensor_->publish_initial_state(true);
   }
+  if (this->stats_interval_ > 0) {
+    this->stats_ = make_unique<ST25RStats>();
+    this->set_interval("stats", this->stats_interval_, [this]() { this->publish_stats_(); });
+  }
+  if (this->wake_up_ && this->rf_field_enabled_)
+    this->enter_wake_up_();
+  if (this->scheduled_field_off_ && this->rf_field_enabled_)
+    this->enter_field_off_();
   ESP_LOGCONFIG(TAG, "ST25R initialized successfully.");
 }
 
 void ST25R::update() {
-  if (this->is_failed() || this->state_ != STATE_IDLE) return;
+  this->record_trace_(TRACE_UPDATE, 0);
+  if (this->stats_ == nullptr) {
+    this->run_update_();
+    return;
+  }
+  uint32_t start = micros();
+  this->run_update_();
+  this->stats_->timings[TIMING_UPDATE].add(micros() - start);
+}
+
+void ST25R::run_update_() {
+  if (this->is_failed()) return;
+  if (this->suppressed_taps_sensor_ != nullptr && this->suppressed_taps_ != this->suppressed_taps_published_) {
+    this->suppressed_taps_published_ = this->suppressed_taps_;
+    this->suppressed_taps_sensor_->publish_state(this->suppressed_taps_);
+  }
+  // The health check also runs while the wake-up timer or the scheduler has the field switched off.
+  if (this->state_ != STATE_IDLE && this->state_ != STATE_WAKE_UP && this->state_ != STATE_FIELD_OFF) {
+    // With fast polling, presence checks or a scheduler a scan is often in flight; run the health
+    // check, and the round after it, once it finishes.
+    if (this->fast_poll_ || this->scheduled_ || this->presence_check_interval_ > 0)
+      this->health_check_pending_ = true;
+    return;
+  }
+  this->health_check_pending_ = false;
 
   uint8_t ic_identity = this->read_register(IC_IDENTITY);
-  if ((ic_identity >> 3) != 0x05) {
+  if ((ic_identity >> 3) != ST25R_VARIANTS[this->variant_].ic_type) {
     this->health_check_failures_++;
     if (this->status_binary_sensor_ != nullptr) {
       this->status_binary_sensor_->publish_state(false);
@@ -63,362 +357,2856 @@ void ST25R::update() {
     this->status_binary_sensor_->publish_state(true);
   }
 
+  if (this->state_ != STATE_IDLE)
+    return;
+
   if (this->rf_field_enabled_ && this->field_strength_sensor_ != nullptr) {
-    this->write_command(ST25R_CMD_MEASURE_AMPLITUDE);
-    uint8_t amplitude = this->read_register(AD_CONV_RESULT);
-    this->field_strength_sensor_->publish_state(amplitude);
+    this->field_strength_sensor_->publish_state(this->measure_(ST25R_CMD_MEASURE_AMPLITUDE));
   }
 
-  this->read_register(IRQ_MAIN);
-  this->read_register(IRQ_TIMER);
-  this->read_register(IRQ_ERROR);
-  this->write_command(ST25R_CMD_CLEAR_FIFO);
+  // Fast polling starts discoveries from loop() on its own cadence, a scheduler when it is this
+  // reader's turn.
+  if (!this->fast_poll_ && !this->scheduled_)
+    this->start_discovery_();
+}
+
+void ST25R::start_discovery_() {
+  if (this->stats_ != nullptr) {
+    this->stats_->round_start = micros();
+    this->stats_->round_bus = this->bus_;
+  }
+#ifdef USE_ST25R_TRACE
+  uint8_t snapshot[4 + MAX_TAGS_PER_ROUND * (1 + ST25RUid::MAX_LENGTH)];
+  this->record_trace_(TRACE_ROUND, 0, snapshot, this->round_snapshot_(snapshot, sizeof(snapshot)));
+#endif
+  uint8_t irqs[3];
+  this->read_registers(IRQ_MAIN, irqs, sizeof(irqs));
 
   if (this->rf_field_enabled_) {
     this->write_register(OP_CONTROL, 0xC8); 
   }
 
-  this->irq_triggered_ = false;
-  this->write_command(ST25R_CMD_TRANSMIT_WUPA);
-  delay(1);
-  this->state_ = STATE_WUPA;
+  for (auto &tag : this->present_tags_)
+    tag.seen = false;
+  this->round_tags_ = 0;
+  this->set_protocol_(PROTOCOL_NFC_A);
+  // WUPA also wakes the tags halted during the previous round.
+  this->activate_(ST25R_CMD_TRANSMIT_WUPA);
+  // Step through the exchanges of a scan at full loop rate instead of one per loop interval.
+  this->high_freq_.start();
+}
+
+void ST25R::activate_(uint8_t command) {
+  this->cascade_level_ = 0;
+  this->current_uid_.clear();
+  this->start_phase_();
+  this->transceive_(nullptr, 0, 1000, command);
+  this->set_state_(STATE_WUPA);
+}
+
+void ST25R::schedule_next_discovery_() {
+  uint32_t now = millis();
+  this->last_discovery_ = now;
+  if (now - this->last_activity_ < this->fast_poll_hold_time_) {
+    this->poll_interval_ = this->fast_poll_min_interval_;
+  } else {
+    // Idle: back off geometrically towards the slowest configured period.
+    uint32_t next = this->poll_interval_ + this->poll_interval_ / 2 + 1;
+    this->poll_interval_ = std::min(next, this->fast_poll_max_interval_);
+  }
+}
+
+bool ST25R::start_scheduled_round() {
+  if (this->is_failed() || this->health_check_failures_ != 0)
+    return false;
+  if (this->state_ == STATE_FIELD_OFF) {
+    // Tags need the field for the guard time before the first command.
+    this->write_register(OP_CONTROL, 0xC8);
+    this->set_state_(STATE_FIELD_SETTLE);
+    this->high_freq_.start();
+    return true;
+  }
+  if (this->state_ != STATE_IDLE)
+    return false;
+  this->start_discovery_();
+  return true;
+}
+
+void ST25R::enter_field_off_() {
+  // en=1, rx_en=0, tx_en=0
+  this->write_register(OP_CONTROL, 0x80);
+  this->set_state_(STATE_FIELD_OFF);
+}
+
+void ST25R::set_state_(State state) {
+  this->state_ = state;
   this->last_state_change_ = millis();
 }
 
-bool ST25R::transceive_(const uint8_t *data, size_t len, uint8_t *resp, uint8_t &resp_len, uint32_t timeout_ms) {
-  this->write_command(ST25R_CMD_CLEAR_FIFO);
-  this->read_register(IRQ_MAIN); 
+void ST25R::finish_scan_(bool found) {
+  this->set_mfc_raw_mode_(false);
+  // The same round goes on with the next enabled technology: NFC-A, NFC-V, then NFC-F.
+  if (this->protocol_ == PROTOCOL_NFC_A && this->nfc_v_) {
+    this->start_nfcv_round_();
+    return;
+  }
+  if (this->protocol_ != PROTOCOL_NFC_F && this->nfc_f_) {
+    this->start_nfcf_round_();
+    return;
+  }
+  this->state_ = STATE_IDLE;
+  this->skip_get_version_ = false;
+  this->high_freq_.stop();
+  if (this->stats_ != nullptr) {
+    ST25RStats &stats = *this->stats_;
+    stats.rounds++;
+    stats.timings[TIMING_ROUND].add(micros() - stats.round_start);
+    stats.register_reads.add(this->bus_.register_reads - stats.round_bus.register_reads);
+    stats.register_writes.add(this->bus_.register_writes - stats.round_bus.register_writes);
+    stats.fifo_bytes.add(this->bus_.fifo_bytes - stats.round_bus.fifo_bytes);
+  }
+  // A round cut short by an error still found the tags resolved before it.
+  found = found || this->round_tags_ > 0;
+  size_t was_present = this->present_tags_.size();
+  this->process_tag_removed_();
+  // The round just saw every tag that answered.
+  this->last_presence_check_ = millis();
+  if (found || was_present != this->present_tags_.size())
+    this->last_activity_ = millis();
+  if (this->fast_poll_)
+    this->schedule_next_discovery_();
+  // Nothing (left) in the field: switch it off until the wake-up timer sees a change.
+  if (this->wake_up_ && this->rf_field_enabled_ && this->present_tags_.empty())
+    this->enter_wake_up_();
+  // The next reader's field comes on next to this one.
+  if (this->scheduled_field_off_ && this->rf_field_enabled_)
+    this->enter_field_off_();
+}
 
-  this->write_fifo(data, len);
-  this->write_register(NUM_TX_BYTES1, (len >> 8) & 0xFF);
-  this->write_register(NUM_TX_BYTES2, (len & 0x1F) << 3); 
-  
-  this->irq_triggered_ = false;
-  this->write_command(ST25R_CMD_TRANSMIT_WITH_CRC);
-  
-  uint32_t start = millis();
-  while (millis() - start < timeout_ms) {
-    if (this->irq_triggered_) {
-      this->irq_triggered_ = false;
-      this->irq_status_ = this->read_register(IRQ_MAIN);
-      
-      if (this->irq_status_ & IRQ_RXE) { 
-        uint8_t f1 = this->read_register(FIFO_STATUS1);
-        resp_len = (f1 > 64) ? 64 : f1;
-        this->read_fifo(resp, resp_len);
-        return true;
-      }
-      if (this->irq_status_ & IRQ_ERR) return false; 
-    }
+bool ST25R::presence_check_due_() const {
+  if (this->presence_check_interval_ == 0 || this->state_ != STATE_IDLE || this->scheduled_ ||
+      !this->rf_field_enabled_ || this->health_check_failures_ != 0 ||
+      millis() - this->last_presence_check_ < this->presence_check_interval_)
+    return false;
+  return std::any_of(this->present_tags_.begin(), this->present_tags_.end(),
+                     [](const ST25RPresentTag &tag) { return tag.nfc_a; });
+}
+
+void ST25R::start_presence_check_() {
+  this->last_presence_check_ = millis();
+  this->presence_index_ = 0;
+  this->set_protocol_(PROTOCOL_NFC_A);
+  this->high_freq_.start();
+  this->presence_next_tag_();
+}
+
+void ST25R::presence_next_tag_() {
+  while (this->presence_index_ < this->present_tags_.size() && !this->present_tags_[this->presence_index_].nfc_a)
+    this->presence_index_++;
+  if (this->presence_index_ >= this->present_tags_.size()) {
+    this->finish_presence_check_();
+    return;
+  }
+  // WUPA also wakes the tags halted by the round or the previous check.
+  this->presence_level_ = 0;
+  this->transceive_(nullptr, 0, 1000, ST25R_CMD_TRANSMIT_WUPA);
+  this->set_state_(STATE_PRESENCE_WUPA);
+}
+
+void ST25R::presence_send_select_() {
+  static const uint8_t SEL_CMDS[] = {0x93, 0x95, 0x97};
+  const ST25RUid &uid = this->present_tags_[this->presence_index_].uid;
+  uint8_t levels = uid.length == 4 ? 1 : (uid.length == 7 ? 2 : 3);
+  uint8_t offset = this->presence_level_ * 3;
+  this->sel_[0] = SEL_CMDS[this->presence_level_];
+  this->sel_[1] = 0x70;
+  // Every level but the last starts with the cascade tag and carries 3 UID bytes.
+  if (this->presence_level_ + 1 < levels) {
+    this->sel_[2] = 0x88;
+    memcpy(this->sel_ + 3, uid.data + offset, 3);
+  } else {
+    memcpy(this->sel_ + 2, uid.data + offset, 4);
+  }
+  this->sel_[6] = this->sel_[2] ^ this->sel_[3] ^ this->sel_[4] ^ this->sel_[5];
+  this->transceive_(this->sel_, sizeof(this->sel_), 1000);
+  this->set_state_(STATE_PRESENCE_SELECT);
+}
+
+void ST25R::presence_process_select_(TransceiveResult result) {
+  if (result != TRANSCEIVE_OK || this->rx_len_ < 1) {
+    // Not there. Tags woken by the WUPA that the SELECT did not match are back in HALT.
+    this->presence_index_++;
+    this->presence_next_tag_();
+    return;
+  }
+  if ((this->rx_buffer_[0] & 0x04) && this->presence_level_ < 2) {
+    this->presence_level_++;
+    this->presence_send_select_();
+    return;
+  }
+  this->present_tags_[this->presence_index_].last_seen = millis();
+  const uint8_t hlta[2] = {0x50, 0x00};
+  this->transceive_(hlta, sizeof(hlta), 1000);
+  this->set_state_(STATE_PRESENCE_HALT);
+}
+
+void ST25R::finish_presence_check_() {
+  this->state_ = STATE_IDLE;
+  this->high_freq_.stop();
+  uint32_t now = millis();
+  size_t was_present = this->present_tags_.size();
+  for (auto it = this->present_tags_.begin(); it != this->present_tags_.end();) {
+    bool gone = it->nfc_a && now - it->last_seen >= this->presence_debounce_;
+    it = gone ? this->remove_present_tag_(it) : it + 1;
+  }
+  if (was_present == this->present_tags_.size())
+    return;
+  this->update_current_tag_();
+  this->last_activity_ = now;
+  if (this->wake_up_ && this->rf_field_enabled_ && this->present_tags_.empty())
+    this->enter_wake_up_();
+}
+
+uint8_t ST25R::measure_(uint8_t command) {
+  this->write_command(command);
+  // Amplitude, phase and capacitance measurements finish within ~25us.
+  delayMicroseconds(30);
+  return this->read_register(AD_RESULT);
+}
+
+void ST25R::enter_wake_up_() {
+  // References are measured right before the field goes off, so they follow antenna drift and
+  // objects left lying on the reader instead of waking up on them forever.
+  uint8_t timer;
+  if (this->wake_up_interval_ <= 80) {
+    timer = WUT_WUR | (((this->wake_up_interval_ / 10 - 1) & 0x07) << 4);
+  } else {
+    timer = ((this->wake_up_interval_ / 100 - 1) & 0x07) << 4;
+  }
+  uint8_t mask = 0x0F;
+  if (this->wake_up_amplitude_delta_ > 0) {
+    const uint8_t conf[2] = {(uint8_t) (this->wake_up_amplitude_delta_ << 4),
+                             this->measure_(ST25R_CMD_MEASURE_AMPLITUDE)};
+    this->write_registers(AMPLITUDE_MEASURE_CONF, conf, sizeof(conf));
+    timer |= WUT_WAM;
+    mask &= ~IRQ_WAM;
+  }
+  if (this->wake_up_phase_delta_ > 0) {
+    const uint8_t conf[2] = {(uint8_t) (this->wake_up_phase_delta_ << 4), this->measure_(ST25R_CMD_MEASURE_PHASE)};
+    this->write_registers(PHASE_MEASURE_CONF, conf, sizeof(conf));
+    timer |= WUT_WPH;
+    mask &= ~IRQ_WPH;
+  }
+  if (this->wake_up_capacitance_delta_ > 0) {
+    this->write_command(ST25R_CMD_CALIBRATE_C_SENSOR);
     delay(1);
+    const uint8_t conf[2] = {(uint8_t) (this->wake_up_capacitance_delta_ << 4),
+                             this->measure_(ST25R_CMD_MEASURE_CAPACITANCE)};
+    this->write_registers(CAPACITANCE_MEASURE_CONF, conf, sizeof(conf));
+    timer |= WUT_WCAP;
+    mask &= ~IRQ_WCAP;
   }
-  return false;
+  this->write_register(WAKE_UP_TIMER_CONTROL, timer);
+  this->write_register(MASK_ERROR, mask);
+
+  // Drop anything left over from the last exchange so only a wake-up event raises the IRQ line.
+  uint8_t irqs[3];
+  this->read_registers(IRQ_MAIN, irqs, sizeof(irqs));
+  this->irq_triggered_ = false;
+
+  // en=0, tx_en=0, wu=1: oscillator and field off, only the wake-up timer runs.
+  this->write_register(OP_CONTROL, 0x04);
+  this->set_state_(STATE_WAKE_UP);
 }
 
-std::unique_ptr<nfc::NfcTag> ST25R::read_tag_(std::vector<uint8_t> &uid) {
-  nfc::NfcTagUid tag_uid;
-  for (auto b : uid) tag_uid.push_back(b);
-  uint8_t type = nfc::guess_tag_type(uid.size());
-  
-  if (type == nfc::TAG_TYPE_2) {
-    std::vector<uint8_t> data;
-    uint8_t buffer[16];
-    uint8_t len;
-
-    uint8_t read_cmd[2] = {0x30, 0x03}; 
-    if (this->transceive_(read_cmd, 2, buffer, len) && len >= 16) {
-      data.insert(data.end(), buffer, buffer + 16);
-      
-      size_t tlv_index = 0;
-      bool found = false;
-      for (size_t i = 0; i < 15; i++) { 
-        if (data[i] == 0x03) {
-          tlv_index = i;
-          found = true;
-          break;
-        }
-      }
+void ST25R::exit_wake_up_() {
+  this->write_register(MASK_ERROR, 0x0F);
+  // The transmitter starts driving as soon as the oscillator is stable.
+  this->write_register(OP_CONTROL, 0xC8);
+  this->set_state_(STATE_FIELD_SETTLE);
+  this->high_freq_.start();
+}
 
-      if (found) {
-        uint8_t msg_len = data[tlv_index + 1];
-        size_t msg_start_idx = tlv_index + 2;
-        
-        while (data.size() < (size_t)(msg_start_idx + msg_len)) {
-          uint8_t next_page = data.size() / 4;
-          read_cmd[1] = next_page;
-          if (!this->transceive_(read_cmd, 2, buffer, len) || len < 16) break;
-          data.insert(data.end(), buffer, buffer + 16);
-        }
-        
-        if (data.size() >= (size_t)(msg_start_idx + msg_len)) {
-          std::vector<uint8_t> ndef_data(data.begin() + msg_start_idx, data.begin() + msg_start_idx + msg_len);
-          return make_unique<nfc::NfcTag>(tag_uid, nfc::NFC_FORUM_TYPE_2, ndef_data);
-        }
-      }
-    }
+void ST25R::set_no_response_timer_(uint32_t timeout_us) {
+  // No-response timer in 4096/fc steps (~302us), started by the chip at the end of transmission.
+  uint32_t nrt = (timeout_us * 1356 + 409599) / 409600;
+  if (nrt > 0xFFFF)
+    nrt = 0xFFFF;
+  if (nrt != this->no_response_timer_) {
+    // NO_RESPONSE_TIMER1 (MSB), NO_RESPONSE_TIMER2 (LSB), TIMER_EMV_CONTROL with nrt_step=4096/fc
+    const uint8_t timer[3] = {(uint8_t) (nrt >> 8), (uint8_t) (nrt & 0xFF), 0x01};
+    this->write_registers(NO_RESPONSE_TIMER1, timer, sizeof(timer));
+    this->no_response_timer_ = nrt;
+  }
+}
+
+void ST25R::transceive_(const uint8_t *data, size_t len, uint32_t timeout_us, uint8_t command, uint8_t last_bits) {
+  this->set_no_response_timer_(timeout_us);
+  this->write_command(ST25R_CMD_CLEAR_FIFO);
+  this->tx_pending_.clear();
+  this->tx_pending_pos_ = 0;
+  if (len > 0) {
+    size_t first = std::min<size_t>(len, FIFO_SIZE);
+    this->write_fifo(data, first);
+    // The rest follows from refill_fifo_() as the chip empties the FIFO.
+    if (first < len)
+      this->tx_pending_.assign(data + first, data + len);
+    // The bits of a split last byte are counted apart from the complete bytes.
+    this->set_num_tx_bytes_(last_bits != 0 ? len - 1 : len, last_bits);
   }
 
-  return make_unique<nfc::NfcTag>(tag_uid);
+  memset(this->irq_status_, 0, sizeof(this->irq_status_));
+  this->rx_len_ = 0;
+  this->rx_last_bits_ = 0;
+  this->rx_overflow_ = false;
+  this->transceive_crc_ = command == ST25R_CMD_TRANSMIT_WITH_CRC;
+  this->transceive_busy_ = true;
+  this->transceive_start_ = millis();
+  if (this->stats_ != nullptr)
+    this->stats_->exchange_start = micros();
+  // Only guards against a lost interrupt; the no-response timer normally ends the exchange.
+  this->transceive_guard_ms_ = timeout_us / 1000 + 50;
+  this->irq_triggered_ = false;
+  this->write_command(command);
 }
 
-void ST25R::loop() {
-  if (this->is_failed()) return;
+void ST25R::receive_(uint32_t timeout_us) {
+  this->set_no_response_timer_(timeout_us);
+  memset(this->irq_status_, 0, sizeof(this->irq_status_));
+  this->rx_len_ = 0;
+  this->rx_last_bits_ = 0;
+  this->rx_overflow_ = false;
+  this->transceive_busy_ = true;
+  this->transceive_start_ = millis();
+  if (this->stats_ != nullptr)
+    this->stats_->exchange_start = micros();
+  this->transceive_guard_ms_ = timeout_us / 1000 + 50;
+  // The receiver stays on after a frame and the FIFO is not cleared, so a frame that is already
+  // coming in is kept; irq_triggered_ may already be set by it.
+  this->write_command(ST25R_CMD_START_NO_RESPONSE_TIMER);
+}
 
-  switch (this->state_) {
-    case STATE_IDLE:
-      break;
+ST25R::TransceiveResult ST25R::poll_transceive_() {
+  if (!this->transceive_busy_)
+    return TRANSCEIVE_ERROR;
 
-    case STATE_WUPA: {
-      if (millis() - this->last_state_change_ > 50) { 
-        this->state_ = STATE_IDLE;
-        this->process_tag_removed_(false);
-        return;
-      }
+  // Without an IRQ pin the interrupt registers are polled on every loop() iteration instead.
+  if (this->irq_polling_ || this->irq_triggered_) {
+    if (!this->irq_polling_)
+      this->record_trace_(TRACE_IRQ, 0);
+    this->irq_triggered_ = false;
+    uint8_t irqs[3];
+    this->read_registers(IRQ_MAIN, irqs, sizeof(irqs));
+    for (int i = 0; i < 3; i++)
+      this->irq_status_[i] |= irqs[i];
+  }
 
-      if (this->irq_triggered_) {
-        this->irq_triggered_ = false;
-        this->irq_status_ = this->read_register(IRQ_MAIN);
-        
-        if (this->irq_status_ & (IRQ_RXE | IRQ_TXE)) {
-          uint8_t f1 = this->read_register(FIFO_STATUS1);
-          if (f1 > 0) {
-            this->cascade_level_ = 0;
-            this->current_uid_ = "";
-            this->state_ = STATE_READ_UID;
-            this->last_state_change_ = millis();
-            this->write_command(ST25R_CMD_CLEAR_FIFO);
-            uint8_t cl[] = {0x93, 0x20};
-            this->irq_triggered_ = false;
-            this->write_fifo(cl, 2);
-            this->write_register(NUM_TX_BYTES1, 0x00);
-            this->write_register(NUM_TX_BYTES2, 0x10); 
-            this->write_command(ST25R_CMD_TRANSMIT_WITHOUT_CRC);
-          } else {
-            this->state_ = STATE_IDLE;
-            this->process_tag_removed_(false);
-          }
-        }
-      }
-      break;
+  if (this->irq_status_[0] & IRQ_WL) {
+    // Water level: the FIFO runs low while sending or fills up while receiving.
+    this->irq_status_[0] &= ~IRQ_WL;
+    if (this->tx_pending_pos_ < this->tx_pending_.size()) {
+      this->refill_fifo_();
+    } else if (this->irq_status_[0] & IRQ_RXS) {
+      this->drain_fifo_();
     }
+  }
 
-    case STATE_READ_UID: {
-      if (millis() - this->last_state_change_ > 500) { 
-        this->state_ = STATE_IDLE;
-        this->process_tag_removed_(false);
-        return;
-      }
-
-      if (this->irq_triggered_) {
-        this->irq_triggered_ = false;
-        this->irq_status_ = this->read_register(IRQ_MAIN);
-        
-        if (this->irq_status_ & (IRQ_RXE | IRQ_TXE)) {
-          uint8_t f1 = this->read_register(FIFO_STATUS1);
-          
-          if (f1 == 0) {
-            this->state_ = STATE_IDLE;
-            this->process_tag_removed_(false);
-            return;
-          }
-
-          uint8_t resp[16];
-          uint8_t actual_len = (f1 > 16) ? 16 : f1;
-          this->read_fifo(resp, actual_len);
-          
-          if (resp[0] == 0x88) {
-            for (int i = 1; i < 4; i++) {
-              char buf[3];
-              sprintf(buf, "%02X", resp[i]);
-              this->current_uid_ += buf;
-            }
-            uint8_t sel_cmds[] = {0x93, 0x95, 0x97};
-            uint8_t sel_pk[7] = {sel_cmds[this->cascade_level_], 0x70, resp[0], resp[1], resp[2], resp[3], resp[4]};
-            this->write_command(ST25R_CMD_CLEAR_FIFO);
-            this->irq_triggered_ = false;
-            this->write_fifo(sel_pk, 7);
-            this->write_register(NUM_TX_BYTES1, 0x00);
-            this->write_register(NUM_TX_BYTES2, 0x38); 
-            this->write_command(ST25R_CMD_TRANSMIT_WITH_CRC);
-            
-            this->cascade_level_++;
-            delay(20); 
-            this->read_register(IRQ_MAIN); 
-            this->write_command(ST25R_CMD_CLEAR_FIFO);
-            uint8_t next_cl[] = {sel_cmds[this->cascade_level_], 0x20};
-            this->irq_triggered_ = false;
-            this->write_fifo(next_cl, 2);
-            this->write_register(NUM_TX_BYTES1, 0x00);
-            this->write_register(NUM_TX_BYTES2, 0x10); 
-            this->write_command(ST25R_CMD_TRANSMIT_WITHOUT_CRC);
-            this->last_state_change_ = millis();
-          } else {
-            for (int i = 0; i < 4; i++) {
-              char buf[3];
-              sprintf(buf, "%02X", resp[i]);
-              this->current_uid_ += buf;
-            }
-            
-            std::vector<uint8_t> uid_bytes;
-            for (size_t i = 0; i < this->current_uid_.length(); i += 2) {
-              std::string byteString = this->current_uid_.substr(i, 2);
-              uint8_t byte = (uint8_t) strtol(byteString.c_str(), nullptr, 16);
-              uid_bytes.push_back(byte);
-            }
-            
-            auto nfc_tag = this->read_tag_(uid_bytes);
-            if (nfc_tag->has_ndef_message()) {
-              auto &message = nfc_tag->get_ndef_message();
-              for (auto &record : message->get_records()) {
-                ESP_LOGI(TAG, "  NDEF Record type: %s", record->get_type().c_str());
-                ESP_LOGI(TAG, "  NDEF Payload: %s", record->get_payload().c_str());
-              }
-            }
-
-            if (!this->tag_present_ || this->tag_present_uid_ != this->current_uid_) {
-              this->tag_present_ = true;
-              this->tag_present_uid_ = this->current_uid_;
-
-              for (auto *listener : this->tag_listeners_) {
-                listener->tag_on(*nfc_tag);
-              }
-
-              for (auto *trigger : this->on_tag_triggers_) {
-                trigger->trigger(this->current_uid_);
-              }
-            }
-            for (auto *obj : this->binary_sensors_) obj->process(this->current_uid_);
-            this->state_ = STATE_IDLE;
-            this->process_tag_removed_(true);
-          }
-        }
-      }
-      break;
+  if (this->irq_status_[0] & IRQ_RXE) {
+    this->transceive_busy_ = false;
+    this->drain_fifo_();
+    // The received CRC is checked by the chip and handed to the FIFO, drop it.
+    if (this->transceive_crc_)
+      this->rx_len_ = (this->rx_len_ >= 2) ? this->rx_len_ - 2 : 0;
+    if (this->rx_overflow_) {
+      ESP_LOGW(TAG, "Receive FIFO overflow");
+      return TRANSCEIVE_ERROR;
     }
+    if (this->irq_status_[2] & (IRQ_CRC | IRQ_PAR | IRQ_ERR1 | IRQ_ERR2))
+      return TRANSCEIVE_ERROR;
+    return TRANSCEIVE_OK;
+  }
 
-    case STATE_REINITIALIZING:
-      this->reinitialize_();
-      this->state_ = STATE_IDLE;
-      break;
+  if (this->irq_status_[1] & IRQ_NRE) {
+    this->transceive_busy_ = false;
+    return TRANSCEIVE_TIMEOUT;
   }
+
+  if (millis() - this->transceive_start_ > this->transceive_guard_ms_) {
+    ESP_LOGV(TAG, "Exchange timed out without an interrupt");
+    this->transceive_busy_ = false;
+    this->write_command(ST25R_CMD_STOP_ALL);
+    return TRANSCEIVE_TIMEOUT;
+  }
+  return TRANSCEIVE_BUSY;
 }
 
-void ST25R::process_tag_removed_(bool found) {
-  for (auto *obj : this->binary_sensors_) obj->on_scan_end();
+void ST25R::drain_fifo_() {
+  // FIFO_STATUS1 holds fifo_b[7:0]; FIFO_STATUS2 fifo_b[9:8], overflow and the last-byte bit count.
+  uint8_t status[2];
+  this->read_registers(FIFO_STATUS1, status, sizeof(status));
+  size_t count = status[0] | ((size_t) (status[1] & 0xC0) << 2);
+  this->rx_last_bits_ = (status[1] >> 1) & 0x07;
+  if (status[1] & FIFO_OVERFLOW)
+    this->rx_overflow_ = true;
+  size_t room = sizeof(this->rx_buffer_) - this->rx_len_;
+  if (count > room) {
+    this->rx_overflow_ = true;
+    count = room;
+  }
+  if (count == 0)
+    return;
+  this->read_fifo(this->rx_buffer_ + this->rx_len_, count);
+  this->rx_len_ += count;
+}
 
-  if (found) {
-    this->missed_updates_ = 0;
+void ST25R::refill_fifo_() {
+  uint8_t status[2];
+  this->read_registers(FIFO_STATUS1, status, sizeof(status));
+  size_t used = status[0] | ((size_t) (status[1] & 0xC0) << 2);
+  size_t room = used < FIFO_SIZE ? FIFO_SIZE - used : 0;
+  size_t count = std::min(room, this->tx_pending_.size() - this->tx_pending_pos_);
+  if (count == 0)
     return;
+  this->write_fifo(this->tx_pending_.data() + this->tx_pending_pos_, count);
+  this->tx_pending_pos_ += count;
+}
+
+void ST25R::send_anticollision_() {
+  static const uint8_t SEL_CMDS[] = {0x93, 0x95, 0x97};
+  memset(this->sel_, 0, sizeof(this->sel_));
+  this->sel_[0] = SEL_CMDS[this->cascade_level_];
+  this->sel_bits_ = 16;
+  this->send_anticollision_frame_();
+}
+
+void ST25R::send_anticollision_frame_() {
+  uint8_t bytes = this->sel_bits_ / 8;
+  uint8_t bits = this->sel_bits_ % 8;
+  // NVB: complete bytes sent including SEL and NVB, then the bits of a split last byte
+  this->sel_[1] = (bytes << 4) | bits;
+  this->set_anticollision_mode_(true);
+  this->transceive_(this->sel_, bytes + (bits != 0 ? 1 : 0), 1000, ST25R_CMD_TRANSMIT_WITHOUT_CRC, bits);
+  this->set_state_(STATE_READ_UID);
+}
+
+bool ST25R::process_anticollision_() {
+  // In anticollision mode the answer is received at its bit position in the frame, so the first
+  // byte completes the split byte that was sent.
+  uint8_t first = this->sel_bits_ / 8;
+  uint8_t known = (1 << (this->sel_bits_ % 8)) - 1;
+  for (uint16_t i = 0; i < this->rx_len_ && first + i < sizeof(this->sel_); i++) {
+    uint8_t keep = i == 0 ? known : 0;
+    this->sel_[first + i] = (this->sel_[first + i] & keep) | (this->rx_buffer_[i] & ~keep);
+  }
+  if (!(this->irq_status_[0] & IRQ_COL)) {
+    if (first + this->rx_len_ < sizeof(this->sel_))
+      return false;
+    this->sel_bits_ = sizeof(this->sel_) * 8;
+    return true;
   }
 
-  if (this->tag_present_) {
-    this->missed_updates_++;
-    if (this->missed_updates_ >= 3) {
-      ESP_LOGI(TAG, "Tag Removed: %s", this->tag_present_uid_.c_str());
+  this->record_collision_();
+  // COLLISION_STATUS: c_byte in bits 7:4 and c_bit in bits 3:1, counted from the start of the frame
+  uint8_t status = this->read_register(COLLISION_STATUS);
+  uint8_t pos = (status >> 4) * 8 + ((status >> 1) & 0x07);
+  if (pos < this->sel_bits_ || pos >= sizeof(this->sel_) * 8)
+    return false;
+  // Everything from the collision on is garbage. Follow the tags that sent a 1 there; the others
+  // drop out at SELECT and answer a later REQA of the round.
+  uint8_t byte = pos / 8;
+  this->sel_[byte] = (this->sel_[byte] & ((1 << (pos % 8)) - 1)) | (1 << (pos % 8));
+  memset(this->sel_ + byte + 1, 0, sizeof(this->sel_) - byte - 1);
+  this->sel_bits_ = pos + 1;
+  ESP_LOGV(TAG, "Collision at bit %u of cascade level %u", pos, this->cascade_level_ + 1);
+  return true;
+}
 
-      std::vector<uint8_t> uid_bytes;
-      for (size_t i = 0; i < this->tag_present_uid_.length(); i += 2) {
-        std::string byteString = this->tag_present_uid_.substr(i, 2);
-        uint8_t byte = (uint8_t) strtol(byteString.c_str(), nullptr, 16);
-        uid_bytes.push_back(byte);
-      }
-      nfc::NfcTagUid tag_uid;
-      for (auto b : uid_bytes) tag_uid.push_back(b);
-      nfc::NfcTag nfc_tag(tag_uid);
-      for (auto *listener : this->tag_listeners_) {
-        listener->tag_off(nfc_tag);
-      }
+void ST25R::set_anticollision_mode_(bool enabled) {
+  if (enabled == this->anticollision_mode_)
+    return;
+  // ISO14443A_CONF antcl: bit-oriented anticollision frames, collisions reported in COLLISION_STATUS
+  this->write_register(ISO14443A_CONF, enabled ? 0x01 : 0x00);
+  this->anticollision_mode_ = enabled;
+}
 
-      for (auto *trigger : this->on_tag_removed_triggers_) {
-        trigger->trigger(this->tag_present_uid_);
-      }
-      this->tag_present_ = false;
-      this->tag_present_uid_ = "";
-      this->missed_updates_ = 0;
-    }
+void ST25R::set_protocol_(Protocol protocol) {
+  if (protocol == this->protocol_)
+    return;
+  // MODE om=0001 ISO14443A, BIT_RATE 106 kbit/s both ways
+  uint8_t mode[2] = {0x08, 0x00};
+  // STREAM_MODE, AUX
+  uint8_t stream[2] = {0x01, 0x10};
+  if (protocol == PROTOCOL_NFC_V) {
+    // MODE om=1110 subcarrier stream. STREAM_MODE: 423.75 kHz subcarrier (fc/32), 8 pulses (one
+    // Manchester half bit) per received stream bit, one transmitted bit per 128/fc. AUX no_crc_rx.
+    mode[0] = 0x70;
+    stream[0] = 0x38;
+    stream[1] = 0x90;
+  } else if (protocol == PROTOCOL_NFC_F) {
+    // MODE om=0011 FeliCa: the chip adds preamble, sync code and CRC, the LEN byte is part of the
+    // data. BIT_RATE tx_rate and rx_rate 1 (212 kbit/s) or 2 (424 kbit/s).
+    uint8_t rate = this->nfcf_bit_rate_ == 424 ? 0x02 : 0x01;
+    mode[0] = 0x18;
+    mode[1] = (rate << 4) | rate;
   }
+  this->write_registers(MODE, mode, sizeof(mode));
+  this->write_registers(STREAM_MODE, stream, sizeof(stream));
+  this->protocol_ = protocol;
 }
 
-bool ST25R::wait_for_irq_(uint8_t mask, uint32_t timeout_ms) {
-  uint32_t start = millis();
-  while (millis() - start < timeout_ms) {
-    if (this->irq_triggered_) {
-       return true;
+ST25RPresentTag *ST25R::find_present_tag_(const ST25RUid &uid) {
+  for (auto &tag : this->present_tags_) {
+    if (tag.uid == uid)
+      return &tag;
+  }
+  return nullptr;
+}
+
+void ST25R::identify_tag_() {
+  ST25RPresentTag *present = this->find_present_tag_(this->current_uid_);
+  if (present != nullptr && present->seen) {
+    // Answered twice in one round: it did not halt, so it would keep hiding the others.
+    this->finish_scan_(true);
+    return;
+  }
+  // A pending write goes to a Type 2 tag entering the field, or to one already in it that it wasn't
+  // tried on yet.
+  this->writing_ = this->write_mode_ != WRITE_NONE && this->sak_ == 0x00 &&
+                   (present == nullptr || this->current_uid_ != this->write_attempted_uid_);
+  if (present != nullptr && !this->writing_) {
+    // Still in the field: nothing would be reported, so don't read it again.
+    this->tag_seen_();
+    return;
+  }
+  this->tag_data_size_ = 0;
+  this->fast_read_ = false;
+  // A retry after GET_VERSION still belongs to the first read.
+  if (this->stats_ != nullptr && !this->skip_get_version_)
+    this->stats_->tag_read_start = micros();
+  if (this->sak_ & 0x20) {
+    this->tag_model_ = TAG_MODEL_ISO_DEP;
+  } else if (this->sak_ & 0x18) {
+    // 0x08 Classic 1K, 0x18 Classic 4K, 0x09 Mini, 0x10/0x11 Plus in SL2
+    this->tag_model_ = TAG_MODEL_MIFARE_CLASSIC;
+  } else if (this->sak_ == 0x00) {
+    this->tag_model_ = TAG_MODEL_TYPE_2;
+  } else {
+    this->tag_model_ = TAG_MODEL_UNKNOWN;
+  }
+  ESP_LOGV(TAG, "ATQA %02X%02X SAK %02X", this->atqa_[1], this->atqa_[0], this->sak_);
+
+  if (this->tag_model_ == TAG_MODEL_ISO_DEP) {
+    this->start_iso_dep_();
+    return;
+  }
+  if (this->tag_model_ == TAG_MODEL_MIFARE_CLASSIC && !this->mfc_keys_.empty()) {
+    this->mfc_start_();
+    return;
+  }
+  if (this->tag_model_ != TAG_MODEL_TYPE_2) {
+    nfc::NfcTagUid tag_uid = this->current_uid_.to_nfc_uid();
+    if (this->tag_model_ == TAG_MODEL_MIFARE_CLASSIC) {
+      this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, nfc::MIFARE_CLASSIC));
+    } else {
+      this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid));
     }
-    delay(1);
+    return;
   }
-  return false;
+  if (this->skip_get_version_) {
+    if (this->writing_) {
+      this->start_write_();
+    } else {
+      this->start_read_tag_();
+    }
+    return;
+  }
+  this->cache_index_ = this->writing_ ? -1 : this->find_ndef_cache_(this->current_uid_);
+  if (this->cache_index_ >= 0) {
+    const uint8_t read_cmd[2] = {T2_READ, T2_CC_PAGE};
+    this->transceive_(read_cmd, sizeof(read_cmd));
+    this->set_state_(STATE_CACHE_HEAD);
+    return;
+  }
+  const uint8_t get_version[] = {T2_GET_VERSION};
+  this->transceive_(get_version, sizeof(get_version), 1000);
+  this->set_state_(STATE_GET_VERSION);
 }
 
-bool ST25R::reset_() {
-  this->write_command(ST25R_CMD_SET_DEFAULT);
-  delay(10);
+void ST25R::process_version_(TransceiveResult result) {
+  // Header 0x00, vendor 0x04 (NXP), product type, subtype, major, minor, storage size, protocol
+  if (result != TRANSCEIVE_OK || this->rx_len_ < 8 || this->rx_buffer_[1] != 0x04) {
+    // Tags without GET_VERSION fall back to IDLE on the unknown command: activate again and
+    // read with plain READ.
+    ESP_LOGV(TAG, "No GET_VERSION answer, re-selecting");
+    this->skip_get_version_ = true;
+    this->activate_(ST25R_CMD_TRANSMIT_REQA);
+    return;
+  }
+  uint8_t product = this->rx_buffer_[2];
+  uint8_t storage = this->rx_buffer_[6];
+  if (product == 0x04) {
+    switch (storage) {
+      case 0x0F:
+        this->tag_model_ = TAG_MODEL_NTAG213;
+        this->tag_data_size_ = 144;
+        break;
+      case 0x11:
+        this->tag_model_ = TAG_MODEL_NTAG215;
+        this->tag_data_size_ = 504;
+        break;
+      case 0x13:
+        this->tag_model_ = TAG_MODEL_NTAG216;
+        this->tag_data_size_ = 888;
+        break;
+      default:
+        break;
+    }
+  } else if (product == 0x03) {
+    this->tag_model_ = TAG_MODEL_ULTRALIGHT_EV1;
+    this->tag_data_size_ = storage == 0x0E ? 128 : 48;
+  }
+  ESP_LOGD(TAG, "Tag model %s, %u bytes user memory", tag_model_to_string(this->tag_model_), this->tag_data_size_);
+  // Every tag answering GET_VERSION also implements FAST_READ.
+  this->fast_read_ = true;
+  if (this->writing_) {
+    this->start_write_();
+  } else {
+    this->start_read_tag_();
+  }
+}
 
-  uint8_t ic_identity = this->read_register(IC_IDENTITY);
-  if ((ic_identity >> 3) != 0x05) return false;
-
-  this->write_register(IO_CONF1, 0x00);  // single=0: differential antenna driving (full power)
-  this->write_register(IO_CONF2, 0x00);  // sup3V=0: 5V supply
-  this->write_register(MODE, 0x08); 
-  this->write_register(BIT_RATE, 0x00); 
-  this->write_register(RX_CONF1, 0x00); 
-  this->write_register(RX_CONF2, 0x68); 
-  this->write_register(0x09, 0x01); 
-  this->write_register(0x0A, 0x10); 
-  this->write_register(MASK_MAIN, 0x07); 
-  this->write_register(ISO14443A_CONF, 0x00); 
+void ST25R::start_read_tag_() {
+  this->raw_read_ = 0;
+  // TLVs start at page 4, byte 16 of tag memory
+  this->tlv_.reset(&this->ndef_buffer_, T2_DATA_ADDRESS, this->tag_data_size_, true);
+  this->read_pages_(T2_CC_PAGE);
+  this->set_state_(STATE_READ_TAG);
+}
 
-  if (this->rf_field_enabled_) this->field_on_();
-  delay(10);
-  
-  uint8_t d_res = (15 - this->rf_power_) << 4;
-  this->write_register(TX_DRIVER_CONF, d_res); 
+void ST25R::read_pages_(uint8_t first_page) {
+  // No further than needed
+  uint16_t last_page = 0xFF;
+  if (this->tag_data_size_ > 0)
+    last_page = std::min<uint16_t>(last_page, T2_CC_PAGE + this->tag_data_size_ / T2_PAGE_SIZE);
+  size_t remaining = this->tlv_.remaining();
+  if (remaining > 0) {
+    size_t needed = this->raw_read_ + remaining;
+    last_page = std::min<uint16_t>(last_page, T2_CC_PAGE + (needed - 1) / T2_PAGE_SIZE);
+  } else {
+    // NDEF length still unknown: a chunk that holds short messages without reading all of memory.
+    last_page = std::min<uint16_t>(last_page, first_page + T2_FIRST_CHUNK_PAGES - 1);
+  }
+  this->read_page_range_(first_page, last_page);
+}
 
-  return true;
+void ST25R::read_page_range_(uint8_t first_page, uint16_t last_page) {
+  if (!this->fast_read_) {
+    // READ returns 4 pages, wrapping around at the end of memory
+    const uint8_t read_cmd[2] = {T2_READ, first_page};
+    this->transceive_(read_cmd, sizeof(read_cmd));
+    return;
+  }
+  // As many pages as fit into the receive buffer next to the CRC
+  last_page = std::min<uint16_t>(last_page, first_page + (sizeof(this->rx_buffer_) - 2) / T2_PAGE_SIZE - 1);
+  last_page = std::min<uint16_t>(last_page, 0xFF);
+  const uint8_t fast_read[3] = {T2_FAST_READ, first_page, (uint8_t) last_page};
+  this->transceive_(fast_read, sizeof(fast_read));
 }
 
-void ST25R::reinitialize_() {
-  this->reinitialization_attempts_++;
-  if (this->reset_pin_ != nullptr) {
-    this->reset_pin_->digital_write(true);
-    delay(10);
-    this->reset_pin_->digital_write(false);
-    delay(10);
+void ST25R::continue_read_tag_(TransceiveResult result) {
+  size_t expected = this->fast_read_ ? T2_PAGE_SIZE : 16;
+  nfc::NfcTagUid tag_uid = this->current_uid_.to_nfc_uid();
+  if (result != TRANSCEIVE_OK || this->rx_len_ < expected) {
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid));
+    return;
   }
-  if (this->reset_()) {
-    this->health_check_failures_ = 0;
-    this->reinitialization_attempts_ = 0;
+
+  const uint8_t *data = this->rx_buffer_;
+  size_t len = this->rx_len_;
+  if (this->raw_read_ == 0) {
+    // Capability container byte 2: data area size / 8
+    if (this->tag_data_size_ == 0) {
+      this->tag_data_size_ = data[2] * 8;
+      this->tlv_.reset(&this->ndef_buffer_, T2_DATA_ADDRESS, this->tag_data_size_, true);
+    }
+    this->track_raw_(data, T2_PAGE_SIZE);
+    data += T2_PAGE_SIZE;
+    len -= T2_PAGE_SIZE;
+  }
+  size_t consumed;
+  ST25RTlvStatus status = this->tlv_.feed(data, len, consumed);
+  this->track_raw_(data, consumed);
+  if (status == TLV_FOUND) {
+    this->store_ndef_cache_();
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, nfc::NFC_FORUM_TYPE_2, this->ndef_buffer_));
+    return;
+  }
+  if (status == TLV_NOT_FOUND) {
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid));
+    return;
+  }
+
+  // Data starts at page 3 (capability container)
+  size_t next_page = T2_CC_PAGE + this->raw_read_ / T2_PAGE_SIZE;
+  if (this->tag_data_size_ > 0 && next_page > (size_t) (T2_CC_PAGE + this->tag_data_size_ / T2_PAGE_SIZE)) {
+    ESP_LOGV(TAG, "NDEF TLV runs past the end of user memory");
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid));
+    return;
+  }
+  this->read_pages_(next_page);
+}
+
+void ST25R::track_raw_(const uint8_t *data, size_t len) {
+  const size_t check = ST25RNdefCacheEntry::CHECK_SIZE;
+  if (this->raw_read_ < check)
+    memcpy(this->raw_head_ + this->raw_read_, data, std::min(len, check - this->raw_read_));
+  if (len >= check) {
+    memcpy(this->raw_tail_, data + len - check, check);
   } else {
-    if (this->reinitialization_attempts_ >= 3) this->mark_failed();
+    memmove(this->raw_tail_, this->raw_tail_ + len, check - len);
+    memcpy(this->raw_tail_ + check - len, data, len);
   }
+  this->raw_read_ += len;
 }
 
-void ST25R::field_on_() {
-  this->write_register(OP_CONTROL, 0x80); 
-  delay(10);
-  this->write_command(ST25R_CMD_FIELD_ON);
-  delay(10);
-  this->write_register(OP_CONTROL, 0xC8); 
+int ST25R::find_ndef_cache_(const ST25RUid &uid) const {
+  for (size_t i = 0; i < this->ndef_cache_.size(); i++) {
+    if (this->ndef_cache_[i].uid == uid)
+      return i;
+  }
+  return -1;
 }
 
-void ST25R::dump_config() {
-  ESP_LOGCONFIG(TAG, "ST25R:");
-  LOG_PIN("  IRQ Pin: ", this->irq_pin_);
-  LOG_PIN("  Reset Pin: ", this->reset_pin_);
-  ESP_LOGCONFIG(TAG, "  RF Power: %u", this->rf_power_);
-  ESP_LOGCONFIG(TAG, "  RF Field Enabled: %s", YESNO(this->rf_field_enabled_));
-  LOG_UPDATE_INTERVAL(this);
+void ST25R::store_ndef_cache_() {
+  if (this->ndef_cache_size_ == 0)
+    return;
+  int index = this->find_ndef_cache_(this->current_uid_);
+  if (index < 0) {
+    if (this->ndef_cache_.size() < this->ndef_cache_size_) {
+      index = this->ndef_cache_.size();
+      this->ndef_cache_.emplace_back();
+    } else {
+      // Evict the least recently used entry
+      index = 0;
+      for (size_t i = 1; i < this->ndef_cache_.size(); i++) {
+        if (this->ndef_cache_[i].last_used < this->ndef_cache_[index].last_used)
+          index = i;
+      }
+    }
+  }
+  ST25RNdefCacheEntry &entry = this->ndef_cache_[index];
+  entry.uid = this->current_uid_;
+  entry.model = this->tag_model_;
+  entry.raw_length = this->raw_read_;
+  memcpy(entry.head, this->raw_head_, sizeof(entry.head));
+  memcpy(entry.tail, this->raw_tail_, sizeof(entry.tail));
+  entry.last_used = ++this->ndef_cache_clock_;
+  entry.ndef = this->ndef_buffer_;
 }
 
-bool ST25RBinarySensor::process(const std::string &uid) {
-  std::string target_uid = "";
-  for (uint8_t b : this->uid_) {
-    char buf[3];
-    sprintf(buf, "%02X", b);
-    target_uid += buf;
+void ST25R::check_ndef_cache_(TransceiveResult result) {
+  if (result != TRANSCEIVE_OK || this->rx_len_ < 16) {
+    // The entry can't be confirmed: drop it and read the tag like an uncached one.
+    ESP_LOGV(TAG, "Cache check of tag %s failed", this->current_uid_.to_string().c_str());
+    this->ndef_cache_.erase(this->ndef_cache_.begin() + this->cache_index_);
+    this->cache_index_ = -1;
+    this->start_read_tag_();
+    return;
   }
-  if (uid == target_uid) {
-    this->publish_state(true);
+  ST25RNdefCacheEntry &entry = this->ndef_cache_[this->cache_index_];
+  // Compare the 16 bytes just read against the cached copy: the CC and TLV header first, then the
+  // pages holding the end of the message, which lie within the last CHECK_SIZE bytes.
+  const size_t check = ST25RNdefCacheEntry::CHECK_SIZE;
+  size_t offset = 0;
+  const uint8_t *cached = entry.head;
+  if (this->state_ == STATE_CACHE_TAIL) {
+    offset = (entry.raw_length - 13) / T2_PAGE_SIZE * T2_PAGE_SIZE;
+    cached = entry.tail + offset - (entry.raw_length - check);
+  }
+  size_t count = std::min<size_t>(check, entry.raw_length - offset);
+  if (memcmp(this->rx_buffer_, cached, count) != 0) {
+    ESP_LOGD(TAG, "Tag %s changed since it was cached", this->current_uid_.to_string().c_str());
+    this->ndef_cache_.erase(this->ndef_cache_.begin() + this->cache_index_);
+    this->cache_index_ = -1;
+    const uint8_t get_version[] = {T2_GET_VERSION};
+    this->transceive_(get_version, sizeof(get_version), 1000);
+    this->set_state_(STATE_GET_VERSION);
+    return;
+  }
+  if (this->state_ == STATE_CACHE_HEAD && entry.raw_length > check) {
+    size_t tail = (entry.raw_length - 13) / T2_PAGE_SIZE;
+    const uint8_t read_cmd[2] = {T2_READ, (uint8_t) (T2_CC_PAGE + tail)};
+    this->transceive_(read_cmd, sizeof(read_cmd));
+    this->set_state_(STATE_CACHE_TAIL);
+    return;
+  }
+
+  entry.last_used = ++this->ndef_cache_clock_;
+  this->tag_model_ = entry.model;
+  nfc::NfcTagUid tag_uid = this->current_uid_.to_nfc_uid();
+  this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, nfc::NFC_FORUM_TYPE_2, entry.ndef));
+}
+
+void ST25R::write_ndef(const std::vector<uint8_t> &message, bool lock) {
+  this->write_mode_ = WRITE_NDEF;
+  this->write_message_ = message;
+  this->write_lock_ = lock;
+  this->write_attempted_uid_.clear();
+  ESP_LOGD(TAG, "NDEF write of %u bytes pending%s", (unsigned) message.size(), lock ? ", then lock" : "");
+}
+
+void ST25R::format_tag() {
+  this->write_mode_ = WRITE_FORMAT;
+  this->write_message_.clear();
+  this->write_lock_ = false;
+  this->write_attempted_uid_.clear();
+  ESP_LOGD(TAG, "Format pending");
+}
+
+void ST25R::erase_tag() {
+  this->write_mode_ = WRITE_ERASE;
+  this->write_message_.clear();
+  this->write_lock_ = false;
+  this->write_attempted_uid_.clear();
+  ESP_LOGD(TAG, "Erase pending");
+}
+
+void ST25R::start_write_() {
+  this->write_attempted_uid_ = this->current_uid_;
+  this->write_locking_ = false;
+  // The cached message is about to be stale; the read after the write caches the new one.
+  int index = this->find_ndef_cache_(this->current_uid_);
+  if (index >= 0)
+    this->ndef_cache_.erase(this->ndef_cache_.begin() + index);
+  this->write_memory_.clear();
+  // The whole user memory, or a first chunk that holds the capability container with its size
+  uint16_t last_page = this->tag_data_size_ > 0 ? T2_CC_PAGE + this->tag_data_size_ / T2_PAGE_SIZE
+                                                : T2_CC_PAGE + T2_FIRST_CHUNK_PAGES - 1;
+  this->read_page_range_(T2_CC_PAGE, last_page);
+  this->set_state_(STATE_WRITE_READ);
+}
+
+void ST25R::write_continue_read_(TransceiveResult result) {
+  size_t expected = this->fast_read_ ? T2_PAGE_SIZE : 16;
+  if (result != TRANSCEIVE_OK || this->rx_len_ < expected) {
+    ESP_LOGW(TAG, "Reading tag %s before the write failed", this->current_uid_.to_string().c_str());
+    this->write_finish_(false);
+    return;
+  }
+  this->write_memory_.insert(this->write_memory_.end(), this->rx_buffer_, this->rx_buffer_ + this->rx_len_);
+  // Capability container byte 2: data area size / 8
+  if (this->tag_data_size_ == 0)
+    this->tag_data_size_ = this->write_memory_[2] * 8;
+  if (this->tag_data_size_ == 0) {
+    ESP_LOGW(TAG, "Tag %s has no capability container and an unknown memory size",
+             this->current_uid_.to_string().c_str());
+    this->write_finish_(false);
+    return;
+  }
+  size_t total = T2_PAGE_SIZE + this->tag_data_size_;
+  if (this->write_memory_.size() < total) {
+    this->read_page_range_(T2_CC_PAGE + this->write_memory_.size() / T2_PAGE_SIZE,
+                           T2_CC_PAGE + this->tag_data_size_ / T2_PAGE_SIZE);
+    return;
+  }
+  // READ wraps around at the end of memory, and FAST_READ may have been sized before the CC was known.
+  this->write_memory_.resize(total);
+  if (!this->prepare_write_()) {
+    this->write_finish_(false);
+    return;
+  }
+
+  this->write_pages_.clear();
+  for (size_t offset = 0; offset < total; offset += T2_PAGE_SIZE) {
+    if (memcmp(&this->write_image_[offset], &this->write_memory_[offset], T2_PAGE_SIZE) != 0)
+      this->write_pages_.push_back(T2_CC_PAGE + offset / T2_PAGE_SIZE);
+  }
+  ESP_LOGD(TAG, "Tag %s: %u of %u pages to program", this->current_uid_.to_string().c_str(),
+           (unsigned) this->write_pages_.size(), (unsigned) (total / T2_PAGE_SIZE));
+  if (this->write_pages_.empty()) {
+    this->lock_tag_();
+    return;
+  }
+  this->write_verify_page_ = this->write_pages_.front();
+  this->write_verify_last_ = this->write_pages_.back();
+  // A blank tag only becomes formatted once the TLV area behind its capability container is complete.
+  if (this->write_pages_.front() == T2_CC_PAGE) {
+    this->write_pages_.erase(this->write_pages_.begin());
+    this->write_pages_.push_back(T2_CC_PAGE);
+  }
+  this->write_index_ = 0;
+  this->write_next_page_();
+}
+
+bool ST25R::prepare_write_() {
+  const uint8_t *cc = this->write_memory_.data();
+  bool blank = cc[0] == 0x00 && cc[1] == 0x00 && cc[2] == 0x00 && cc[3] == 0x00;
+  if (!blank && cc[0] != T2_CC_MAGIC) {
+    ESP_LOGW(TAG, "Tag %s is not NFC Forum formatted", this->current_uid_.to_string().c_str());
+    return false;
+  }
+  if (!blank && (cc[3] & 0x0F) != 0x00) {
+    ESP_LOGW(TAG, "Tag %s is read-only", this->current_uid_.to_string().c_str());
+    return false;
+  }
+  this->write_image_ = this->write_memory_;
+  // write_image_ starts at the capability container, byte 12 of tag memory.
+  const uint32_t base = T2_CC_PAGE * T2_PAGE_SIZE;
+  const uint32_t end = T2_DATA_ADDRESS + this->tag_data_size_;
+
+  // Lock and Memory Control TLVs in front of the first NDEF TLV or terminator stay, and so do the
+  // bytes they reserve; everything after them is laid out anew.
+  uint32_t address = T2_DATA_ADDRESS;
+  this->tlv_.reset(&this->ndef_buffer_, T2_DATA_ADDRESS, this->tag_data_size_, !blank);
+  if (!blank) {
+    size_t consumed;
+    ST25RTlvStatus status = this->tlv_.feed(cc + T2_PAGE_SIZE, this->tag_data_size_, consumed);
+    if (status == TLV_FOUND || (status == TLV_NOT_FOUND && this->tlv_.tlv_type() == TLV_TERMINATOR)) {
+      address = this->tlv_.tlv_address();
+    } else {
+      // Nothing to keep: no reserved areas either
+      this->tlv_.reset(&this->ndef_buffer_, T2_DATA_ADDRESS, this->tag_data_size_, false);
+    }
+  }
+  auto put = [&](uint8_t byte) {
+    while (address < end && this->tlv_.is_reserved(address))
+      address++;
+    if (address >= end)
+      return false;
+    this->write_image_[address++ - base] = byte;
+    return true;
+  };
+
+  if (this->write_mode_ == WRITE_ERASE) {
+    while (put(0x00)) {
+    }
+    return true;
+  }
+  size_t length = this->write_message_.size();
+  bool fits = put(TLV_NDEF);
+  if (length < 0xFF) {
+    fits = fits && put(length);
+  } else {
+    fits = fits && put(0xFF) && put(length >> 8) && put(length & 0xFF);
+  }
+  for (size_t i = 0; fits && i < length; i++)
+    fits = put(this->write_message_[i]);
+  fits = fits && put(TLV_TERMINATOR);
+  if (!fits) {
+    ESP_LOGW(TAG, "NDEF message of %u bytes does not fit into the %u bytes of tag %s", (unsigned) length,
+             this->tag_data_size_, this->current_uid_.to_string().c_str());
+    return false;
+  }
+  // The rest of the last page is cleared, the memory after it is left alone.
+  while (address % T2_PAGE_SIZE != 0 && put(0x00)) {
+  }
+  if (blank) {
+    this->write_image_[0] = T2_CC_MAGIC;
+    this->write_image_[1] = T2_CC_VERSION;
+    this->write_image_[2] = this->tag_data_size_ / 8;
+    this->write_image_[3] = 0x00;
+  }
+  return true;
+}
+
+void ST25R::write_next_page_() {
+  if (this->write_index_ >= this->write_pages_.size()) {
+    if (this->write_locking_) {
+      this->write_finish_(true);
+      return;
+    }
+    // Every page from the first to the last one programmed is read back in as few reads as possible.
+    this->read_page_range_(this->write_verify_page_, this->write_verify_last_);
+    this->set_state_(STATE_WRITE_VERIFY);
+    return;
+  }
+  uint8_t page = this->write_pages_[this->write_index_];
+  uint8_t write_cmd[2 + T2_PAGE_SIZE] = {T2_WRITE, page};
+  const uint8_t *data =
+      page == T2_LOCK_PAGE ? T2_STATIC_LOCK : &this->write_image_[(page - T2_CC_PAGE) * T2_PAGE_SIZE];
+  memcpy(write_cmd + 2, data, T2_PAGE_SIZE);
+  this->transceive_(write_cmd, sizeof(write_cmd), T2_WRITE_TIMEOUT_US);
+  this->set_state_(STATE_WRITE_PAGE);
+}
+
+void ST25R::write_process_ack_(TransceiveResult result) {
+  // The 4-bit ACK carries no CRC, so the chip's CRC check may flag it; only its value counts.
+  if (result == TRANSCEIVE_TIMEOUT || this->rx_last_bits_ != 4 || (this->rx_buffer_[0] & 0x0F) != T2_ACK) {
+    ESP_LOGW(TAG, "Tag %s refused the write of page %u", this->current_uid_.to_string().c_str(),
+             this->write_pages_[this->write_index_]);
+    this->write_finish_(false);
+    return;
+  }
+  this->write_index_++;
+  this->write_next_page_();
+}
+
+void ST25R::write_continue_verify_(TransceiveResult result) {
+  size_t expected = this->fast_read_ ? T2_PAGE_SIZE : 16;
+  if (result != TRANSCEIVE_OK || this->rx_len_ < expected) {
+    ESP_LOGW(TAG, "Reading back tag %s failed", this->current_uid_.to_string().c_str());
+    this->write_finish_(false);
+    return;
+  }
+  size_t pages = std::min<size_t>(this->rx_len_ / T2_PAGE_SIZE, this->write_verify_last_ - this->write_verify_page_ + 1);
+  if (memcmp(this->rx_buffer_, &this->write_image_[(this->write_verify_page_ - T2_CC_PAGE) * T2_PAGE_SIZE],
+             pages * T2_PAGE_SIZE) != 0) {
+    ESP_LOGW(TAG, "Tag %s does not read back what was written", this->current_uid_.to_string().c_str());
+    this->write_finish_(false);
+    return;
+  }
+  this->write_verify_page_ += pages;
+  if (this->write_verify_page_ <= this->write_verify_last_) {
+    this->read_page_range_(this->write_verify_page_, this->write_verify_last_);
+    return;
+  }
+  this->lock_tag_();
+}
+
+void ST25R::lock_tag_() {
+  if (!this->write_lock_) {
+    this->write_finish_(true);
+    return;
+  }
+  // Read-only access in the capability container, then the static lock bits over pages 3-15. Both
+  // are one-time programmable. Pages past 15 stay writable for writers that ignore the CC.
+  this->write_image_[3] = T2_CC_READ_ONLY;
+  this->write_pages_ = {T2_CC_PAGE, T2_LOCK_PAGE};
+  this->write_index_ = 0;
+  this->write_locking_ = true;
+  this->write_next_page_();
+}
+
+void ST25R::write_finish_(bool success) {
+  this->writing_ = false;
+  if (success) {
+    ESP_LOGI(TAG, "Write to tag %s finished", this->current_uid_.to_string().c_str());
+    this->write_mode_ = WRITE_NONE;
+    ST25REvent event;
+    event.type = EVENT_WRITE_FINISHED;
+    event.uid = this->current_uid_;
+    this->post_event_(std::move(event));
+  }
+  // Reported, and cached, with what it holds now
+  this->start_read_tag_();
+}
+
+void ST25R::start_iso_dep_() {
+  // RATS with FSDI and CID 0
+  const uint8_t rats[2] = {ISO_DEP_RATS, ISO_DEP_FSDI << 4};
+  this->transceive_(rats, sizeof(rats), ISO_DEP_ACTIVATION_US);
+  this->set_state_(STATE_ISO_DEP_RATS);
+}
+
+void ST25R::process_ats_(TransceiveResult result) {
+  // TL, T0 (TA/TB/TC present in bits 4-6, FSCI in bits 0-3), TA, TB, TC, historical bytes
+  uint8_t tl = this->rx_len_ > 0 ? this->rx_buffer_[0] : 0;
+  if (result != TRANSCEIVE_OK || tl == 0 || tl > this->rx_len_) {
+    ESP_LOGV(TAG, "No ATS, reporting the UID only");
+    nfc::NfcTagUid tag_uid = this->current_uid_.to_nfc_uid();
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid));
+    return;
+  }
+  uint8_t fsci = 2;
+  uint8_t fwi = ISO_DEP_DEFAULT_FWI;
+  uint8_t sfgi = 0;
+  this->iso_dep_ta_ = 0;
+  if (tl >= 2) {
+    uint8_t t0 = this->rx_buffer_[1];
+    uint8_t pos = 2;
+    fsci = t0 & 0x0F;
+    if ((t0 & 0x10) && pos < tl)
+      this->iso_dep_ta_ = this->rx_buffer_[pos++];
+    if ((t0 & 0x20) && pos < tl) {
+      fwi = this->rx_buffer_[pos] >> 4;
+      sfgi = this->rx_buffer_[pos] & 0x0F;
+    }
+  }
+  // FSCI beyond the table and FWI/SFGI 15 are RFU and read as the defaults.
+  this->iso_dep_fsc_ = ISO_DEP_FSC_TABLE[std::min<uint8_t>(fsci, sizeof(ISO_DEP_FSC_TABLE) / sizeof(uint16_t) - 1)];
+  if (fwi > 14)
+    fwi = ISO_DEP_DEFAULT_FWI;
+  this->iso_dep_fwt_us_ = ISO_DEP_FWT_UNIT_US << fwi;
+  this->iso_dep_sfgt_us_ = (sfgi == 0 || sfgi > 14) ? 0 : ISO_DEP_FWT_UNIT_US << sfgi;
+  this->iso_dep_active_ = true;
+  this->iso_dep_block_number_ = 0;
+  ESP_LOGV(TAG, "ATS: FSC %u, FWT %" PRIu32 "us, TA %02X", this->iso_dep_fsc_, this->iso_dep_fwt_us_,
+           this->iso_dep_ta_);
+  if (this->iso_dep_sfgt_us_ > 0) {
+    // The card needs the start-up frame guard time before it takes the next frame.
+    this->iso_dep_guard_start_ = micros();
+    this->set_state_(STATE_ISO_DEP_GUARD);
+    return;
+  }
+  this->send_pps_();
+}
+
+void ST25R::send_pps_() {
+  // TA: DS 8/4/2 (card to reader) in bits 6:4, DR 8/4/2 (reader to card) in bits 2:0, bit 7 asks
+  // for the same divisor both ways. PPS1 carries DSI in bits 3:2 and DRI in bits 1:0.
+  uint8_t max_code = this->iso_dep_max_bit_rate_ >= 848 ? 3 : this->iso_dep_max_bit_rate_ >= 424 ? 2 :
+                     this->iso_dep_max_bit_rate_ >= 212 ? 1 : 0;
+  uint8_t dsi = 0;
+  uint8_t dri = 0;
+  for (uint8_t code = 1; code <= max_code; code++) {
+    if (this->iso_dep_ta_ & (0x10 << (code - 1)))
+      dsi = code;
+    if (this->iso_dep_ta_ & (0x01 << (code - 1)))
+      dri = code;
+  }
+  if (this->iso_dep_ta_ & 0x80)
+    dsi = dri = std::min(dsi, dri);
+  if (dsi == 0 && dri == 0) {
+    this->t4_exchange_(T4_SELECT_APP, nullptr, 0);
+    return;
+  }
+  const uint8_t pps[3] = {ISO_DEP_PPSS, 0x11, (uint8_t) ((dsi << 2) | dri)};
+  this->iso_dep_bit_rate_ = (dri << 4) | dsi;
+  this->transceive_(pps, sizeof(pps), this->iso_dep_fwt_us_);
+  this->set_state_(STATE_ISO_DEP_PPS);
+}
+
+void ST25R::process_pps_(TransceiveResult result) {
+  if (result == TRANSCEIVE_OK && this->rx_len_ >= 1 && this->rx_buffer_[0] == ISO_DEP_PPSS) {
+    // The new rates apply from the next frame on.
+    this->write_register(BIT_RATE, this->iso_dep_bit_rate_);
+    ESP_LOGV(TAG, "PPS: %u/%u kbit/s", 106 << (this->iso_dep_bit_rate_ >> 4), 106 << (this->iso_dep_bit_rate_ & 0x0F));
+  } else {
+    // No PPS answer: the card stays at 106 kbit/s.
+    this->iso_dep_bit_rate_ = 0x00;
+  }
+  this->t4_exchange_(T4_SELECT_APP, nullptr, 0);
+}
+
+void ST25R::iso_dep_exchange_(const uint8_t *apdu, size_t len) {
+  this->iso_dep_tx_.assign(apdu, apdu + len);
+  this->iso_dep_tx_pos_ = 0;
+  this->iso_dep_rx_.clear();
+  this->iso_dep_retries_ = 0;
+  this->iso_dep_send_next_();
+}
+
+void ST25R::iso_dep_send_next_() {
+  // The card takes at most FSC bytes per frame; longer APDUs go out as a chain of I-blocks.
+  size_t chunk = std::min<size_t>(this->iso_dep_tx_.size() - this->iso_dep_tx_pos_,
+                                  this->iso_dep_fsc_ - ISO_DEP_BLOCK_OVERHEAD);
+  bool more = this->iso_dep_tx_pos_ + chunk < this->iso_dep_tx_.size();
+  this->iso_dep_block_.clear();
+  this->iso_dep_block_.push_back(ISO_DEP_PCB_I | this->iso_dep_block_number_ | (more ? ISO_DEP_PCB_CHAINING : 0));
+  this->iso_dep_block_.insert(this->iso_dep_block_.end(), this->iso_dep_tx_.begin() + this->iso_dep_tx_pos_,
+                              this->iso_dep_tx_.begin() + this->iso_dep_tx_pos_ + chunk);
+  this->iso_dep_tx_pos_ += chunk;
+  this->iso_dep_send_block_(this->iso_dep_block_.data(), this->iso_dep_block_.size(), this->iso_dep_fwt_us_);
+}
+
+void ST25R::iso_dep_send_block_(const uint8_t *block, size_t len, uint32_t timeout_us) {
+  this->transceive_(block, len, timeout_us);
+  this->set_state_(STATE_ISO_DEP_EXCHANGE);
+}
+
+void ST25R::iso_dep_process_block_(TransceiveResult result) {
+  if (result != TRANSCEIVE_OK || this->rx_len_ < 1) {
+    if (++this->iso_dep_retries_ > ISO_DEP_MAX_RETRIES) {
+      this->iso_dep_complete_(false);
+      return;
+    }
+    // R(NAK) makes the card repeat its last block, or acknowledge ours so it goes out again.
+    const uint8_t nak = ISO_DEP_PCB_R_NAK | this->iso_dep_block_number_;
+    this->iso_dep_send_block_(&nak, 1, this->iso_dep_fwt_us_);
+    return;
+  }
+  uint8_t pcb = this->rx_buffer_[0];
+
+  if ((pcb & 0xF7) == ISO_DEP_PCB_S_WTX && this->rx_len_ >= 2) {
+    // Waiting time extension: confirm with the same multiplier, which holds for this one frame.
+    uint8_t wtxm = std::max<uint8_t>(this->rx_buffer_[1] & 0x3F, 1);
+    const uint8_t wtx[2] = {ISO_DEP_PCB_S_WTX, wtxm};
+    this->iso_dep_send_block_(wtx, sizeof(wtx), std::min(this->iso_dep_fwt_us_ * wtxm, ISO_DEP_FWT_MAX_US));
+    return;
+  }
+
+  if ((pcb & 0xE2) == ISO_DEP_PCB_I && (pcb & 0x01) == this->iso_dep_block_number_) {
+    this->iso_dep_block_number_ ^= 1;
+    this->iso_dep_retries_ = 0;
+    this->iso_dep_rx_.insert(this->iso_dep_rx_.end(), this->rx_buffer_ + 1, this->rx_buffer_ + this->rx_len_);
+    if (pcb & ISO_DEP_PCB_CHAINING) {
+      // More of the response follows after an R(ACK).
+      const uint8_t ack = ISO_DEP_PCB_R_ACK | this->iso_dep_block_number_;
+      this->iso_dep_send_block_(&ack, 1, this->iso_dep_fwt_us_);
+      return;
+    }
+    this->iso_dep_complete_(true);
+    return;
+  }
+
+  if ((pcb & 0xF6) == ISO_DEP_PCB_R_ACK) {
+    if ((pcb & 0x01) == this->iso_dep_block_number_ && this->iso_dep_tx_pos_ < this->iso_dep_tx_.size()) {
+      // Chained block acknowledged: on with the next one.
+      this->iso_dep_block_number_ ^= 1;
+      this->iso_dep_retries_ = 0;
+      this->iso_dep_send_next_();
+      return;
+    }
+    if ((pcb & 0x01) != this->iso_dep_block_number_ && ++this->iso_dep_retries_ <= ISO_DEP_MAX_RETRIES) {
+      this->iso_dep_send_block_(this->iso_dep_block_.data(), this->iso_dep_block_.size(), this->iso_dep_fwt_us_);
+      return;
+    }
+  }
+  ESP_LOGV(TAG, "Unexpected ISO-DEP block %02X", pcb);
+  this->iso_dep_complete_(false);
+}
+
+void ST25R::iso_dep_complete_(bool success) {
+  if (this->t4_step_ != T4_USER_APDU) {
+    this->t4_continue_(success);
+    return;
+  }
+  // The callback may queue the next APDU, so the request leaves the queue first.
+  ST25RApduRequest request = std::move(this->apdu_queue_.front());
+  this->apdu_queue_.erase(this->apdu_queue_.begin());
+  if (!success)
+    this->iso_dep_rx_.clear();
+  if (request.callback)
+    request.callback(success, this->iso_dep_rx_);
+  if (!success)
+    this->apdu_queue_.clear();
+  this->iso_dep_next_apdu_();
+}
+
+bool ST25R::send_apdu(const std::vector<uint8_t> &apdu, ST25RApduCallback callback) {
+  if (!this->iso_dep_active_ || apdu.empty() || this->apdu_queue_.size() >= MAX_QUEUED_APDUS)
+    return false;
+  this->apdu_queue_.push_back(ST25RApduRequest{apdu, std::move(callback)});
+  return true;
+}
+
+void ST25R::iso_dep_next_apdu_() {
+  if (!this->apdu_queue_.empty()) {
+    this->t4_step_ = T4_USER_APDU;
+    this->iso_dep_exchange_(this->apdu_queue_.front().apdu.data(), this->apdu_queue_.front().apdu.size());
+    return;
+  }
+  this->iso_dep_active_ = false;
+  const uint8_t deselect[1] = {ISO_DEP_PCB_S_DESELECT};
+  this->transceive_(deselect, sizeof(deselect), this->iso_dep_fwt_us_);
+  this->set_state_(STATE_ISO_DEP_DESELECT);
+}
+
+void ST25R::process_deselect_() {
+  // A deselected card is in HALT like after HLTA; the rest of the round runs at 106 kbit/s.
+  if (this->iso_dep_bit_rate_ != 0x00) {
+    this->write_register(BIT_RATE, 0x00);
+    this->iso_dep_bit_rate_ = 0x00;
+  }
+  this->next_nfca_tag_();
+}
+
+void ST25R::t4_exchange_(Type4Step step, const uint8_t *apdu, size_t len) {
+  this->t4_step_ = step;
+  if (step == T4_SELECT_APP) {
+    // SELECT by name, first or only occurrence, Le 00
+    uint8_t select[5 + sizeof(T4_NDEF_APP) + 1] = {0x00, 0xA4, 0x04, 0x00, sizeof(T4_NDEF_APP)};
+    memcpy(select + 5, T4_NDEF_APP, sizeof(T4_NDEF_APP));
+    select[sizeof(select) - 1] = 0x00;
+    this->iso_dep_exchange_(select, sizeof(select));
+    return;
+  }
+  this->iso_dep_exchange_(apdu, len);
+}
+
+void ST25R::t4_continue_(bool success) {
+  nfc::NfcTagUid tag_uid = this->current_uid_.to_nfc_uid();
+  size_t len = this->iso_dep_rx_.size();
+  // Every step must end in SW1-SW2 9000; cards without the NDEF application report the UID only.
+  if (!success || len < 2 || this->iso_dep_rx_[len - 2] != 0x90 || this->iso_dep_rx_[len - 1] != 0x00) {
+    ESP_LOGV(TAG, "Type 4 step %u failed", this->t4_step_);
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid));
+    return;
+  }
+  const uint8_t *data = this->iso_dep_rx_.data();
+  size_t data_len = len - 2;
+  switch (this->t4_step_) {
+    case T4_SELECT_APP: {
+      const uint8_t select_cc[7] = {0x00, 0xA4, 0x00, 0x0C, 0x02, T4_CC_FILE >> 8, T4_CC_FILE & 0xFF};
+      this->t4_exchange_(T4_SELECT_CC, select_cc, sizeof(select_cc));
+      break;
+    }
+    case T4_SELECT_CC: {
+      const uint8_t read_cc[5] = {0x00, 0xB0, 0x00, 0x00, T4_CC_LENGTH};
+      this->t4_exchange_(T4_READ_CC, read_cc, sizeof(read_cc));
+      break;
+    }
+    case T4_READ_CC: {
+      // CCLEN, mapping version, MLe, MLc, then the NDEF File Control TLV: T 04, L 06, file ID,
+      // maximum size, read and write access
+      if (data_len < T4_CC_LENGTH || data[7] != 0x04) {
+        this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_4));
+        return;
+      }
+      this->t4_max_le_ = std::min<uint16_t>((data[3] << 8) | data[4], T4_MAX_LE);
+      const uint8_t select_ndef[7] = {0x00, 0xA4, 0x00, 0x0C, 0x02, data[9], data[10]};
+      this->t4_exchange_(T4_SELECT_NDEF, select_ndef, sizeof(select_ndef));
+      break;
+    }
+    case T4_SELECT_NDEF: {
+      const uint8_t read_nlen[5] = {0x00, 0xB0, 0x00, 0x00, 0x02};
+      this->t4_exchange_(T4_READ_NLEN, read_nlen, sizeof(read_nlen));
+      break;
+    }
+    case T4_READ_NLEN:
+      if (data_len < 2 || this->t4_max_le_ == 0 || ((data[0] << 8) | data[1]) == 0) {
+        this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_4));
+        return;
+      }
+      this->read_data_.clear();
+      this->ndef_length_ = (data[0] << 8) | data[1];
+      this->t4_read_next_();
+      break;
+    case T4_READ_NDEF:
+      this->read_data_.insert(this->read_data_.end(), data, data + data_len);
+      if (data_len == 0 || this->read_data_.size() >= this->ndef_length_) {
+        this->read_data_.resize(std::min(this->read_data_.size(), this->ndef_length_));
+        this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_4, this->read_data_));
+        return;
+      }
+      this->t4_read_next_();
+      break;
+    default:
+      break;
+  }
+}
+
+void ST25R::t4_read_next_() {
+  // READ BINARY behind NLEN; each response is as long as MLe allows and may come back chained.
+  size_t offset = 2 + this->read_data_.size();
+  uint8_t count = std::min<size_t>(this->ndef_length_ - this->read_data_.size(), this->t4_max_le_);
+  const uint8_t read_binary[5] = {0x00, 0xB0, (uint8_t) ((offset >> 8) & 0x7F), (uint8_t) (offset & 0xFF), count};
+  this->t4_exchange_(T4_READ_NDEF, read_binary, sizeof(read_binary));
+}
+
+const ST25RMifareClassicEntry *ST25R::get_mifare_classic_card(const ST25RUid &uid) const {
+  for (auto &entry : this->mfc_cache_) {
+    if (entry.uid == uid)
+      return &entry;
+  }
+  return nullptr;
+}
+
+void ST25R::mfc_start_() {
+  // SAK 0x18 Classic 4K, 0x09 Mini, otherwise 1K
+  this->mfc_sectors_ = this->sak_ == 0x18 ? 40 : (this->sak_ == 0x09 ? 5 : 16);
+  int index = -1;
+  for (size_t i = 0; i < this->mfc_cache_.size(); i++) {
+    if (this->mfc_cache_[i].uid == this->current_uid_ && this->mfc_cache_[i].keys.size() == this->mfc_sectors_)
+      index = i;
+  }
+  if (index < 0) {
+    if (this->mfc_cache_.size() < this->mfc_cache_size_) {
+      index = this->mfc_cache_.size();
+      this->mfc_cache_.emplace_back();
+    } else {
+      // Evict the least recently used entry
+      index = 0;
+      for (size_t i = 1; i < this->mfc_cache_.size(); i++) {
+        if (this->mfc_cache_[i].last_used < this->mfc_cache_[index].last_used)
+          index = i;
+      }
+    }
+    ST25RMifareClassicEntry &entry = this->mfc_cache_[index];
+    entry.uid = this->current_uid_;
+    entry.keys.assign(this->mfc_sectors_, uint8_t{ST25RMifareClassicEntry::KEY_UNKNOWN});
+    entry.sector_read.assign(this->mfc_sectors_, false);
+    uint8_t last = this->mfc_sectors_ - 1;
+    entry.data.assign((mfc_first_block(last) + mfc_block_count(last)) * MFC_BLOCK_SIZE, 0x00);
+  }
+  this->mfc_entry_ = index;
+  this->mfc_cache_[index].last_used = ++this->mfc_cache_clock_;
+  this->mfc_authenticated_ = false;
+  this->mfc_reactivate_pending_ = false;
+  this->mfc_last_key_ = ST25RMifareClassicEntry::KEY_UNKNOWN;
+  this->mfc_sector_ = 0;
+  this->mfc_next_sector_();
+}
+
+void ST25R::mfc_next_sector_() {
+  // Sectors read on an earlier presentation, or that no key opens, are skipped: a card read
+  // completely before is reported without a single AUTH.
+  ST25RMifareClassicEntry &entry = this->mfc_cache_[this->mfc_entry_];
+  while (this->mfc_sector_ < this->mfc_sectors_ &&
+         (entry.sector_read[this->mfc_sector_] || entry.keys[this->mfc_sector_] == ST25RMifareClassicEntry::KEY_NONE))
+    this->mfc_sector_++;
+  if (this->mfc_sector_ >= this->mfc_sectors_) {
+    this->mfc_report_();
+    return;
+  }
+  // The key remembered for this sector goes first, else the one that opened the previous sector.
+  uint8_t known = entry.keys[this->mfc_sector_];
+  this->mfc_first_key_ = known != ST25RMifareClassicEntry::KEY_UNKNOWN ? known : this->mfc_last_key_;
+  this->mfc_try_ = 0;
+  this->mfc_auth_();
+}
+
+// Candidate i of a sector: the preferred key first, then the dictionary as key A, then as key B.
+static uint8_t mfc_candidate(uint8_t first, uint8_t i, size_t keys) {
+  uint8_t code;
+  if (first >= keys * 2) {
+    code = i;
+  } else if (i == 0) {
+    return first;
+  } else {
+    code = i - 1;
+    // Dictionary order is all keys A, then all keys B; skip the one already tried first.
+    uint8_t first_order = (first & 1) * keys + (first >> 1);
+    if (code >= first_order)
+      code++;
+  }
+  return code < keys ? code << 1 : ((code - keys) << 1) | 1;
+}
+
+void ST25R::mfc_auth_() {
+  if (this->mfc_reactivate_pending_) {
+    // REQA reaches the card again; SELECT by the known UID follows.
+    this->set_mfc_raw_mode_(false);
+    this->cascade_level_ = 0;
+    this->transceive_(nullptr, 0, 1000, ST25R_CMD_TRANSMIT_REQA);
+    this->set_state_(STATE_MFC_ACTIVATE);
+    return;
+  }
+  uint8_t code = mfc_candidate(this->mfc_first_key_, this->mfc_try_, this->mfc_keys_.size());
+  const uint8_t auth[2] = {(code & 1) ? MFC_AUTH_B : MFC_AUTH_A, mfc_first_block(this->mfc_sector_)};
+  this->mfc_send_(auth, sizeof(auth));
+  this->set_state_(STATE_MFC_AUTH);
+}
+
+void ST25R::mfc_process_nonce_(TransceiveResult result) {
+  uint8_t nonce[4];
+  if (result != TRANSCEIVE_OK || this->mfc_receive_(nonce, sizeof(nonce)) != sizeof(nonce)) {
+    this->mfc_auth_failed_();
+    return;
+  }
+  uint8_t code = mfc_candidate(this->mfc_first_key_, this->mfc_try_, this->mfc_keys_.size());
+  // Authentication uses the last 4 UID bytes (the last cascade level).
+  const uint8_t *uid = this->current_uid_.data + this->current_uid_.length - 4;
+  uint32_t cuid = ((uint32_t) uid[0] << 24) | (uid[1] << 16) | (uid[2] << 8) | uid[3];
+  uint32_t nt = ((uint32_t) nonce[0] << 24) | (nonce[1] << 16) | (nonce[2] << 8) | nonce[3];
+  this->mfc_crypto_.init(this->mfc_keys_[code >> 1]);
+  if (this->mfc_authenticated_) {
+    // Nested AUTH: the card's nonce comes encrypted under the new key.
+    nt ^= this->mfc_crypto_.word(cuid ^ nt, true);
+  } else {
+    this->mfc_crypto_.word(cuid ^ nt, false);
+  }
+  this->mfc_authenticated_ = false;
+  this->mfc_nt_ = nt;
+
+  // Reader nonce, fed into the cipher, then the card's nonce 64 steps on as the answer.
+  uint8_t data[8];
+  uint8_t parity[8];
+  uint32_t nr = random_uint32();
+  for (int i = 0; i < 4; i++) {
+    uint8_t plain = nr >> (24 - 8 * i);
+    data[i] = this->mfc_crypto_.byte(plain, false) ^ plain;
+    parity[i] = Crypto1::odd_parity(plain) ^ this->mfc_crypto_.peek();
+  }
+  uint32_t ar = Crypto1::prng_successor(nt, 64);
+  const uint8_t ar_plain[4] = {(uint8_t) (ar >> 24), (uint8_t) (ar >> 16), (uint8_t) (ar >> 8), (uint8_t) ar};
+  this->mfc_crypto_.encrypt(ar_plain, data + 4, parity + 4, sizeof(ar_plain));
+  this->mfc_transceive_(data, parity, sizeof(data));
+  this->set_state_(STATE_MFC_AUTH_REPLY);
+}
+
+void ST25R::mfc_process_auth_reply_(TransceiveResult result) {
+  uint8_t answer[4];
+  if (result != TRANSCEIVE_OK || this->mfc_receive_(answer, sizeof(answer)) != sizeof(answer)) {
+    this->mfc_auth_failed_();
+    return;
+  }
+  this->mfc_crypto_.decrypt(answer, sizeof(answer));
+  uint32_t at = ((uint32_t) answer[0] << 24) | (answer[1] << 16) | (answer[2] << 8) | answer[3];
+  if (at != Crypto1::prng_successor(this->mfc_nt_, 96)) {
+    this->mfc_auth_failed_();
+    return;
+  }
+  uint8_t code = mfc_candidate(this->mfc_first_key_, this->mfc_try_, this->mfc_keys_.size());
+  this->mfc_authenticated_ = true;
+  this->mfc_cache_[this->mfc_entry_].keys[this->mfc_sector_] = code;
+  this->mfc_last_key_ = code;
+  ESP_LOGV(TAG, "Sector %u opened with key %c #%u", this->mfc_sector_, (code & 1) ? 'B' : 'A', code >> 1);
+  // Block 0 of sector 0 holds the manufacturer data, which is read like any other block.
+  this->mfc_block_ = mfc_first_block(this->mfc_sector_);
+  this->mfc_read_block_();
+}
+
+void ST25R::mfc_auth_failed_() {
+  this->mfc_authenticated_ = false;
+  this->mfc_reactivate_pending_ = true;
+  if (++this->mfc_try_ >= this->mfc_keys_.size() * 2) {
+    ESP_LOGV(TAG, "No dictionary key opens sector %u", this->mfc_sector_);
+    this->mfc_cache_[this->mfc_entry_].keys[this->mfc_sector_] = ST25RMifareClassicEntry::KEY_NONE;
+    this->mfc_sector_++;
+    this->mfc_next_sector_();
+    return;
+  }
+  this->mfc_auth_();
+}
+
+void ST25R::mfc_reactivate_(TransceiveResult result) {
+  if (result == TRANSCEIVE_TIMEOUT) {
+    // Gone from the field: report what was read so far.
+    this->mfc_reactivate_pending_ = false;
+    this->mfc_report_();
+    return;
+  }
+  if (this->state_ == STATE_MFC_SELECT) {
+    if (result != TRANSCEIVE_OK || this->rx_len_ < 1) {
+      this->mfc_reactivate_pending_ = false;
+      this->mfc_report_();
+      return;
+    }
+    // SAK bit 2: UID not complete, one more cascade level
+    if ((this->rx_buffer_[0] & 0x04) == 0) {
+      this->mfc_reactivate_pending_ = false;
+      this->mfc_auth_();
+      return;
+    }
+    this->cascade_level_++;
+  }
+  // SELECT with the cascade bytes of the known UID: CT 0x88 and 3 UID bytes while more levels
+  // follow, the last 4 UID bytes at the last level.
+  static const uint8_t SEL_CMDS[] = {0x93, 0x95, 0x97};
+  uint8_t levels = this->current_uid_.length == 4 ? 1 : (this->current_uid_.length == 7 ? 2 : 3);
+  uint8_t select[7] = {SEL_CMDS[this->cascade_level_], 0x70};
+  if (this->cascade_level_ + 1 < levels) {
+    select[2] = 0x88;
+    memcpy(select + 3, this->current_uid_.data + this->cascade_level_ * 3, 3);
+  } else {
+    memcpy(select + 2, this->current_uid_.data + this->current_uid_.length - 4, 4);
+  }
+  select[6] = select[2] ^ select[3] ^ select[4] ^ select[5];
+  this->transceive_(select, sizeof(select), 1000);
+  this->set_state_(STATE_MFC_SELECT);
+}
+
+void ST25R::mfc_read_block_() {
+  const uint8_t read_cmd[2] = {MFC_READ, this->mfc_block_};
+  this->mfc_send_(read_cmd, sizeof(read_cmd));
+  this->set_state_(STATE_MFC_READ);
+}
+
+void ST25R::mfc_process_read_(TransceiveResult result) {
+  uint8_t block[MFC_BLOCK_SIZE + 2];
+  if (result != TRANSCEIVE_OK || this->mfc_receive_(block, sizeof(block)) != sizeof(block)) {
+    // A 4-bit NAK (access bits deny the read with this key) or a lost card.
+    this->mfc_auth_failed_();
+    return;
+  }
+  this->mfc_crypto_.decrypt(block, sizeof(block));
+  uint16_t crc = crc_a(block, MFC_BLOCK_SIZE);
+  if (block[MFC_BLOCK_SIZE] != (crc & 0xFF) || block[MFC_BLOCK_SIZE + 1] != (crc >> 8)) {
+    this->mfc_auth_failed_();
+    return;
+  }
+  ST25RMifareClassicEntry &entry = this->mfc_cache_[this->mfc_entry_];
+  memcpy(&entry.data[this->mfc_block_ * MFC_BLOCK_SIZE], block, MFC_BLOCK_SIZE);
+  this->mfc_block_++;
+  // The trailer's keys read back as zeros, so it is not read at all.
+  uint8_t trailer = mfc_first_block(this->mfc_sector_) + mfc_block_count(this->mfc_sector_) - 1;
+  if (this->mfc_block_ < trailer) {
+    this->mfc_read_block_();
+    return;
+  }
+  entry.sector_read[this->mfc_sector_] = true;
+  this->mfc_sector_++;
+  this->mfc_next_sector_();
+}
+
+void ST25R::mfc_report_() {
+  nfc::NfcTagUid tag_uid = this->current_uid_.to_nfc_uid();
+  const ST25RMifareClassicEntry &entry = this->mfc_cache_[this->mfc_entry_];
+  const uint8_t *data = entry.data.data();
+  // MAD1 in sector 0 (blocks 1-2) lists sectors 1-15; MAD2 in sector 16 (blocks 64-66) sectors
+  // 17-39 of a 4K card. Each starts with a CRC over the info byte and the AIDs.
+  bool mad1 = entry.sector_read[0] && crc_mad(data + 17, 31) == data[16];
+  bool mad2 = mad1 && this->mfc_sectors_ > 16 && entry.sector_read[16] && crc_mad(data + 64 * 16 + 1, 47) == data[64 * 16];
+  auto is_ndef_sector = [&](uint8_t sector) {
+    const uint8_t *aid;
+    if (mad1 && sector > 0 && sector < 16) {
+      aid = data + 16 + 2 * sector;
+    } else if (mad2 && sector > 16) {
+      aid = data + 64 * 16 + 2 * (sector - 16);
+    } else {
+      return false;
+    }
+    return aid[0] == MFC_NDEF_AID[0] && aid[1] == MFC_NDEF_AID[1];
+  };
+  // The TLV area is as large as the data blocks of all sectors the MAD gives to NDEF.
+  uint32_t span = 0;
+  for (uint8_t sector = 1; sector < this->mfc_sectors_; sector++) {
+    if (is_ndef_sector(sector))
+      span += (mfc_block_count(sector) - 1) * MFC_BLOCK_SIZE;
+  }
+  ST25RTlvStatus status = TLV_MORE;
+  if (span > 0)
+    this->tlv_.reset(&this->ndef_buffer_, 0, span, false);
+  for (uint8_t sector = 1; span > 0 && sector < this->mfc_sectors_; sector++) {
+    if (!is_ndef_sector(sector))
+      continue;
+    if (!entry.sector_read[sector])
+      break;
+    // The data blocks of the NDEF sectors form one TLV area; sector trailers are not part of it.
+    const uint8_t *first = data + mfc_first_block(sector) * MFC_BLOCK_SIZE;
+    size_t consumed;
+    status = this->tlv_.feed(first, (mfc_block_count(sector) - 1) * MFC_BLOCK_SIZE, consumed);
+    if (status != TLV_MORE)
+      break;
+  }
+  if (status == TLV_FOUND) {
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, nfc::MIFARE_CLASSIC, this->ndef_buffer_));
+    return;
+  }
+  this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, nfc::MIFARE_CLASSIC));
+}
+
+void ST25R::set_mfc_raw_mode_(bool enabled) {
+  if (enabled == this->mfc_raw_mode_)
+    return;
+  this->write_register(ISO14443A_CONF, enabled ? MFC_RAW_ISO14443A_CONF : 0x00);
+  this->write_register(AUX, enabled ? MFC_RAW_AUX : 0x10);
+  this->anticollision_mode_ = false;
+  this->mfc_raw_mode_ = enabled;
+}
+
+void ST25R::mfc_transceive_(const uint8_t *data, const uint8_t *parity, size_t len) {
+  // Each byte LSB first, then its parity bit: 9 bits per byte on air.
+  uint8_t frame[(MFC_BLOCK_SIZE + 2) * 9 / 8 + 1] = {};
+  size_t bits = 0;
+  for (size_t i = 0; i < len && bits + 9 <= sizeof(frame) * 8; i++) {
+    uint16_t value = data[i] | ((parity[i] & 1) << 8);
+    for (int b = 0; b < 9; b++, bits++)
+      frame[bits / 8] |= ((value >> b) & 1) << (bits % 8);
+  }
+  this->set_mfc_raw_mode_(true);
+  this->transceive_(frame, (bits + 7) / 8, MFC_TIMEOUT_US, ST25R_CMD_TRANSMIT_WITHOUT_CRC, bits % 8);
+}
+
+void ST25R::mfc_send_(const uint8_t *plain, size_t len) {
+  uint8_t frame[4];
+  uint8_t data[4];
+  uint8_t parity[4];
+  memcpy(frame, plain, len);
+  uint16_t crc = crc_a(plain, len);
+  frame[len] = crc & 0xFF;
+  frame[len + 1] = crc >> 8;
+  if (this->mfc_authenticated_) {
+    this->mfc_crypto_.encrypt(frame, data, parity, len + 2);
+  } else {
+    for (size_t i = 0; i < len + 2; i++) {
+      data[i] = frame[i];
+      parity[i] = Crypto1::odd_parity(frame[i]);
+    }
+  }
+  this->mfc_transceive_(data, parity, len + 2);
+}
+
+size_t ST25R::mfc_receive_(uint8_t *data, size_t max_len) {
+  size_t bits = this->rx_len_ * 8;
+  if (this->rx_last_bits_ != 0 && bits > 0)
+    bits -= 8 - this->rx_last_bits_;
+  size_t count = std::min(bits / 9, max_len);
+  for (size_t i = 0; i < count; i++) {
+    uint8_t value = 0;
+    for (int b = 0; b < 8; b++) {
+      size_t bit = i * 9 + b;
+      value |= ((this->rx_buffer_[bit / 8] >> (bit % 8)) & 1) << b;
+    }
+    data[i] = value;
+  }
+  return count;
+}
+
+void ST25R::next_nfca_tag_() {
+  this->set_mfc_raw_mode_(false);
+  if (this->round_tags_ >= MAX_TAGS_PER_ROUND) {
+    this->finish_scan_(true);
+    return;
+  }
+  // Only tags that haven't been halted yet answer REQA.
+  this->activate_(ST25R_CMD_TRANSMIT_REQA);
+}
+
+void ST25R::mark_seen_() {
+  for (auto *obj : this->binary_sensors_) obj->process(this->current_uid_);
+  ST25RPresentTag *present = this->find_present_tag_(this->current_uid_);
+  if (present != nullptr) {
+    present->seen = true;
+    present->last_seen = millis();
+  }
+  this->round_tags_++;
+}
+
+void ST25R::nfcv_transceive_(const uint8_t *data, size_t len, uint32_t timeout_us) {
+  // VCD 1-out-of-4 pulse position coding, one FIFO bit per 128/fc slot: every bit pair, LSB first,
+  // becomes a byte with the pause in slot 1, 3, 5 or 7, between SOF 0x21 and EOF 0x04.
+  static const uint8_t CODES[4] = {0x02, 0x08, 0x20, 0x80};
+  uint8_t frame[16];
+  uint8_t coded[2 + sizeof(frame) * 4];
+  len = std::min(len, sizeof(frame) - 2);
+  memcpy(frame, data, len);
+  uint16_t crc = crc_15693(frame, len);
+  frame[len++] = crc & 0xFF;
+  frame[len++] = crc >> 8;
+  size_t n = 0;
+  coded[n++] = 0x21;
+  for (size_t i = 0; i < len; i++) {
+    for (int shift = 0; shift < 8; shift += 2)
+      coded[n++] = CODES[(frame[i] >> shift) & 0x03];
+  }
+  coded[n++] = 0x04;
+  this->transceive_(coded, n, timeout_us, ST25R_CMD_TRANSMIT_WITHOUT_CRC);
+}
+
+ST25R::TransceiveResult ST25R::nfcv_decode_(TransceiveResult result, bool &collision) {
+  collision = false;
+  if (result != TRANSCEIVE_OK)
+    return result;
+  size_t bits = this->rx_last_bits_ != 0 ? (this->rx_len_ - 1) * 8 + this->rx_last_bits_ : this->rx_len_ * 8;
+  auto stream_bits = [this](size_t pos, uint8_t count) {
+    uint8_t value = 0;
+    for (uint8_t i = 0; i < count; i++)
+      value |= ((this->rx_buffer_[(pos + i) / 8] >> ((pos + i) % 8)) & 0x01) << i;
+    return value;
+  };
+  if (bits < 5 || stream_bits(0, 5) != V_STREAM_SOF)
+    return TRANSCEIVE_ERROR;
+
+  // Manchester: subcarrier in the first half bit is a 0, in the second a 1, in both a collision.
+  // Bytes are written back into rx_buffer_ behind the read position.
+  size_t pos = 5;
+  uint16_t len = 0;
+  uint8_t byte = 0;
+  uint8_t bit = 0;
+  while (true) {
+    if (bit == 0 && pos + 5 <= bits && stream_bits(pos, 5) == V_STREAM_EOF)
+      break;
+    if (pos + 2 > bits)
+      return TRANSCEIVE_ERROR;
+    uint8_t half_bits = stream_bits(pos, 2);
+    pos += 2;
+    if (half_bits == 0x00)
+      return TRANSCEIVE_ERROR;
+    if (half_bits == 0x03)
+      collision = true;
+    if (half_bits == 0x02)
+      byte |= 1 << bit;
+    if (++bit == 8) {
+      this->rx_buffer_[len++] = byte;
+      byte = 0;
+      bit = 0;
+    }
+  }
+  this->rx_len_ = len;
+  if (collision || len < 3)
+    return TRANSCEIVE_ERROR;
+  // The residue over data and CRC of an intact frame
+  if (crc_15693(this->rx_buffer_, len) != (uint16_t) ~0xF0B8) {
+    collision = true;
+    return TRANSCEIVE_ERROR;
+  }
+  this->rx_len_ -= 2;
+  return TRANSCEIVE_OK;
+}
+
+void ST25R::start_nfcv_round_() {
+  this->set_anticollision_mode_(false);
+  this->set_protocol_(PROTOCOL_NFC_V);
+  this->nfcv_uids_.clear();
+  this->nfcv_masks_.clear();
+  this->nfcv_masks_.emplace_back(0, 0);
+  this->nfcv_next_inventory_();
+}
+
+void ST25R::nfcv_next_inventory_() {
+  if (this->nfcv_masks_.empty() || this->nfcv_uids_.size() >= MAX_TAGS_PER_ROUND) {
+    this->nfcv_index_ = 0;
+    this->nfcv_next_tag_();
+    return;
+  }
+  this->nfcv_mask_ = this->nfcv_masks_.back().first;
+  this->nfcv_mask_length_ = this->nfcv_masks_.back().second;
+  this->nfcv_masks_.pop_back();
+  this->nfcv_slot_ = 0;
+
+  // Flags, INVENTORY, mask length in bits, then the mask itself LSB first. 16 slots (nb_slots=0).
+  uint8_t request[3 + 8] = {V_FLAG_HIGH_RATE | V_FLAG_INVENTORY, V_INVENTORY, this->nfcv_mask_length_};
+  uint8_t mask_bytes = (this->nfcv_mask_length_ + 7) / 8;
+  for (uint8_t i = 0; i < mask_bytes; i++)
+    request[3 + i] = (this->nfcv_mask_ >> (i * 8)) & 0xFF;
+  this->nfcv_transceive_(request, 3 + mask_bytes, 1000);
+  this->set_state_(STATE_NFCV_INVENTORY);
+}
+
+void ST25R::nfcv_process_slot_(TransceiveResult result) {
+  bool collision;
+  result = this->nfcv_decode_(result, collision);
+  // Flags, DSFID and the UID, LSB first
+  if (result == TRANSCEIVE_OK && this->rx_len_ >= 2 + V_UID_LENGTH && !(this->rx_buffer_[0] & V_RESPONSE_ERROR)) {
+    ST25RUid uid;
+    for (uint8_t i = 0; i < V_UID_LENGTH; i++)
+      uid.data[i] = this->rx_buffer_[2 + V_UID_LENGTH - 1 - i];
+    uid.length = V_UID_LENGTH;
+    if (std::find(this->nfcv_uids_.begin(), this->nfcv_uids_.end(), uid) == this->nfcv_uids_.end() &&
+        this->nfcv_uids_.size() < MAX_TAGS_PER_ROUND)
+      this->nfcv_uids_.push_back(uid);
+  } else if (result != TRANSCEIVE_TIMEOUT && this->nfcv_mask_length_ + 4 <= V_MAX_MASK_LENGTH) {
+    // Several tags share this slot: probe it again with the slot number as 4 more mask bits.
+    this->record_collision_();
+    ESP_LOGV(TAG, "NFC-V collision in slot %u, mask length %u", this->nfcv_slot_, this->nfcv_mask_length_);
+    this->nfcv_masks_.emplace_back(this->nfcv_mask_ | ((uint64_t) this->nfcv_slot_ << this->nfcv_mask_length_),
+                                   this->nfcv_mask_length_ + 4);
+  }
+
+  if (++this->nfcv_slot_ < 16) {
+    // A lone EOF moves every tag on to the next slot.
+    const uint8_t eof[1] = {0x04};
+    this->transceive_(eof, sizeof(eof), 1000, ST25R_CMD_TRANSMIT_WITHOUT_CRC);
+    return;
+  }
+  this->nfcv_next_inventory_();
+}
+
+void ST25R::nfcv_next_tag_() {
+  while (this->nfcv_index_ < this->nfcv_uids_.size()) {
+    this->current_uid_ = this->nfcv_uids_[this->nfcv_index_++];
+    ST25RPresentTag *present = this->find_present_tag_(this->current_uid_);
+    if (present == nullptr) {
+      if (this->stats_ != nullptr)
+        this->stats_->tag_read_start = micros();
+      this->tag_model_ = TAG_MODEL_TYPE_5;
+      this->tag_data_size_ = 0;
+      this->raw_read_ = 0;
+      this->nfcv_read_blocks_(0, V_FIRST_CHUNK_BLOCKS);
+      return;
+    }
+    // Still in the field: nothing would be reported, so don't read it again.
+    if (!present->seen)
+      this->mark_seen_();
+  }
+  this->finish_scan_(false);
+}
+
+void ST25R::nfcv_read_blocks_(uint8_t first_block, uint8_t count) {
+  // Addressed READ_MULTIPLE_BLOCKS: UID LSB first, first block, number of blocks - 1
+  uint8_t request[2 + V_UID_LENGTH + 2] = {V_FLAG_HIGH_RATE | V_FLAG_ADDRESS, V_READ_MULTIPLE_BLOCKS};
+  for (uint8_t i = 0; i < V_UID_LENGTH; i++)
+    request[2 + i] = this->current_uid_.data[V_UID_LENGTH - 1 - i];
+  request[2 + V_UID_LENGTH] = first_block;
+  request[3 + V_UID_LENGTH] = count - 1;
+  this->nfcv_read_count_ = count;
+  // 26.48 kbit/s: 32 blocks of 4 bytes take ~40 ms to arrive.
+  this->nfcv_transceive_(request, sizeof(request), 20000);
+  this->set_state_(STATE_NFCV_READ);
+}
+
+void ST25R::nfcv_continue_read_(TransceiveResult result) {
+  bool collision;
+  result = this->nfcv_decode_(result, collision);
+  nfc::NfcTagUid tag_uid = this->current_uid_.to_nfc_uid();
+  size_t data_len = this->rx_len_ > 0 ? this->rx_len_ - 1 : 0;
+  if (result != TRANSCEIVE_OK || data_len == 0 || (this->rx_buffer_[0] & V_RESPONSE_ERROR) ||
+      data_len % this->nfcv_read_count_ != 0) {
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_5));
+    return;
+  }
+  size_t block_size = data_len / this->nfcv_read_count_;
+  const uint8_t *data = this->rx_buffer_ + 1;
+  size_t len = data_len;
+
+  if (this->raw_read_ == 0) {
+    // Capability container: magic 0xE1/0xE2, version, data area size / 8; size 0 means an 8-byte
+    // CC with the size in bytes 6-7.
+    size_t cc_length = 4;
+    if (len >= 8 && data[2] == 0) {
+      cc_length = 8;
+      this->tag_data_size_ = ((data[6] << 8) | data[7]) * 8;
+    } else if (len >= 4) {
+      this->tag_data_size_ = data[2] * 8;
+    }
+    if (len < cc_length || (data[0] != 0xE1 && data[0] != 0xE2)) {
+      this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_5));
+      return;
+    }
+    // Control TLV addresses are Type 2 pages; Type 5 tags don't use them.
+    this->tlv_.reset(&this->ndef_buffer_, cc_length, this->tag_data_size_, false);
+    this->raw_read_ = cc_length;
+    data += cc_length;
+    len -= cc_length;
+  }
+  size_t consumed;
+  ST25RTlvStatus status = this->tlv_.feed(data, len, consumed);
+  this->raw_read_ += consumed;
+  if (status == TLV_FOUND) {
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_5, this->ndef_buffer_));
+    return;
+  }
+  if (status == TLV_NOT_FOUND) {
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_5));
+    return;
+  }
+
+  size_t next_block = this->raw_read_ / block_size;
+  size_t remaining = this->tlv_.remaining();
+  size_t needed = this->raw_read_ + (remaining > 0 ? remaining : V_FIRST_CHUNK_BLOCKS * block_size);
+  size_t last_block = (needed - 1) / block_size;
+  // Blocks past 255 need the extended commands, which not every tag has. The data area follows a
+  // CC of at most 8 bytes.
+  size_t end = this->tag_data_size_ + 8;
+  if (last_block > 0xFF || (this->tag_data_size_ > 0 && (remaining > 0 ? needed : this->raw_read_) > end)) {
+    ESP_LOGV(TAG, "NDEF TLV runs past the readable memory");
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_5));
+    return;
+  }
+  this->nfcv_read_blocks_(next_block, std::min<size_t>(last_block - next_block + 1, V_MAX_BLOCKS_PER_READ));
+}
+
+void ST25R::start_nfcf_round_() {
+  this->set_anticollision_mode_(false);
+  this->set_protocol_(PROTOCOL_NFC_F);
+  this->nfcf_cards_.clear();
+  this->nfcf_polls_ = 0;
+  this->nfcf_poll_();
+}
+
+void ST25R::nfcf_poll_() {
+  // LEN, SENSF_REQ, system code 0xFFFF (any), request code, time slot number (slots - 1)
+  const uint8_t request[6] = {6, F_SENSF_REQ, 0xFF, 0xFF, F_REQUEST_SYSTEM_CODE,
+                              (uint8_t) (this->nfcf_time_slots_ - 1)};
+  uint32_t window = F_FIRST_SLOT_US + this->nfcf_time_slots_ * F_SLOT_US;
+  this->nfcf_polls_++;
+  this->nfcf_collision_ = false;
+  this->transceive_(request, sizeof(request), window);
+  this->nfcf_window_end_ = micros() + window;
+  this->set_state_(STATE_NFCF_POLL);
+}
+
+void ST25R::nfcf_process_poll_(TransceiveResult result) {
+  // LEN, SENSF_RES, IDm, PMm and the system code asked for by the request code
+  if (result == TRANSCEIVE_OK && this->rx_len_ >= 20 && this->rx_buffer_[1] == F_SENSF_RES) {
+    ST25RUid idm;
+    idm.append(this->rx_buffer_ + 2, F_IDM_LENGTH);
+    uint16_t system_code = (this->rx_buffer_[18] << 8) | this->rx_buffer_[19];
+    auto known = std::find_if(this->nfcf_cards_.begin(), this->nfcf_cards_.end(),
+                              [&idm](const std::pair<ST25RUid, uint16_t> &card) { return card.first == idm; });
+    if (known == this->nfcf_cards_.end() && this->nfcf_cards_.size() < MAX_TAGS_PER_ROUND)
+      this->nfcf_cards_.emplace_back(idm, system_code);
+  } else if (result == TRANSCEIVE_ERROR) {
+    // Cards that picked the same slot garble each other.
+    this->nfcf_collision_ = true;
+    this->record_collision_();
+  }
+
+  // Later slots of the same request are still to come.
+  int32_t remaining = (int32_t) (this->nfcf_window_end_ - micros());
+  if (result != TRANSCEIVE_TIMEOUT && remaining > (int32_t) F_MIN_LISTEN_US) {
+    this->receive_(remaining);
+    return;
+  }
+  // Cards choose a new random slot for every request, so another one usually sorts them out.
+  if (this->nfcf_collision_ && this->nfcf_polls_ < F_MAX_POLLS && this->nfcf_cards_.size() < MAX_TAGS_PER_ROUND) {
+    ESP_LOGV(TAG, "NFC-F slot collision, polling again");
+    this->nfcf_poll_();
+    return;
+  }
+  this->nfcf_index_ = 0;
+  this->nfcf_next_tag_();
+}
+
+void ST25R::nfcf_next_tag_() {
+  while (this->nfcf_index_ < this->nfcf_cards_.size()) {
+    const auto &card = this->nfcf_cards_[this->nfcf_index_++];
+    this->current_uid_ = card.first;
+    ST25RPresentTag *present = this->find_present_tag_(this->current_uid_);
+    if (present == nullptr) {
+      if (this->stats_ != nullptr)
+        this->stats_->tag_read_start = micros();
+      this->tag_model_ = TAG_MODEL_FELICA;
+      if (card.second != F_SYSTEM_CODE_NDEF) {
+        // Transit and payment systems: the IDm is all there is to read without keys.
+        nfc::NfcTagUid tag_uid = this->current_uid_.to_nfc_uid();
+        this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, FELICA));
+        return;
+      }
+      this->read_data_.clear();
+      this->ndef_length_ = 0;
+      this->nfcf_data_blocks_ = 0;
+      this->nfcf_read_blocks_(0, F_FIRST_CHUNK_BLOCKS);
+      return;
+    }
+    // Still in the field: nothing would be reported, so don't read it again.
+    if (!present->seen)
+      this->mark_seen_();
+  }
+  this->finish_scan_(false);
+}
+
+void ST25R::nfcf_read_blocks_(uint8_t first_block, uint8_t count) {
+  // LEN, Read Without Encryption, IDm, one service code (little endian), the number of blocks,
+  // then a 2-byte block list element per block: service index 0, block number
+  uint8_t request[2 + F_IDM_LENGTH + 4 + 2 * F_MAX_BLOCKS_PER_READ];
+  size_t n = 1;
+  request[n++] = F_READ_WITHOUT_ENCRYPTION;
+  memcpy(request + n, this->current_uid_.data, F_IDM_LENGTH);
+  n += F_IDM_LENGTH;
+  request[n++] = 1;
+  request[n++] = F_SERVICE_NDEF_READ & 0xFF;
+  request[n++] = F_SERVICE_NDEF_READ >> 8;
+  request[n++] = count;
+  for (uint8_t i = 0; i < count; i++) {
+    request[n++] = 0x80;
+    request[n++] = first_block + i;
+  }
+  request[0] = n;
+  this->nfcf_read_count_ = count;
+  this->transceive_(request, n, 20000);
+  this->set_state_(STATE_NFCF_READ);
+}
+
+void ST25R::nfcf_continue_read_(TransceiveResult result) {
+  nfc::NfcTagUid tag_uid = this->current_uid_.to_nfc_uid();
+  bool first_chunk = this->nfcf_data_blocks_ == 0;
+  if (result != TRANSCEIVE_OK || this->rx_len_ < F_READ_HEADER + this->nfcf_read_count_ * F_BLOCK_SIZE ||
+      this->rx_buffer_[1] != F_READ_WITHOUT_ENCRYPTION + 1 || this->rx_buffer_[10] != 0x00) {
+    if (first_chunk && result == TRANSCEIVE_OK && this->nfcf_read_count_ > 1) {
+      // Status flags set: fewer blocks per command or in memory than the first chunk assumes.
+      this->nfcf_read_blocks_(0, 1);
+      return;
+    }
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, FELICA));
+    return;
+  }
+  const uint8_t *blocks = this->rx_buffer_ + F_READ_HEADER;
+
+  if (first_chunk) {
+    // Attribute information block: version, Nbr, Nbw, Nmaxb (2), 4 reserved, WriteF, RWFlag, Ln (3),
+    // checksum over the first 14 bytes
+    uint16_t sum = 0;
+    for (uint8_t i = 0; i < 14; i++)
+      sum += blocks[i];
+    uint16_t nmaxb = (blocks[3] << 8) | blocks[4];
+    if (sum != ((blocks[14] << 8) | blocks[15]) || nmaxb == 0) {
+      this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_3));
+      return;
+    }
+    this->nfcf_max_blocks_ = std::max<uint8_t>(1, std::min(blocks[1], F_MAX_BLOCKS_PER_READ));
+    this->nfcf_data_blocks_ = nmaxb;
+    this->ndef_length_ = ((uint32_t) blocks[11] << 16) | (blocks[12] << 8) | blocks[13];
+    // The NDEF message follows the attribute block directly, without a TLV.
+    blocks += F_BLOCK_SIZE;
+    this->read_data_.insert(this->read_data_.end(), blocks, blocks + (this->nfcf_read_count_ - 1) * F_BLOCK_SIZE);
+    if (this->ndef_length_ == 0) {
+      this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_3));
+      return;
+    }
+  } else {
+    this->read_data_.insert(this->read_data_.end(), blocks, blocks + this->nfcf_read_count_ * F_BLOCK_SIZE);
+  }
+
+  if (this->read_data_.size() >= this->ndef_length_) {
+    std::vector<uint8_t> ndef_data(this->read_data_.begin(), this->read_data_.begin() + this->ndef_length_);
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_3, ndef_data));
+    return;
+  }
+  size_t next_block = 1 + this->read_data_.size() / F_BLOCK_SIZE;
+  size_t last_block = (this->ndef_length_ + F_BLOCK_SIZE - 1) / F_BLOCK_SIZE;
+  // Block list elements of two bytes address blocks 0-255.
+  if (last_block > this->nfcf_data_blocks_ || last_block > 0xFF) {
+    ESP_LOGV(TAG, "NDEF message runs past the end of the NDEF service");
+    this->on_tag_read_(make_unique<nfc::NfcTag>(tag_uid, NFC_FORUM_TYPE_3));
+    return;
+  }
+  this->nfcf_read_blocks_(next_block, std::min<size_t>(last_block - next_block + 1, this->nfcf_max_blocks_));
+}
+
+void ST25R::tag_seen_() {
+  this->mark_seen_();
+  if (this->protocol_ == PROTOCOL_NFC_V) {
+    this->nfcv_next_tag_();
+    return;
+  }
+  if (this->protocol_ == PROTOCOL_NFC_F) {
+    this->nfcf_next_tag_();
+    return;
+  }
+  if (this->iso_dep_active_) {
+    // APDUs queued by the on_tag handlers go out before S(DESELECT) halts the card, so the card
+    // stays selected until loop() has dispatched its event.
+    if (this->event_count_ > 0) {
+      this->set_state_(STATE_ISO_DEP_EVENTS);
+      return;
+    }
+    this->iso_dep_next_apdu_();
+    return;
+  }
+  if (this->mfc_authenticated_) {
+    // An authenticated Mifare Classic only takes an encrypted HLTA.
+    const uint8_t hlta[2] = {0x50, 0x00};
+    this->mfc_send_(hlta, sizeof(hlta));
+    this->mfc_authenticated_ = false;
+    this->set_state_(STATE_HALT);
+    return;
+  }
+  this->set_mfc_raw_mode_(false);
+  // HLTA is never answered; the no-response timer ends it.
+  const uint8_t hlta[2] = {0x50, 0x00};
+  this->transceive_(hlta, sizeof(hlta), 1000);
+  this->set_state_(STATE_HALT);
+}
+
+void ST25R::on_tag_read_(std::unique_ptr<nfc::NfcTag> nfc_tag) {
+  if (this->find_present_tag_(this->current_uid_) == nullptr) {
+    if (this->stats_ != nullptr) {
+      this->stats_->tags_read++;
+      this->stats_->timings[TIMING_TAG_READ].add(micros() - this->stats_->tag_read_start);
+    }
+    ST25RPresentTag present;
+    present.uid = this->current_uid_;
+    present.nfc_a = this->protocol_ == PROTOCOL_NFC_A;
+    present.last_seen = millis();
+    present.suppressed = !this->filter_tag_event_(this->current_uid_);
+    this->present_tags_.push_back(present);
+    this->tag_present_uid_ = this->current_uid_;
+
+    if (!present.suppressed) {
+      ST25REvent event;
+      event.type = EVENT_TAG_ON;
+      event.uid = this->current_uid_;
+      event.tag = std::move(nfc_tag);
+      this->post_event_(std::move(event));
+    }
+  }
+  this->tag_seen_();
+}
+
+void ST25R::post_event_(ST25REvent &&event) {
+  if (this->event_count_ == EVENT_QUEUE_SIZE) {
+    ESP_LOGW(TAG, "Event queue full, dispatching the oldest event now");
+    ST25REvent oldest = std::move(this->events_[this->event_head_]);
+    this->event_head_ = (this->event_head_ + 1) % EVENT_QUEUE_SIZE;
+    this->event_count_--;
+    this->dispatch_event_(oldest);
+  }
+  this->events_[(this->event_head_ + this->event_count_) % EVENT_QUEUE_SIZE] = std::move(event);
+  this->event_count_++;
+  this->events_high_freq_.start();
+}
+
+void ST25R::dispatch_events_() {
+  uint32_t start = micros();
+  do {
+    if (this->event_count_ == 0)
+      break;
+    // Off the queue first: a handler may end up posting another event.
+    ST25REvent event = std::move(this->events_[this->event_head_]);
+    this->event_head_ = (this->event_head_ + 1) % EVENT_QUEUE_SIZE;
+    this->event_count_--;
+    this->dispatch_event_(event);
+  } while (micros() - start < EVENT_DISPATCH_BUDGET_US);
+  if (this->event_count_ == 0)
+    this->events_high_freq_.stop();
+}
+
+void ST25R::flush_events_() {
+  while (this->event_count_ > 0)
+    this->dispatch_events_();
+}
+
+void ST25R::dispatch_event_(ST25REvent &event) {
+  switch (event.type) {
+    case EVENT_TAG_ON: {
+      if (event.tag->has_ndef_message()) {
+        auto &message = event.tag->get_ndef_message();
+        for (auto &record : message->get_records()) {
+          ESP_LOGI(TAG, "  NDEF Record type: %s", record->get_type().c_str());
+          ESP_LOGI(TAG, "  NDEF Payload: %s", record->get_payload().c_str());
+        }
+      }
+      for (auto *listener : this->tag_listeners_) {
+        listener->tag_on(*event.tag);
+      }
+      if (this->on_tag_triggers_.empty() && this->on_authorized_triggers_.empty() &&
+          this->on_denied_triggers_.empty())
+        break;
+      std::string uid = event.uid.to_string();
+      for (auto *trigger : this->on_tag_triggers_) {
+        trigger->trigger(uid);
+      }
+      if (!this->on_authorized_triggers_.empty() || !this->on_denied_triggers_.empty()) {
+        bool authorized = this->is_authorized(event.uid);
+        ESP_LOGD(TAG, "Tag %s %s", uid.c_str(), authorized ? "authorized" : "denied");
+        for (auto *trigger : authorized ? this->on_authorized_triggers_ : this->on_denied_triggers_) {
+          trigger->trigger(uid);
+        }
+      }
+      break;
+    }
+    case EVENT_TAG_OFF: {
+      std::string uid = event.uid.to_string();
+      ESP_LOGI(TAG, "Tag Removed: %s", uid.c_str());
+      nfc::NfcTagUid tag_uid = event.uid.to_nfc_uid();
+      nfc::NfcTag nfc_tag(tag_uid);
+      for (auto *listener : this->tag_listeners_) {
+        listener->tag_off(nfc_tag);
+      }
+      for (auto *trigger : this->on_tag_removed_triggers_) {
+        trigger->trigger(uid);
+      }
+      break;
+    }
+    case EVENT_BINARY_SENSOR:
+      event.sensor->publish_state(event.state);
+      break;
+    case EVENT_WRITE_FINISHED: {
+      std::string uid = event.uid.to_string();
+      for (auto *trigger : this->on_finished_write_triggers_) {
+        trigger->trigger(uid);
+      }
+      break;
+    }
+  }
+  event.tag.reset();
+}
+
+void ST25R::loop() {
+  // Events posted in earlier iterations, before the state machine moves on
+  if (this->event_count_ > 0)
+    this->dispatch_events_();
+  if (this->stats_ == nullptr) {
+    this->run_loop_();
+    return;
+  }
+  uint32_t start = micros();
+  State state = this->state_;
+  this->run_loop_();
+  // Idle iterations only look at a timestamp or the IRQ flag.
+  if ((state != STATE_IDLE && state != STATE_WAKE_UP && state != STATE_FIELD_OFF) || this->state_ != state)
+    this->stats_->timings[TIMING_LOOP].add(micros() - start);
+}
+
+void ST25R::run_loop_() {
+  if (this->is_failed()) return;
+
+  if (this->state_ == STATE_REINITIALIZING) {
+    this->reinitialize_();
+    this->state_ = STATE_IDLE;
+    if (this->wake_up_ && this->rf_field_enabled_ && !this->is_failed())
+      this->enter_wake_up_();
+    if (this->scheduled_field_off_ && this->rf_field_enabled_ && !this->is_failed())
+      this->enter_field_off_();
+    return;
+  }
+  if (this->state_ == STATE_WAKE_UP) {
+    if (!this->irq_polling_ && !this->irq_triggered_)
+      return;
+    if (!this->irq_polling_)
+      this->record_trace_(TRACE_IRQ, 0);
+    this->irq_triggered_ = false;
+    uint8_t irqs[3];
+    this->read_registers(IRQ_MAIN, irqs, sizeof(irqs));
+    if (irqs[2] & (IRQ_WAM | IRQ_WPH | IRQ_WCAP)) {
+      ESP_LOGV(TAG, "Wake-up event 0x%02X", irqs[2]);
+      this->exit_wake_up_();
+    }
+    return;
+  }
+  if (this->state_ == STATE_ISO_DEP_GUARD) {
+    if (micros() - this->iso_dep_guard_start_ >= this->iso_dep_sfgt_us_)
+      this->send_pps_();
+    return;
+  }
+  if (this->state_ == STATE_ISO_DEP_EVENTS) {
+    if (this->event_count_ == 0)
+      this->iso_dep_next_apdu_();
+    return;
+  }
+  if (this->state_ == STATE_FIELD_SETTLE) {
+    if (millis() - this->last_state_change_ >= FIELD_GUARD_TIME_MS)
+      this->start_discovery_();
+    return;
+  }
+  if (this->state_ == STATE_IDLE || this->state_ == STATE_FIELD_OFF) {
+    if (this->health_check_pending_) {
+      this->update();
+      return;
+    }
+    if (this->fast_poll_ && this->health_check_failures_ == 0 &&
+        millis() - this->last_discovery_ >= this->poll_interval_) {
+      this->start_discovery_();
+      return;
+    }
+    if (this->presence_check_due_())
+      this->start_presence_check_();
+    return;
+  }
+
+  TransceiveResult result = this->poll_transceive_();
+  if (result == TRANSCEIVE_BUSY) return;
+  this->record_exchange_(result);
+
+  switch (this->state_) {
+    case STATE_WUPA:
+      // ATQA received: start anticollision at cascade level 1. Several tags answering at once
+      // garble the ATQA, but any answer means there is something to resolve.
+      if (result == TRANSCEIVE_TIMEOUT) {
+        this->finish_scan_(false);
+        return;
+      }
+      if (this->rx_len_ >= 2) {
+        memcpy(this->atqa_, this->rx_buffer_, 2);
+      } else {
+        memset(this->atqa_, 0, sizeof(this->atqa_));
+      }
+      this->end_phase_(TIMING_ACTIVATE);
+      this->send_anticollision_();
+      break;
+
+    case STATE_READ_UID: {
+      // Framing errors may come with a collision; only its position matters then.
+      bool collision = (this->irq_status_[0] & IRQ_COL) != 0;
+      if (result == TRANSCEIVE_TIMEOUT || (result != TRANSCEIVE_OK && !collision) ||
+          !this->process_anticollision_()) {
+        this->finish_scan_(false);
+        return;
+      }
+      if (this->sel_bits_ < sizeof(this->sel_) * 8) {
+        this->send_anticollision_frame_();
+        return;
+      }
+      const uint8_t *cl = this->sel_ + 2;
+      if ((cl[0] ^ cl[1] ^ cl[2] ^ cl[3]) != cl[4]) {
+        ESP_LOGV(TAG, "BCC mismatch at cascade level %u", this->cascade_level_ + 1);
+        this->finish_scan_(false);
+        return;
+      }
+
+      // A cascade tag (0x88) means the UID continues at the next level
+      if (cl[0] == 0x88) {
+        this->current_uid_.append(cl + 1, 3);
+      } else {
+        this->current_uid_.append(cl, 4);
+      }
+
+      this->end_phase_((ST25RTiming) (TIMING_CASCADE_1 + this->cascade_level_));
+      this->sel_[1] = 0x70;
+      this->set_anticollision_mode_(false);
+      this->transceive_(this->sel_, sizeof(this->sel_), 1000);
+      this->set_state_(STATE_SELECT);
+      break;
+    }
+
+    case STATE_SELECT: {
+      if (result != TRANSCEIVE_OK || this->rx_len_ < 1) {
+        this->finish_scan_(false);
+        return;
+      }
+      uint8_t sak = this->rx_buffer_[0];
+      this->end_phase_(TIMING_SELECT);
+      if (sak & 0x04) {
+        // UID not complete yet
+        if (++this->cascade_level_ > 2) {
+          this->finish_scan_(false);
+          return;
+        }
+        this->send_anticollision_();
+        return;
+      }
+      this->sak_ = sak;
+      this->identify_tag_();
+      break;
+    }
+
+    case STATE_NFCV_INVENTORY:
+      this->nfcv_process_slot_(result);
+      break;
+
+    case STATE_NFCV_READ:
+      this->nfcv_continue_read_(result);
+      break;
+
+    case STATE_NFCF_POLL:
+      this->nfcf_process_poll_(result);
+      break;
+
+    case STATE_NFCF_READ:
+      this->nfcf_continue_read_(result);
+      break;
+
+    case STATE_HALT:
+      this->next_nfca_tag_();
+      break;
+
+    case STATE_PRESENCE_WUPA:
+      // Nothing woke up: none of the NFC-A tags is left.
+      if (result == TRANSCEIVE_TIMEOUT) {
+        this->finish_presence_check_();
+        return;
+      }
+      this->presence_send_select_();
+      break;
+
+    case STATE_PRESENCE_SELECT:
+      this->presence_process_select_(result);
+      break;
+
+    case STATE_PRESENCE_HALT:
+      this->presence_index_++;
+      this->presence_next_tag_();
+      break;
+
+    case STATE_MFC_ACTIVATE:
+    case STATE_MFC_SELECT:
+      this->mfc_reactivate_(result);
+      break;
+
+    case STATE_MFC_AUTH:
+      this->mfc_process_nonce_(result);
+      break;
+
+    case STATE_MFC_AUTH_REPLY:
+      this->mfc_process_auth_reply_(result);
+      break;
+
+    case STATE_MFC_READ:
+      this->mfc_process_read_(result);
+      break;
+
+    case STATE_ISO_DEP_RATS:
+      this->process_ats_(result);
+      break;
+
+    case STATE_ISO_DEP_PPS:
+      this->process_pps_(result);
+      break;
+
+    case STATE_ISO_DEP_EXCHANGE:
+      this->iso_dep_process_block_(result);
+      break;
+
+    case STATE_ISO_DEP_DESELECT:
+      this->process_deselect_();
+      break;
+
+    case STATE_GET_VERSION:
+      this->process_version_(result);
+      break;
+
+    case STATE_READ_TAG:
+      this->continue_read_tag_(result);
+      break;
+
+    case STATE_CACHE_HEAD:
+    case STATE_CACHE_TAIL:
+      this->check_ndef_cache_(result);
+      break;
+
+    case STATE_WRITE_READ:
+      this->write_continue_read_(result);
+      break;
+
+    case STATE_WRITE_PAGE:
+      this->write_process_ack_(result);
+      break;
+
+    case STATE_WRITE_VERIFY:
+      this->write_continue_verify_(result);
+      break;
+
+    default:
+      break;
+  }
+}
+
+size_t ST25R::round_snapshot_(uint8_t *out, size_t max_len) const {
+  // Flags, protocol, no-response timer, then the present tags as length and UID
+  size_t len = 0;
+  out[len++] = (this->irq_polling_ ? 0x01 : 0) | (this->anticollision_mode_ ? 0x02 : 0) |
+               (this->mfc_raw_mode_ ? 0x04 : 0);
+  out[len++] = this->protocol_;
+  out[len++] = this->no_response_timer_ & 0xFF;
+  out[len++] = this->no_response_timer_ >> 8;
+  for (const auto &tag : this->present_tags_) {
+    if (len + 1 + tag.uid.length > max_len)
+      break;
+    out[len++] = tag.uid.length;
+    memcpy(out + len, tag.uid.data, tag.uid.length);
+    len += tag.uid.length;
+  }
+  return len;
+}
+
+void ST25R::restore_round_snapshot_(const uint8_t *data, size_t len) {
+  if (len < 4)
+    return;
+  this->irq_polling_ = data[0] & 0x01;
+  this->anticollision_mode_ = data[0] & 0x02;
+  this->mfc_raw_mode_ = data[0] & 0x04;
+  this->protocol_ = (Protocol) data[1];
+  this->no_response_timer_ = data[2] | (data[3] << 8);
+  this->present_tags_.clear();
+  for (size_t pos = 4; pos < len && pos + 1 + data[pos] <= len; pos += 1 + data[pos]) {
+    ST25RPresentTag tag;
+    tag.uid.append(data + pos + 1, std::min<uint8_t>(data[pos], ST25RUid::MAX_LENGTH));
+    this->present_tags_.push_back(tag);
+  }
+  this->tag_present_uid_ = this->present_tags_.empty() ? ST25RUid() : this->present_tags_.back().uid;
+}
+
+void ST25R::end_phase_(ST25RTiming timing) {
+  if (this->stats_ == nullptr)
+    return;
+  uint32_t now = micros();
+  this->stats_->timings[timing].add(now - this->stats_->phase_start);
+  this->stats_->phase_start = now;
+}
+
+void ST25R::record_exchange_(TransceiveResult result) {
+  if (this->stats_ == nullptr)
+    return;
+  this->stats_->timings[TIMING_EXCHANGE].add(micros() - this->stats_->exchange_start);
+  if (result == TRANSCEIVE_TIMEOUT)
+    this->stats_->timeouts++;
+  if (this->irq_status_[2] & (IRQ_CRC | IRQ_PAR | IRQ_ERR1 | IRQ_ERR2))
+    this->stats_->irq_errors++;
+}
+
+void ST25R::publish_stats_() {
+  ST25RStats &stats = *this->stats_;
+  const ST25RHistogram &round = stats.timings[TIMING_ROUND];
+  ESP_LOGD(TAG, "Stats: %" PRIu32 " rounds, p95 %.1fms, max %.1fms, %.1f bus transactions per round", round.count,
+           round.percentile(95) / 1000.0f, round.max / 1000.0f,
+           stats.register_reads.avg() + stats.register_writes.avg());
+  if (this->round_time_sensor_ != nullptr && round.count > 0)
+    this->round_time_sensor_->publish_state(round.percentile(95) / 1000.0f);
+  const ST25RHistogram &read = stats.timings[TIMING_TAG_READ];
+  if (this->tag_read_time_sensor_ != nullptr && read.count > 0)
+    this->tag_read_time_sensor_->publish_state(read.percentile(95) / 1000.0f);
+  if (this->loop_time_sensor_ != nullptr)
+    this->loop_time_sensor_->publish_state(stats.timings[TIMING_LOOP].max);
+  if (this->bus_transactions_sensor_ != nullptr && stats.register_reads.count > 0)
+    this->bus_transactions_sensor_->publish_state(stats.register_reads.avg() + stats.register_writes.avg());
+  if (this->fifo_bytes_sensor_ != nullptr && stats.fifo_bytes.count > 0)
+    this->fifo_bytes_sensor_->publish_state(stats.fifo_bytes.avg());
+  if (this->timeouts_sensor_ != nullptr)
+    this->timeouts_sensor_->publish_state(stats.timeouts);
+  if (this->irq_errors_sensor_ != nullptr)
+    this->irq_errors_sensor_->publish_state(stats.irq_errors);
+  if (this->collisions_sensor_ != nullptr)
+    this->collisions_sensor_->publish_state(stats.collisions);
+
+  // Histograms cover one interval so a regression shows up in the next one; counters keep counting.
+  for (auto &timing : stats.timings)
+    timing.reset();
+  stats.register_reads.reset();
+  stats.register_writes.reset();
+  stats.fifo_bytes.reset();
+}
+
+void ST25R::process_tag_removed_() {
+  for (auto *obj : this->binary_sensors_) {
+    ST25REvent event;
+    event.type = EVENT_BINARY_SENSOR;
+    event.sensor = obj;
+    if (obj->on_scan_end(event.state))
+      this->post_event_(std::move(event));
+  }
+
+  uint32_t now = millis();
+  for (auto it = this->present_tags_.begin(); it != this->present_tags_.end();) {
+    if (it->seen) {
+      it->missed = 0;
+      ++it;
+      continue;
+    }
+    // Tags covered by the presence check go by time, the others by missed rounds.
+    bool gone = ++it->missed >= 3;
+    if (this->presence_check_interval_ > 0 && it->nfc_a)
+      gone = now - it->last_seen >= this->presence_debounce_;
+    it = gone ? this->remove_present_tag_(it) : it + 1;
+  }
+  this->update_current_tag_();
+}
+
+std::vector<ST25RPresentTag>::iterator ST25R::remove_present_tag_(std::vector<ST25RPresentTag>::iterator it) {
+  for (auto *obj : this->binary_sensors_) {
+    if (!obj->on_removed(it->uid))
+      continue;
+    ST25REvent event;
+    event.type = EVENT_BINARY_SENSOR;
+    event.sensor = obj;
+    event.state = false;
+    this->post_event_(std::move(event));
+  }
+  if (!it->suppressed) {
+    ST25REvent event;
+    event.type = EVENT_TAG_OFF;
+    event.uid = it->uid;
+    this->post_event_(std::move(event));
+  }
+  return this->present_tags_.erase(it);
+}
+
+bool ST25R::filter_tag_event_(const ST25RUid &uid) {
+  if (!this->event_filter_)
+    return true;
+  uint32_t now = millis();
+  ST25RReportedTag *entry = nullptr;
+  for (uint8_t i = 0; i < this->reported_count_; i++) {
+    if (this->reported_tags_[i].uid == uid) {
+      entry = &this->reported_tags_[i];
+      break;
+    }
+  }
+  const char *reason = nullptr;
+  if (entry != nullptr && now - entry->reported < this->event_filter_window_)
+    reason = "repeated within the window";
+  if (reason == nullptr && this->event_filter_max_events_ > 0) {
+    uint32_t elapsed = std::min(now - this->event_filter_last_, this->event_filter_period_);
+    this->event_filter_credit_ = std::min(this->event_filter_credit_ + elapsed, this->event_filter_period_);
+    this->event_filter_last_ = now;
+    uint32_t cost = this->event_filter_period_ / this->event_filter_max_events_;
+    if (this->event_filter_credit_ < cost) {
+      reason = "over the rate limit";
+    } else {
+      this->event_filter_credit_ -= cost;
+    }
+  }
+  if (reason != nullptr) {
+    this->suppressed_taps_++;
+    ESP_LOGD(TAG, "Tag %s suppressed, %s", uid.to_string().c_str(), reason);
+    return false;
+  }
+
+  if (entry == nullptr) {
+    if (this->reported_count_ < REPORTED_TAGS_SIZE) {
+      entry = &this->reported_tags_[this->reported_count_++];
+    } else {
+      entry = &this->reported_tags_[0];
+      for (auto &tag : this->reported_tags_) {
+        if (now - tag.reported > now - entry->reported)
+          entry = &tag;
+      }
+    }
+    entry->uid = uid;
+  }
+  entry->reported = now;
+  return true;
+}
+
+void ST25R::update_current_tag_() {
+  if (this->present_tags_.empty()) {
+    this->tag_present_uid_.clear();
+  } else if (this->find_present_tag_(this->tag_present_uid_) == nullptr) {
+    this->tag_present_uid_ = this->present_tags_.back().uid;
+  }
+}
+
+bool ST25R::reset_() {
+  this->record_trace_(TRACE_SETUP, 0);
+  // SET_DEFAULT completes within the command; the oscillator stays off until the field goes on.
+  this->write_command(ST25R_CMD_SET_DEFAULT);
+  if (!this->check_identity_())
+    return false;
+
+  const ST25RVariantInfo &variant = ST25R_VARIANTS[this->variant_];
+  for (size_t i = 0; i < variant.init_count; i++)
+    this->write_registers(variant.init[i].reg, variant.init[i].values, variant.init[i].len);
+  this->anticollision_mode_ = false;
+  this->protocol_ = PROTOCOL_NFC_A;
+  this->iso_dep_active_ = false;
+  this->iso_dep_bit_rate_ = 0x00;
+  this->apdu_queue_.clear();
+  this->mfc_raw_mode_ = false;
+  this->mfc_authenticated_ = false;
+  this->no_response_timer_ = 0;
+
+  // Driver resistance before the field comes up, so it starts at the configured power
+  uint8_t d_res = (15 - this->rf_power_) << 4;
+  this->write_register(TX_DRIVER_CONF, d_res);
+
+  if (this->rf_field_enabled_) this->field_on_();
+  return true;
+}
+
+bool ST25R::check_identity_() {
+  uint8_t ic_type = this->read_register(IC_IDENTITY) >> 3;
+  const ST25RVariantInfo &variant = ST25R_VARIANTS[this->variant_];
+  if (ic_type == variant.ic_type)
+    return true;
+  const char *found = nullptr;
+  for (const auto &info : ST25R_VARIANTS) {
+    if (info.ic_type == ic_type)
+      found = info.name;
+  }
+  if (found != nullptr) {
+    ESP_LOGE(TAG, "Found an %s, but the configuration is for an %s; set variant: to match", found, variant.name);
+  } else if (ic_type == ST25R3911B_IC_TYPE) {
+    ESP_LOGE(TAG, "Found an ST25R3911B, which is not supported");
+  } else {
+    ESP_LOGE(TAG, "Unknown IC type 0x%02X, expected an %s", ic_type, variant.name);
+  }
+  return false;
+}
+
+void ST25R::reinitialize_() {
+#ifdef USE_ST25R_TRACE
+  // What led up to the hang, before the reset traffic pushes it out of the buffer
+  if (this->trace_.is_enabled()) {
+    ESP_LOGW(TAG, "Reinitializing, trace of the transport before:");
+    this->trace_.dump();
+  }
+#endif
+  this->reinitialization_attempts_++;
+  if (this->reset_pin_ != nullptr) {
+    this->reset_pin_->digital_write(true);
+    delay(10);
+    this->reset_pin_->digital_write(false);
+    delay(10);
+  }
+  if (this->reset_()) {
+    this->health_check_failures_ = 0;
+    this->reinitialization_attempts_ = 0;
+  } else {
+    if (this->reinitialization_attempts_ >= 3) this->mark_failed();
+  }
+}
+
+void ST25R::set_num_tx_bytes_(size_t len, uint8_t last_bits) {
+  // NUM_TX_BYTES1 holds ntx[12:5], NUM_TX_BYTES2 holds ntx[4:0] followed by the bits of a split last byte.
+  const uint8_t num_tx[2] = {(uint8_t) ((len >> 5) & 0xFF), (uint8_t) (((len & 0x1F) << 3) | (last_bits & 0x07))};
+  this->write_registers(NUM_TX_BYTES1, num_tx, sizeof(num_tx));
+}
+
+bool ST25R::start_oscillator_() {
+  this->write_register(OP_CONTROL, 0x80);
+  uint32_t start = millis();
+  while (!(this->read_register(AUX_DISPLAY) & AUX_DISPLAY_OSC_OK)) {
+    if (millis() - start > OSCILLATOR_TIMEOUT_MS) {
+      ESP_LOGW(TAG, "Oscillator not stable after %" PRIu32 "ms", OSCILLATOR_TIMEOUT_MS);
+      return false;
+    }
+    delayMicroseconds(100);
+  }
+  return true;
+}
+
+void ST25R::field_on_() {
+  this->start_oscillator_();
+  this->write_command(ST25R_CMD_FIELD_ON);
+  delay(FIELD_GUARD_TIME_MS);
+  this->write_register(OP_CONTROL, 0xC8);
+}
+
+bool ST25R::is_authorized(const ST25RUid &uid) const {
+  // Records sort by length first, then UID bytes, matching the order generated by __init__.py.
+  size_t low = 0;
+  size_t high = this->allowlist_count_;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    const uint8_t *record = this->allowlist_ + mid * ALLOWLIST_RECORD_SIZE;
+    int cmp = (int) progmem_read_byte(record) - (int) uid.length;
+    for (uint8_t i = 0; cmp == 0 && i < uid.length; i++)
+      cmp = (int) progmem_read_byte(record + 1 + i) - (int) uid.data[i];
+    if (cmp == 0)
+      return true;
+    if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return false;
+}
+
+void ST25R::dump_config() {
+  ESP_LOGCONFIG(TAG, "ST25R:");
+  LOG_PIN("  IRQ Pin: ", this->irq_pin_);
+  LOG_PIN("  Reset Pin: ", this->reset_pin_);
+  ESP_LOGCONFIG(TAG, "  Variant: %s", ST25R_VARIANTS[this->variant_].name);
+  ESP_LOGCONFIG(TAG, "  RF Power: %u", this->rf_power_);
+  ESP_LOGCONFIG(TAG, "  RF Field Enabled: %s", YESNO(this->rf_field_enabled_));
+  if (this->allowlist_count_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Allowlist: %u UIDs", (unsigned) this->allowlist_count_);
+  }
+  LOG_UPDATE_INTERVAL(this);
+  ESP_LOGCONFIG(TAG, "  NDEF Cache: %u entries", this->ndef_cache_size_);
+  ESP_LOGCONFIG(TAG, "  ISO-DEP: up to %u kbit/s", this->iso_dep_max_bit_rate_);
+  if (!this->mfc_keys_.empty()) {
+    ESP_LOGCONFIG(TAG, "  Mifare Classic: %u keys, %u cards cached", (unsigned) this->mfc_keys_.size(),
+                  this->mfc_cache_size_);
+  }
+  ESP_LOGCONFIG(TAG, "  NFC-V: %s", YESNO(this->nfc_v_));
+  if (this->nfc_f_) {
+    ESP_LOGCONFIG(TAG, "  NFC-F: %u kbit/s, %u time slots", this->nfcf_bit_rate_, this->nfcf_time_slots_);
+  } else {
+    ESP_LOGCONFIG(TAG, "  NFC-F: NO");
+  }
+  if (this->wake_up_) {
+    ESP_LOGCONFIG(TAG, "  Wake-up: every %" PRIu32 "ms, delta amplitude %u / phase %u / capacitance %u",
+                  this->wake_up_interval_, this->wake_up_amplitude_delta_, this->wake_up_phase_delta_,
+                  this->wake_up_capacitance_delta_);
+  }
+  if (this->fast_poll_) {
+    ESP_LOGCONFIG(TAG, "  Fast Poll: %" PRIu32 "-%" PRIu32 "ms, hold %" PRIu32 "ms", this->fast_poll_min_interval_,
+                  this->fast_poll_max_interval_, this->fast_poll_hold_time_);
+  }
+  if (this->event_filter_) {
+    ESP_LOGCONFIG(TAG, "  Event Filter: window %" PRIu32 "ms", this->event_filter_window_);
+    if (this->event_filter_max_events_ > 0)
+      ESP_LOGCONFIG(TAG, "    At most %u events per %" PRIu32 "ms", this->event_filter_max_events_,
+                    this->event_filter_period_);
+  }
+  if (this->presence_check_interval_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Presence Check: every %" PRIu32 "ms, removal after %" PRIu32 "ms",
+                  this->presence_check_interval_, this->presence_debounce_);
+  }
+  if (this->scheduled_) {
+    ESP_LOGCONFIG(TAG, "  Scheduled: %s", this->scheduled_field_off_ ? "field off between turns" : "field stays on");
+  }
+  ESP_LOGCONFIG(TAG, "  Bus: %" PRIu32 " register reads, %" PRIu32 " register writes, %" PRIu32 " FIFO bytes",
+                this->bus_.register_reads, this->bus_.register_writes, this->bus_.fifo_bytes);
+#ifdef USE_ST25R_TRACE
+  if (this->trace_.is_enabled()) {
+    ESP_LOGCONFIG(TAG, "  Trace: %u bytes, %s", (unsigned) this->trace_size_,
+                  this->trace_stop_when_full_ ? "stops when full" : "ring");
+  }
+#endif
+  if (this->stats_ == nullptr)
+    return;
+  const ST25RStats &stats = *this->stats_;
+  ESP_LOGCONFIG(TAG, "  Stats: every %" PRIu32 "ms; %" PRIu32 " rounds, %" PRIu32 " tags read, %" PRIu32
+                " timeouts, %" PRIu32 " IRQ errors, %" PRIu32 " collisions",
+                this->stats_interval_, stats.rounds, stats.tags_read, stats.timeouts, stats.irq_errors,
+                stats.collisions);
+  ESP_LOGCONFIG(TAG, "    %-16s %7s %8s %8s %8s %8s %8s", "us", "count", "min", "avg", "p50", "p95", "max");
+  for (uint8_t i = 0; i < TIMING_COUNT; i++) {
+    const ST25RHistogram &h = stats.timings[i];
+    if (h.count == 0)
+      continue;
+    ESP_LOGCONFIG(TAG, "    %-16s %7" PRIu32 " %8" PRIu32 " %8.0f %8" PRIu32 " %8" PRIu32 " %8" PRIu32,
+                  timing_to_string((ST25RTiming) i), h.count, h.min, h.avg(), h.percentile(50), h.percentile(95),
+                  h.max);
+  }
+  const ST25RHistogram *per_round[3] = {&stats.register_reads, &stats.register_writes, &stats.fifo_bytes};
+  const char *const names[3] = {"Reads/round", "Writes/round", "FIFO B/round"};
+  for (uint8_t i = 0; i < 3; i++) {
+    const ST25RHistogram &h = *per_round[i];
+    if (h.count == 0)
+      continue;
+    ESP_LOGCONFIG(TAG, "    %-16s %7" PRIu32 " %8" PRIu32 " %8.1f %8" PRIu32 " %8" PRIu32 " %8" PRIu32, names[i],
+                  h.count, h.min, h.avg(), h.percentile(50), h.percentile(95), h.max);
+  }
+}
+
+bool ST25RBinarySensor::process(const ST25RUid &uid) {
+  if (uid == this->uid_) {
     this->found_ = true;
     return true;
   }
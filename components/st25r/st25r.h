@@ -1,11 +1,21 @@
 #pragma once
 
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
 #include "esphome/core/hal.h"
 #include "esphome/core/automation.h"
+#include "esphome/core/helpers.h"
 #include "esphome/components/binary_sensor/binary_sensor.h"
 #include "esphome/components/sensor/sensor.h"
 #include "esphome/components/nfc/nfc.h"
+#include "crypto1.h"
+#include "st25r_registers.h"
+#include "st25r_tlv.h"
+#include "st25r_trace.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -14,46 +24,197 @@ namespace st25r {
 
 class ST25RBinarySensor;
 
-// ST25R Register Definitions
-enum ST25RRegister : uint8_t {
-  IO_CONF1 = 0x00,
-  IO_CONF2 = 0x01,
-  OP_CONTROL = 0x02,
-  MODE = 0x03,
-  BIT_RATE = 0x04,
-  RX_CONF1 = 0x0B,
-  RX_CONF2 = 0x0C,
-  RX_CONF3 = 0x0D,
-  RX_CONF4 = 0x0E,
-  ISO14443A_CONF = 0x05,
-  MASK_MAIN = 0x16,
-  IRQ_MAIN = 0x1A,
-  IRQ_TIMER = 0x1B,
-  IRQ_ERROR = 0x1C,
-  FIFO_STATUS1 = 0x1E,
-  FIFO_STATUS2 = 0x1F,
-  NUM_TX_BYTES1 = 0x22,
-  NUM_TX_BYTES2 = 0x23,
-  COLLISION_DISPLAY = 0x24,
-  TX_DRIVER_CONF = 0x28,
-  AD_CONV_RESULT = 0x2A,
-  IC_IDENTITY = 0x3F,
-};
-
-// ST25R Commands
-enum ST25RCommand : uint8_t {
-  ST25R_CMD_SET_DEFAULT = 0xC1,
-  ST25R_CMD_STOP_ALL = 0xC2,
-  ST25R_CMD_CLEAR_FIFO = 0xC3,
-  ST25R_CMD_TRANSMIT_WITH_CRC = 0xC4,
-  ST25R_CMD_TRANSMIT_WITHOUT_CRC = 0xC5,
-  ST25R_CMD_TRANSMIT_REQA = 0xC6,
-  ST25R_CMD_TRANSMIT_WUPA = 0xC7,
-  ST25R_CMD_FIELD_ON = 0xC8,
-  ST25R_CMD_MEASURE_AMPLITUDE = 0xD3,
+class ST25R;
+
+/// Tag family identified from SAK and, for Type 2 tags, GET_VERSION.
+enum ST25RTagModel : uint8_t {
+  TAG_MODEL_UNKNOWN,
+  TAG_MODEL_MIFARE_CLASSIC,
+  TAG_MODEL_ISO_DEP,
+  TAG_MODEL_TYPE_2,  // Type 2 without GET_VERSION, e.g. original Ultralight
+  TAG_MODEL_ULTRALIGHT_EV1,
+  TAG_MODEL_NTAG213,
+  TAG_MODEL_NTAG215,
+  TAG_MODEL_NTAG216,
+  TAG_MODEL_TYPE_5,  // ISO15693 (NFC-V)
+  TAG_MODEL_FELICA,  // NFC-F
 };
 
-class ST25R;
+const char *tag_model_to_string(ST25RTagModel model);
+
+/// Binary tag UID (4, 7 or 10 bytes) stored inline; formatted to hex only at trigger boundaries.
+struct ST25RUid {
+  static const uint8_t MAX_LENGTH = 10;
+
+  uint8_t data[MAX_LENGTH];
+  uint8_t length{0};
+
+  void clear() { this->length = 0; }
+  bool empty() const { return this->length == 0; }
+  bool append(const uint8_t *bytes, uint8_t count) {
+    if (this->length + count > MAX_LENGTH)
+      return false;
+    memcpy(this->data + this->length, bytes, count);
+    this->length += count;
+    return true;
+  }
+  bool operator==(const ST25RUid &other) const {
+    return this->length == other.length && memcmp(this->data, other.data, this->length) == 0;
+  }
+  bool operator!=(const ST25RUid &other) const { return !(*this == other); }
+
+  /// Uppercase hex without separators, e.g. "04DC1F4A113C80".
+  std::string to_string() const;
+  nfc::NfcTagUid to_nfc_uid() const;
+};
+
+/// NDEF message of a Type 2 tag read before, with the first and last bytes of its memory from the
+/// capability container (page 3) to the end of the NDEF TLV, so the tag can be checked with two
+/// READs instead of reading its whole message again.
+struct ST25RNdefCacheEntry {
+  static const uint8_t CHECK_SIZE = 16;
+
+  ST25RUid uid;
+  ST25RTagModel model{TAG_MODEL_UNKNOWN};
+  // Bytes from the capability container to the end of the NDEF TLV, the first and the last
+  // CHECK_SIZE of them
+  uint16_t raw_length{0};
+  uint8_t head[CHECK_SIZE]{};
+  uint8_t tail[CHECK_SIZE]{};
+  uint32_t last_used{0};
+  std::vector<uint8_t> ndef;
+};
+
+/// A tag reported through on_tag that has not been reported removed yet.
+struct ST25RPresentTag {
+  ST25RUid uid;
+  uint8_t missed{0};       // discovery rounds in a row without an answer
+  bool seen{false};        // answered in the current round
+  bool nfc_a{false};       // can be re-selected by its UID for a presence check
+  bool suppressed{false};  // on_tag was filtered out, and so is the removal
+  uint32_t last_seen{0};   // millis() of the last answer, round or presence check
+};
+
+/// A UID whose tag event went out, for the event filter's suppression window.
+struct ST25RReportedTag {
+  ST25RUid uid;
+  uint32_t reported{0};  // millis()
+};
+
+/// Something the state machine reports, dispatched to listeners, triggers and binary sensors from
+/// a later loop() iteration so slow automations do not hold up the RF exchanges.
+enum ST25REventType : uint8_t {
+  EVENT_TAG_ON,
+  EVENT_TAG_OFF,
+  EVENT_BINARY_SENSOR,
+  EVENT_WRITE_FINISHED,
+};
+
+struct ST25REvent {
+  ST25REventType type{EVENT_TAG_ON};
+  bool state{false};  // EVENT_BINARY_SENSOR
+  ST25RUid uid;
+  std::unique_ptr<nfc::NfcTag> tag;      // EVENT_TAG_ON, with the NDEF message read
+  ST25RBinarySensor *sensor{nullptr};  // EVENT_BINARY_SENSOR
+};
+
+/// What the next Type 2 tag presented gets instead of a plain read.
+enum ST25RWriteMode : uint8_t {
+  WRITE_NONE,
+  WRITE_NDEF,    // the armed NDEF message
+  WRITE_FORMAT,  // an empty NDEF message, and a capability container on a blank tag
+  WRITE_ERASE,   // zeros over the TLV area
+};
+
+/// Mifare Classic sectors read so far, and which dictionary key opened each of them, so a card
+/// presented again is reported without authenticating.
+struct ST25RMifareClassicEntry {
+  static const uint8_t KEY_UNKNOWN = 0xFF;  // not tried yet
+  static const uint8_t KEY_NONE = 0xFE;     // no dictionary key opens the sector
+
+  ST25RUid uid;
+  // Per sector: dictionary index << 1, | 1 for key B
+  std::vector<uint8_t> keys;
+  std::vector<bool> sector_read;
+  // 16 bytes per block of the whole card; sector trailers and unreadable sectors stay zero
+  std::vector<uint8_t> data;
+  uint32_t last_used{0};
+};
+
+/// Bus traffic between the MCU and the chip. A burst or FIFO access counts as one transaction.
+struct ST25RBusCounters {
+  uint32_t register_reads{0};
+  uint32_t register_writes{0};  // including direct commands
+  uint32_t fifo_bytes{0};
+};
+
+/// Running min/avg/max of unsigned samples with a log2 histogram for percentile estimates. Fixed
+/// size, so recording a sample never allocates.
+struct ST25RHistogram {
+  // Bucket 0 holds zeros, bucket i holds [2^(i-1), 2^i); the last one is open-ended.
+  static const uint8_t BUCKETS = 24;
+
+  uint32_t count{0};
+  uint32_t min{0};
+  uint32_t max{0};
+  uint64_t sum{0};
+  uint32_t buckets[BUCKETS]{};
+
+  void add(uint32_t value);
+  void reset() { *this = ST25RHistogram(); }
+  float avg() const { return this->count == 0 ? 0.0f : (float) this->sum / this->count; }
+  /// p-th percentile (0-100), interpolated linearly inside its bucket.
+  uint32_t percentile(uint8_t p) const;
+};
+
+/// Durations recorded while stats are enabled, in microseconds.
+enum ST25RTiming : uint8_t {
+  TIMING_UPDATE,     // update(): health check, field strength, start of a round
+  TIMING_LOOP,       // loop() iterations that had something to do
+  TIMING_EXCHANGE,   // transceive_() until the exchange completed or timed out
+  TIMING_ROUND,      // discovery round, from the first WUPA until the reader is idle again
+  TIMING_ACTIVATE,   // WUPA/REQA until ATQA
+  TIMING_CASCADE_1,  // anticollision frames of cascade level 1
+  TIMING_CASCADE_2,
+  TIMING_CASCADE_3,
+  TIMING_SELECT,
+  TIMING_TAG_READ,  // UID known until the tag is reported: NDEF read, authentication, ATS
+  TIMING_COUNT,
+};
+
+const char *timing_to_string(ST25RTiming timing);
+
+/// Instrumentation of the current stats window plus totals since boot. Allocated once in setup()
+/// when stats are configured.
+struct ST25RStats {
+  ST25RHistogram timings[TIMING_COUNT];
+  // Per discovery round
+  ST25RHistogram register_reads;
+  ST25RHistogram register_writes;
+  ST25RHistogram fifo_bytes;
+
+  uint32_t rounds{0};
+  uint32_t tags_read{0};
+  uint32_t timeouts{0};
+  uint32_t irq_errors{0};
+  uint32_t collisions{0};
+
+  // micros() at the start of the round, the exchange, the phase and the tag read in progress
+  uint32_t round_start{0};
+  uint32_t exchange_start{0};
+  uint32_t phase_start{0};
+  uint32_t tag_read_start{0};
+  ST25RBusCounters round_bus;
+};
+
+/// Response APDU including SW1-SW2; success is false if the card stopped answering.
+using ST25RApduCallback = std::function<void(bool success, const std::vector<uint8_t> &response)>;
+
+/// Command APDU queued for the ISO-DEP card being reported.
+struct ST25RApduRequest {
+  std::vector<uint8_t> apdu;
+  ST25RApduCallback callback;
+};
 
 class ST25RTagTrigger : public Trigger<std::string> {
  public:
@@ -77,7 +238,62 @@ class ST25R : public PollingComponent, public nfc::Nfcc {
     STATE_IDLE,
     STATE_WUPA,
     STATE_READ_UID,
+    STATE_SELECT,
+    STATE_HALT,
+    STATE_NFCV_INVENTORY,
+    STATE_NFCV_READ,
+    STATE_NFCF_POLL,
+    STATE_NFCF_READ,
+    STATE_ISO_DEP_RATS,
+    STATE_ISO_DEP_GUARD,
+    STATE_ISO_DEP_PPS,
+    STATE_ISO_DEP_EXCHANGE,
+    STATE_ISO_DEP_EVENTS,
+    STATE_ISO_DEP_DESELECT,
+    STATE_MFC_ACTIVATE,
+    STATE_MFC_SELECT,
+    STATE_MFC_AUTH,
+    STATE_MFC_AUTH_REPLY,
+    STATE_MFC_READ,
+    STATE_GET_VERSION,
+    STATE_READ_TAG,
+    STATE_CACHE_HEAD,
+    STATE_CACHE_TAIL,
+    STATE_WRITE_READ,
+    STATE_WRITE_PAGE,
+    STATE_WRITE_VERIFY,
+    STATE_PRESENCE_WUPA,
+    STATE_PRESENCE_SELECT,
+    STATE_PRESENCE_HALT,
     STATE_REINITIALIZING,
+    STATE_WAKE_UP,
+    STATE_FIELD_SETTLE,
+    STATE_FIELD_OFF,
+  };
+
+  enum Protocol : uint8_t {
+    PROTOCOL_NFC_A,
+    PROTOCOL_NFC_V,
+    PROTOCOL_NFC_F,
+  };
+
+  /// What the ISO-DEP exchange in flight is for: a step of the NFC Forum Type 4 NDEF read or a
+  /// queued send_apdu() request.
+  enum Type4Step : uint8_t {
+    T4_SELECT_APP,
+    T4_SELECT_CC,
+    T4_READ_CC,
+    T4_SELECT_NDEF,
+    T4_READ_NLEN,
+    T4_READ_NDEF,
+    T4_USER_APDU,
+  };
+
+  enum TransceiveResult : uint8_t {
+    TRANSCEIVE_BUSY,
+    TRANSCEIVE_OK,
+    TRANSCEIVE_TIMEOUT,
+    TRANSCEIVE_ERROR,
   };
 
   void setup() override;
@@ -90,77 +306,715 @@ class ST25R : public PollingComponent, public nfc::Nfcc {
   void set_irq_pin(InternalGPIOPin *irq_pin) { this->irq_pin_ = irq_pin; }
   void set_rf_field_enabled(bool enabled) { this->rf_field_enabled_ = enabled; }
   void set_rf_power(uint8_t power) { this->rf_power_ = power; }
+  void set_variant(ST25RVariant variant) { this->variant_ = variant; }
+  ST25RVariant get_variant() const { return this->variant_; }
+  /// Run discovery from loop() between min and max interval, independent of update().
+  void set_fast_poll(uint32_t min_interval, uint32_t max_interval, uint32_t hold_time) {
+    this->fast_poll_ = true;
+    this->fast_poll_min_interval_ = min_interval;
+    this->fast_poll_max_interval_ = max_interval;
+    this->fast_poll_hold_time_ = hold_time;
+    this->poll_interval_ = min_interval;
+  }
+  /// Keep the field off between scans and let the chip's wake-up timer watch for a tag. A delta of 0
+  /// disables that measurement; interval must be 10-80 ms in 10 ms or 100-800 ms in 100 ms steps.
+  void set_wake_up(uint32_t interval, uint8_t amplitude_delta, uint8_t phase_delta, uint8_t capacitance_delta) {
+    this->wake_up_ = true;
+    this->wake_up_interval_ = interval;
+    this->wake_up_amplitude_delta_ = amplitude_delta;
+    this->wake_up_phase_delta_ = phase_delta;
+    this->wake_up_capacitance_delta_ = capacitance_delta;
+  }
+  /// Between discovery rounds, re-select each present NFC-A tag every interval ms and report it
+  /// removed once it has not answered for debounce ms.
+  void set_presence_check(uint32_t interval, uint32_t debounce) {
+    this->presence_check_interval_ = interval;
+    this->presence_debounce_ = debounce;
+  }
+  /// Leave discovery rounds to an ST25RScheduler: update() only runs the health check. With
+  /// field_off the field is switched off after every round until the next start_scheduled_round().
+  void set_scheduled(bool field_off) {
+    this->scheduled_ = true;
+    this->scheduled_field_off_ = field_off;
+  }
+  /// Start a discovery round now, switching the field on first if it is off. False if the reader
+  /// is busy, failed or failing its health check.
+  bool start_scheduled_round();
+  /// A discovery round is running, including the field settling before it.
+  bool is_round_active() const {
+    return this->state_ != STATE_IDLE && this->state_ != STATE_WAKE_UP && this->state_ != STATE_FIELD_OFF;
+  }
 
   void register_on_tag_trigger(ST25RTagTrigger *trig) { this->on_tag_triggers_.push_back(trig); }
   void register_on_tag_removed_trigger(ST25RTagRemovedTrigger *trig) {
     this->on_tag_removed_triggers_.push_back(trig);
   }
+  void register_on_authorized_trigger(ST25RTagTrigger *trig) { this->on_authorized_triggers_.push_back(trig); }
+  void register_on_denied_trigger(ST25RTagTrigger *trig) { this->on_denied_triggers_.push_back(trig); }
+  void register_on_finished_write_trigger(ST25RTagTrigger *trig) { this->on_finished_write_triggers_.push_back(trig); }
   void register_tag(ST25RBinarySensor *tag) { this->binary_sensors_.push_back(tag); }
+  /// Sorted table of ALLOWLIST_RECORD_SIZE-byte records (length, UID zero-padded) kept in flash.
+  void set_allowlist(const uint8_t *table, size_t count) {
+    this->allowlist_ = table;
+    this->allowlist_count_ = count;
+  }
+  /// Also poll ISO15693 (NFC-V) tags after the NFC-A part of every discovery round.
+  void set_nfc_v(bool enabled) { this->nfc_v_ = enabled; }
+  /// Also poll FeliCa (NFC-F) cards at the end of every discovery round. bit_rate is 212 or 424 kbit/s,
+  /// time_slots 1, 2, 4, 8 or 16 SENSF_REQ response slots.
+  void set_nfc_f(uint16_t bit_rate, uint8_t time_slots) {
+    this->nfc_f_ = true;
+    this->nfcf_bit_rate_ = bit_rate;
+    this->nfcf_time_slots_ = time_slots;
+  }
+  /// Highest bit rate (106, 212, 424 or 848 kbit/s) offered to ISO-DEP cards with PPS.
+  void set_iso_dep_max_bit_rate(uint16_t bit_rate) { this->iso_dep_max_bit_rate_ = bit_rate; }
+  /// Dictionary keys tried on every Mifare Classic sector, as key A first, then as key B.
+  void add_mifare_classic_key(uint64_t key) { this->mfc_keys_.push_back(key); }
+  /// Number of Mifare Classic cards whose sectors and keys are kept.
+  void set_mifare_classic_cache_size(uint8_t size) { this->mfc_cache_size_ = size; }
+  /// Number of NDEF messages kept for tags seen before; 0 disables the cache.
+  void set_ndef_cache_size(uint8_t size) { this->ndef_cache_size_ = size; }
+  /// Report a UID again only `window` ms after its last reported tag event, and at most
+  /// max_events tag events per `period` ms overall (0: no cap). Suppressed taps are counted.
+  void set_event_filter(uint32_t window, uint16_t max_events, uint32_t period) {
+    this->event_filter_ = true;
+    this->event_filter_window_ = window;
+    this->event_filter_max_events_ = max_events;
+    this->event_filter_period_ = period;
+    this->event_filter_credit_ = period;
+  }
+  /// Count of suppressed taps since boot, published from update() when it changed.
+  void set_suppressed_taps_sensor(sensor::Sensor *sensor) { this->suppressed_taps_sensor_ = sensor; }
   void set_status_binary_sensor(binary_sensor::BinarySensor *sensor) { this->status_binary_sensor_ = sensor; }
   void set_field_strength_sensor(sensor::Sensor *sensor) { this->field_strength_sensor_ = sensor; }
+  /// Record phase timings and bus counters; sensors are published and the histograms restarted
+  /// every interval.
+  void set_stats_interval(uint32_t interval) { this->stats_interval_ = interval; }
+  void set_round_time_sensor(sensor::Sensor *sensor) { this->round_time_sensor_ = sensor; }
+  void set_tag_read_time_sensor(sensor::Sensor *sensor) { this->tag_read_time_sensor_ = sensor; }
+  void set_loop_time_sensor(sensor::Sensor *sensor) { this->loop_time_sensor_ = sensor; }
+  void set_bus_transactions_sensor(sensor::Sensor *sensor) { this->bus_transactions_sensor_ = sensor; }
+  void set_fifo_bytes_sensor(sensor::Sensor *sensor) { this->fifo_bytes_sensor_ = sensor; }
+  void set_timeouts_sensor(sensor::Sensor *sensor) { this->timeouts_sensor_ = sensor; }
+  void set_irq_errors_sensor(sensor::Sensor *sensor) { this->irq_errors_sensor_ = sensor; }
+  void set_collisions_sensor(sensor::Sensor *sensor) { this->collisions_sensor_ = sensor; }
+
+  bool is_tag_present() const { return !this->present_tags_.empty(); }
+  /// UID of the most recently detected tag still in the field.
+  std::string get_current_uid() const { return this->tag_present_uid_.to_string(); }
+  const ST25RUid &get_current_uid_bytes() const { return this->tag_present_uid_; }
+  /// Every tag in the field, in the order they were first detected.
+  const std::vector<ST25RPresentTag> &get_present_tags() const { return this->present_tags_; }
+  /// Model of the most recently read tag.
+  ST25RTagModel get_tag_model() const { return this->tag_model_; }
+  /// Binary search of the compiled-in allowlist.
+  bool is_authorized(const ST25RUid &uid) const;
+  /// Queue a command APDU for the ISO-DEP card being reported, from an on_tag trigger, a tag_on()
+  /// listener or another APDU's callback. The exchanges run from loop() before the card is deselected;
+  /// false if no ISO-DEP card is active or MAX_QUEUED_APDUS are already waiting.
+  bool send_apdu(const std::vector<uint8_t> &apdu, ST25RApduCallback callback);
+  /// Write an encoded NDEF message to the next Type 2 tag presented, or the one in the field. Only
+  /// pages whose content changes are programmed, then read back; with lock the tag is made read-only
+  /// afterwards. Replaces any write still pending; pending until a tag was written successfully.
+  void write_ndef(const std::vector<uint8_t> &message, bool lock = false);
+  /// Write an empty NDEF message, plus the capability container if the tag has none yet.
+  void format_tag();
+  /// Zero the TLV area after any Lock and Memory Control TLVs.
+  void erase_tag();
+  void cancel_write() { this->write_mode_ = WRITE_NONE; }
+  bool is_writing() const { return this->write_mode_ != WRITE_NONE; }
+  /// An ISO-DEP card is activated and accepts send_apdu().
+  bool is_iso_dep_active() const { return this->iso_dep_active_; }
+  /// Sectors read from a Mifare Classic card, or nullptr if it is not in the cache.
+  const ST25RMifareClassicEntry *get_mifare_classic_card(const ST25RUid &uid) const;
+  /// Bus transactions since boot.
+  const ST25RBusCounters &get_bus_counters() const { return this->bus_; }
+  /// Timings and error counters, or nullptr if stats are not enabled.
+  const ST25RStats *get_stats() const { return this->stats_.get(); }
+#ifdef USE_ST25R_TRACE
+  /// Record every transport call into a ring buffer of size bytes, allocated in setup().
+  void set_trace(size_t size, bool stop_when_full) {
+    this->trace_size_ = size;
+    this->trace_stop_when_full_ = stop_when_full;
+  }
+  /// Log the trace in the text format st25r_replay reads.
+  void dump_trace() const { this->trace_.dump(); }
+  void clear_trace() { this->trace_.clear(); }
+  const ST25RTrace &get_trace() const { return this->trace_; }
+#endif
 
-  bool is_tag_present() const { return this->tag_present_; }
+  static const uint8_t ALLOWLIST_RECORD_SIZE = 1 + ST25RUid::MAX_LENGTH;
+  static const uint8_t MAX_QUEUED_APDUS = 8;
+  static const uint8_t MAX_MIFARE_CLASSIC_KEYS = 32;
 
  protected:
-  virtual uint8_t read_register(uint8_t reg) = 0;
-  virtual void write_register(uint8_t reg, uint8_t value) = 0;
-  virtual void write_command(uint8_t command) = 0;
-  virtual void write_fifo(const uint8_t *data, size_t len) = 0;
-  virtual void read_fifo(uint8_t *data, size_t len) = 0;
+  // Transport of the SPI, I2C or simulated chip.
+  virtual uint8_t bus_read_register(uint8_t reg) = 0;
+  virtual void bus_write_register(uint8_t reg, uint8_t value) = 0;
+  // Burst access using the chip's address auto-increment: one bus transaction for len registers.
+  virtual void bus_read_registers(uint8_t reg, uint8_t *data, size_t len) = 0;
+  virtual void bus_write_registers(uint8_t reg, const uint8_t *data, size_t len) = 0;
+  virtual void bus_write_command(uint8_t command) = 0;
+  virtual void bus_write_fifo(const uint8_t *data, size_t len) = 0;
+  virtual void bus_read_fifo(uint8_t *data, size_t len) = 0;
+
+  // Every access of the driver goes through these, so bus_ counts the whole traffic and the trace
+  // sees every transport call.
+  uint8_t read_register(uint8_t reg) {
+    this->bus_.register_reads++;
+    uint8_t value = this->bus_read_register(reg);
+    this->record_trace_(TRACE_READ_REGISTERS, reg, &value, 1);
+    return value;
+  }
+  void write_register(uint8_t reg, uint8_t value) {
+    this->bus_.register_writes++;
+    this->record_trace_(TRACE_WRITE_REGISTERS, reg, &value, 1);
+    this->bus_write_register(reg, value);
+  }
+  void read_registers(uint8_t reg, uint8_t *data, size_t len) {
+    this->bus_.register_reads++;
+    this->bus_read_registers(reg, data, len);
+    this->record_trace_(TRACE_READ_REGISTERS, reg, data, len);
+  }
+  void write_registers(uint8_t reg, const uint8_t *data, size_t len) {
+    this->bus_.register_writes++;
+    this->record_trace_(TRACE_WRITE_REGISTERS, reg, data, len);
+    this->bus_write_registers(reg, data, len);
+  }
+  void write_command(uint8_t command) {
+    this->bus_.register_writes++;
+    this->record_trace_(TRACE_COMMAND, command);
+    this->bus_write_command(command);
+  }
+  void write_fifo(const uint8_t *data, size_t len) {
+    this->bus_.register_writes++;
+    this->bus_.fifo_bytes += len;
+    this->record_trace_(TRACE_WRITE_FIFO, 0, data, len);
+    this->bus_write_fifo(data, len);
+  }
+  void read_fifo(uint8_t *data, size_t len) {
+    this->bus_.register_reads++;
+    this->bus_.fifo_bytes += len;
+    this->bus_read_fifo(data, len);
+    this->record_trace_(TRACE_READ_FIFO, 0, data, len);
+  }
+  /// Compiled out without a trace: configured.
+  void record_trace_(ST25RTraceOp op, uint8_t addr, const uint8_t *data = nullptr, size_t len = 0) {
+#ifdef USE_ST25R_TRACE
+    this->trace_.record(op, addr, data, len);
+#endif
+  }
+  /// State the bus traffic of a discovery round depends on: shadowed register settings and the
+  /// tags already present. Recorded with TRACE_ROUND so a replay can start at any round.
+  size_t round_snapshot_(uint8_t *out, size_t max_len) const;
+  void restore_round_snapshot_(const uint8_t *data, size_t len);
+
+  void run_update_();
+  void run_loop_();
 
   bool reset_();
+  /// IC_IDENTITY read and checked against the configured variant.
+  bool check_identity_();
+  /// Enable the oscillator and wait until it is stable, at most OSCILLATOR_TIMEOUT_MS.
+  bool start_oscillator_();
   void field_on_();
-  void process_tag_removed_(bool found);
-  bool wait_for_irq_(uint8_t mask, uint32_t timeout_ms);
+  void set_num_tx_bytes_(size_t len, uint8_t last_bits = 0);
+  void process_tag_removed_();
+  /// Whether the tag event of a newly present tag goes out under the event filter; records it
+  /// in reported_tags_ if so.
+  bool filter_tag_event_(const ST25RUid &uid);
+  /// Post the removal of a present tag, with its binary sensors, and drop it.
+  std::vector<ST25RPresentTag>::iterator remove_present_tag_(std::vector<ST25RPresentTag>::iterator it);
+  /// get_current_uid() falls back to the newest tag still in the field.
+  void update_current_tag_();
+  /// A presence check is due: present NFC-A tags, the field on and no round of a scheduler to wait for.
+  bool presence_check_due_() const;
+  /// WUPA, SELECT by the known UID at each cascade level and HLTA for every present NFC-A tag; no
+  /// anticollision and no reads.
+  void start_presence_check_();
+  void presence_next_tag_();
+  void presence_send_select_();
+  void presence_process_select_(TransceiveResult result);
+  void finish_presence_check_();
+  /// Queue an event for dispatch from a later loop(). A full queue dispatches its oldest event
+  /// first, so nothing is dropped.
+  void post_event_(ST25REvent &&event);
+  /// Dispatch queued events until the queue is empty or EVENT_DISPATCH_BUDGET_US has passed;
+  /// at least one event goes out per call.
+  void dispatch_events_();
+  /// Dispatch every queued event now.
+  void flush_events_();
+  void dispatch_event_(ST25REvent &event);
   void reinitialize_();
-  bool transceive_(const uint8_t *data, size_t len, uint8_t *resp, uint8_t &resp_len, uint32_t timeout_ms = 50);
-  std::unique_ptr<nfc::NfcTag> read_tag_(std::vector<uint8_t> &uid);
+  void set_state_(State state);
+  void start_discovery_();
+  void schedule_next_discovery_();
+  /// Transmitter off between scheduled rounds; the oscillator keeps running.
+  void enter_field_off_();
+  void finish_scan_(bool found);
+  uint8_t measure_(uint8_t command);
+  /// Take fresh reference values, switch the field off and hand over to the wake-up timer.
+  void enter_wake_up_();
+  void exit_wake_up_();
+  /// Start an asynchronous exchange. The chip's no-response timer bounds the wait; the result is
+  /// collected by poll_transceive_() from loop() and the response lands in rx_buffer_/rx_len_.
+  void transceive_(const uint8_t *data, size_t len, uint32_t timeout_us = 5000,
+                   uint8_t command = ST25R_CMD_TRANSMIT_WITH_CRC, uint8_t last_bits = 0);
+  /// Wait for one more frame of the same exchange without transmitting, e.g. the next SENSF_REQ slot.
+  void receive_(uint32_t timeout_us);
+  void set_no_response_timer_(uint32_t timeout_us);
+  TransceiveResult poll_transceive_();
+  /// Move the bytes received so far from the FIFO into rx_buffer_.
+  void drain_fifo_();
+  /// Top the FIFO up with the part of a long frame that did not fit at the start.
+  void refill_fifo_();
+  /// REQA/WUPA: wake up the next tag of the round.
+  void activate_(uint8_t command);
+  void send_anticollision_();
+  /// ANTICOLLISION with the sel_bits_ known bits of sel_; the tags fill in the rest.
+  void send_anticollision_frame_();
+  /// Merge a (partial) ANTICOLLISION answer into sel_; false if it can't be resolved further.
+  bool process_anticollision_();
+  void set_anticollision_mode_(bool enabled);
+  /// Switch the analog front end, framing and bit rate between NFC-A, NFC-V and NFC-F.
+  void set_protocol_(Protocol protocol);
+  ST25RPresentTag *find_present_tag_(const ST25RUid &uid);
+  /// Classify the selected tag from its SAK; Type 2 tags are asked for GET_VERSION next.
+  void identify_tag_();
+  void process_version_(TransceiveResult result);
+  /// RATS; the ATS sets the frame size, waiting time and the bit rates PPS may ask for.
+  void start_iso_dep_();
+  void process_ats_(TransceiveResult result);
+  void send_pps_();
+  void process_pps_(TransceiveResult result);
+  /// Send an APDU as one or more chained I-blocks; the response is collected in iso_dep_rx_.
+  void iso_dep_exchange_(const uint8_t *apdu, size_t len);
+  void iso_dep_send_next_();
+  void iso_dep_send_block_(const uint8_t *block, size_t len, uint32_t timeout_us);
+  /// Answer WTX and chaining until the card's last I-block is in, then iso_dep_complete_().
+  void iso_dep_process_block_(TransceiveResult result);
+  void iso_dep_complete_(bool success);
+  /// Next queued send_apdu() request, or S(DESELECT) once the queue is empty.
+  void iso_dep_next_apdu_();
+  void process_deselect_();
+  /// NFC Forum Type 4: NDEF application, capability container, NDEF file.
+  void t4_exchange_(Type4Step step, const uint8_t *apdu, size_t len);
+  void t4_continue_(bool success);
+  void t4_read_next_();
+  /// Mifare Classic: authenticate and read every sector a dictionary key opens, unless the card is
+  /// cached already.
+  void mfc_start_();
+  void mfc_next_sector_();
+  /// AUTH with the next key candidate of the sector, nested inside the running session if any.
+  void mfc_auth_();
+  void mfc_process_nonce_(TransceiveResult result);
+  void mfc_process_auth_reply_(TransceiveResult result);
+  /// The key was wrong or the sector refused the read: the card dropped to IDLE, so the next
+  /// candidate starts with REQA and SELECT.
+  void mfc_auth_failed_();
+  void mfc_reactivate_(TransceiveResult result);
+  void mfc_read_block_();
+  void mfc_process_read_(TransceiveResult result);
+  /// NDEF message of the MAD's NDEF sectors, if any, to on_tag_read_().
+  void mfc_report_();
+  /// Frames with parity bits from the host: encrypted once authenticated, no chip CRC.
+  void set_mfc_raw_mode_(bool enabled);
+  void mfc_transceive_(const uint8_t *data, const uint8_t *parity, size_t len);
+  /// Plain bytes, with CRC_A appended and encrypted once authenticated.
+  void mfc_send_(const uint8_t *plain, size_t len);
+  /// Strip the parity bits of a raw answer into data; returns the number of bytes.
+  size_t mfc_receive_(uint8_t *data, size_t max_len);
+  /// REQA for the tags of the round not halted yet.
+  void next_nfca_tag_();
+  void start_read_tag_();
+  void read_pages_(uint8_t first_page);
+  /// READ of 4 pages, or FAST_READ up to last_page as far as the receive buffer takes it.
+  void read_page_range_(uint8_t first_page, uint16_t last_page);
+  /// Type 2 write: read the user memory, lay the new TLV area over it and program the pages that
+  /// differ, then verify them with batched reads.
+  void start_write_();
+  void write_continue_read_(TransceiveResult result);
+  /// Build write_image_ from write_memory_; false if the tag can't take it.
+  bool prepare_write_();
+  void write_next_page_();
+  void write_process_ack_(TransceiveResult result);
+  void write_continue_verify_(TransceiveResult result);
+  /// Lock bits after a verified write, if asked for; then write_finish_().
+  void lock_tag_();
+  /// Report the outcome and read the tag back through the regular read.
+  void write_finish_(bool success);
+  int find_ndef_cache_(const ST25RUid &uid) const;
+  /// Account for raw Type 2 memory read, keeping its first and last CHECK_SIZE bytes.
+  void track_raw_(const uint8_t *data, size_t len);
+  void store_ndef_cache_();
+  void check_ndef_cache_(TransceiveResult result);
+  /// Binary sensors and round bookkeeping for a tag that answered, new or not.
+  void mark_seen_();
+  /// mark_seen_(), then on to the next tag of the round: NFC-A tags are halted so the next REQA
+  /// reaches the ones still waiting, NFC-V and NFC-F tags are taken from the inventory list.
+  void tag_seen_();
+  void continue_read_tag_(TransceiveResult result);
+  /// NFC-V runs in subcarrier stream mode: frames are coded with CRC in software before they go
+  /// into the FIFO, and answers are decoded in place in rx_buffer_.
+  void nfcv_transceive_(const uint8_t *data, size_t len, uint32_t timeout_us);
+  TransceiveResult nfcv_decode_(TransceiveResult result, bool &collision);
+  void start_nfcv_round_();
+  /// 16-slot INVENTORY with the next mask; slots after the first are opened with a lone EOF.
+  void nfcv_next_inventory_();
+  void nfcv_process_slot_(TransceiveResult result);
+  void nfcv_next_tag_();
+  void nfcv_read_blocks_(uint8_t first_block, uint8_t count);
+  void nfcv_continue_read_(TransceiveResult result);
+  /// SENSF_REQ with nfcf_time_slots_ slots; every card answering in a slot of its own is collected
+  /// from the same request.
+  void start_nfcf_round_();
+  void nfcf_poll_();
+  void nfcf_process_poll_(TransceiveResult result);
+  void nfcf_next_tag_();
+  /// Read Without Encryption of count consecutive blocks of the NDEF service.
+  void nfcf_read_blocks_(uint8_t first_block, uint8_t count);
+  void nfcf_continue_read_(TransceiveResult result);
+  void on_tag_read_(std::unique_ptr<nfc::NfcTag> tag);
+  /// Start the next phase of a read; end_phase_() records the time since and starts the one after.
+  void start_phase_() {
+    if (this->stats_ != nullptr)
+      this->stats_->phase_start = micros();
+  }
+  void end_phase_(ST25RTiming timing);
+  /// Duration, timeout and receive errors of the exchange that just ended.
+  void record_exchange_(TransceiveResult result);
+  void record_collision_() {
+    if (this->stats_ != nullptr)
+      this->stats_->collisions++;
+  }
+  void publish_stats_();
   static void isr(ST25R *arg);
   
   GPIOPin *reset_pin_{nullptr};
   InternalGPIOPin *irq_pin_{nullptr};
 
-  bool tag_present_{false};
-  std::string tag_present_uid_;
+  std::vector<ST25RPresentTag> present_tags_;
+  ST25RUid tag_present_uid_;
   bool rf_field_enabled_{true};
   uint8_t rf_power_{15};
+  ST25RVariant variant_{VARIANT_ST25R3916};
   uint8_t health_check_failures_{0};
   uint8_t reinitialization_attempts_{0};
   volatile bool irq_triggered_{false};
-  volatile uint8_t irq_status_{0};
-  
-  static const uint8_t IRQ_RXS = 0x80;
-  static const uint8_t IRQ_RXE = 0x40;
-  static const uint8_t IRQ_TXE = 0x20;
-  static const uint8_t IRQ_ERR = 0x10;
-  static const uint8_t IRQ_COL = 0x08;
+  bool irq_polling_{true};
+  // IRQ_MAIN, IRQ_TIMER, IRQ_ERROR accumulated over the current exchange
+  uint8_t irq_status_[3]{};
+
+  // IRQ_MAIN
+  static const uint8_t IRQ_OSC = 0x80;
+  static const uint8_t IRQ_WL = 0x40;
+  static const uint8_t IRQ_RXS = 0x20;
+  static const uint8_t IRQ_RXE = 0x10;
+  static const uint8_t IRQ_TXE = 0x08;
+  static const uint8_t IRQ_COL = 0x04;
+  // IRQ_TIMER
+  static const uint8_t IRQ_NRE = 0x40;
+  // FIFO_STATUS2
+  static const uint8_t FIFO_OVERFLOW = 0x10;
+  // IRQ_ERROR
+  static const uint8_t IRQ_CRC = 0x80;
+  static const uint8_t IRQ_PAR = 0x40;
+  static const uint8_t IRQ_ERR2 = 0x20;
+  static const uint8_t IRQ_ERR1 = 0x10;
+  static const uint8_t IRQ_WT = 0x08;
+  static const uint8_t IRQ_WAM = 0x04;
+  static const uint8_t IRQ_WPH = 0x02;
+  static const uint8_t IRQ_WCAP = 0x01;
+
   State state_{STATE_IDLE};
   uint32_t last_state_change_{0};
   uint8_t cascade_level_{0};
-  std::string current_uid_;
-  uint8_t missed_updates_{0};
+  // SEL, NVB, 4 UID bytes and BCC of the cascade level being resolved; sel_bits_ of it are known
+  uint8_t sel_[7]{};
+  uint8_t sel_bits_{0};
+  bool anticollision_mode_{false};
+  ST25RUid current_uid_;
+  // Tags resolved in the current discovery round
+  uint8_t round_tags_{0};
+  static const uint8_t MAX_TAGS_PER_ROUND = 16;
+  Protocol protocol_{PROTOCOL_NFC_A};
+
+  bool nfc_v_{false};
+  // Inventory masks still to probe: a collision in a slot adds the slot number as 4 more mask bits
+  std::vector<std::pair<uint64_t, uint8_t>> nfcv_masks_;
+  uint64_t nfcv_mask_{0};
+  uint8_t nfcv_mask_length_{0};
+  uint8_t nfcv_slot_{0};
+  std::vector<ST25RUid> nfcv_uids_;
+  size_t nfcv_index_{0};
+  uint8_t nfcv_read_count_{0};
+
+  bool nfc_f_{false};
+  uint16_t nfcf_bit_rate_{212};
+  uint8_t nfcf_time_slots_{4};
+  // IDm and the system code each card answered SENSF_REQ with
+  std::vector<std::pair<ST25RUid, uint16_t>> nfcf_cards_;
+  size_t nfcf_index_{0};
+  // SENSF_REQ sent this round, and whether a slot came back garbled
+  uint8_t nfcf_polls_{0};
+  bool nfcf_collision_{false};
+  // micros() at which the last response slot of the pending SENSF_REQ closes
+  uint32_t nfcf_window_end_{0};
+  // Blocks per Read Without Encryption, from the attribute information block
+  uint8_t nfcf_max_blocks_{1};
+  uint16_t nfcf_data_blocks_{0};
+  uint8_t nfcf_read_count_{0};
+  uint8_t atqa_[2]{};
+  uint8_t sak_{0};
+  ST25RTagModel tag_model_{TAG_MODEL_UNKNOWN};
+  // Type 2 user memory in bytes starting at page 4; 0 until GET_VERSION or the CC tells.
+  uint16_t tag_data_size_{0};
+  bool fast_read_{false};
+  // Set after a tag dropped out on GET_VERSION, so the retry goes straight to READ.
+  bool skip_get_version_{false};
+
+  uint16_t iso_dep_max_bit_rate_{424};
+  bool iso_dep_active_{false};
+  // From the ATS: frame size the card accepts, frame waiting time, start-up frame guard time
+  uint16_t iso_dep_fsc_{32};
+  uint32_t iso_dep_fwt_us_{4832};
+  uint32_t iso_dep_sfgt_us_{0};
+  uint8_t iso_dep_ta_{0};
+  // BIT_RATE while the card is active: tx_rate in bits 7:4, rx_rate in bits 3:0
+  uint8_t iso_dep_bit_rate_{0x00};
+  uint32_t iso_dep_guard_start_{0};
+  uint8_t iso_dep_block_number_{0};
+  uint8_t iso_dep_retries_{0};
+  // Command APDU being sent, the last block on air (for retransmission) and the response so far
+  std::vector<uint8_t> iso_dep_tx_;
+  size_t iso_dep_tx_pos_{0};
+  std::vector<uint8_t> iso_dep_block_;
+  std::vector<uint8_t> iso_dep_rx_;
+  Type4Step t4_step_{T4_SELECT_APP};
+  uint16_t t4_max_le_{0};
+  std::vector<ST25RApduRequest> apdu_queue_;
+
+  std::vector<uint64_t> mfc_keys_;
+  uint8_t mfc_cache_size_{4};
+  uint32_t mfc_cache_clock_{0};
+  std::vector<ST25RMifareClassicEntry> mfc_cache_;
+  // Entry of the card being read
+  size_t mfc_entry_{0};
+  Crypto1 mfc_crypto_;
+  bool mfc_authenticated_{false};
+  bool mfc_raw_mode_{false};
+  // The last attempt left the card in IDLE
+  bool mfc_reactivate_pending_{false};
+  uint8_t mfc_sectors_{16};
+  uint8_t mfc_sector_{0};
+  uint8_t mfc_block_{0};
+  // Candidate index within the sector, the candidate tried first, and the key that last worked
+  uint8_t mfc_try_{0};
+  uint8_t mfc_first_key_{ST25RMifareClassicEntry::KEY_UNKNOWN};
+  uint8_t mfc_last_key_{ST25RMifareClassicEntry::KEY_UNKNOWN};
+  uint32_t mfc_nt_{0};
+
+  bool fast_poll_{false};
+  bool scheduled_{false};
+  bool scheduled_field_off_{false};
+  bool health_check_pending_{false};
+  uint32_t fast_poll_min_interval_{20};
+  uint32_t fast_poll_max_interval_{50};
+  uint32_t fast_poll_hold_time_{5000};
+  uint32_t poll_interval_{20};
+  uint32_t last_discovery_{0};
+  uint32_t last_activity_{0};
+  HighFrequencyLoopRequester high_freq_;
+
+  // 0 disables the presence check
+  uint32_t presence_check_interval_{0};
+  uint32_t presence_debounce_{0};
+  uint32_t last_presence_check_{0};
+  // Index into present_tags_ of the tag being checked, and its cascade level
+  size_t presence_index_{0};
+  uint8_t presence_level_{0};
+
+  static const uint8_t EVENT_QUEUE_SIZE = 16;
+  // Ring buffer of pending events, oldest at event_head_
+  ST25REvent events_[EVENT_QUEUE_SIZE];
+  uint8_t event_head_{0};
+  uint8_t event_count_{0};
+  // Keeps loop() at full rate while events are pending
+  HighFrequencyLoopRequester events_high_freq_;
+
+  bool wake_up_{false};
+  uint32_t wake_up_interval_{100};
+  uint8_t wake_up_amplitude_delta_{0};
+  uint8_t wake_up_phase_delta_{0};
+  uint8_t wake_up_capacitance_delta_{0};
+
+  bool transceive_busy_{false};
+  bool transceive_crc_{false};
+  uint32_t transceive_start_{0};
+  uint32_t transceive_guard_ms_{0};
+  uint16_t no_response_timer_{0};
+  // Responses stream through the 512-byte FIFO on water-level interrupts, so a frame may be larger
+  // than the FIFO itself, e.g. a FAST_READ of a whole NTAG216.
+  static const uint16_t FIFO_SIZE = 512;
+  static const uint16_t FRAME_BUFFER_SIZE = 1024;
+  uint8_t rx_buffer_[FRAME_BUFFER_SIZE];
+  uint16_t rx_len_{0};
+  // Valid bits in the last received byte, 0 for a complete byte
+  uint8_t rx_last_bits_{0};
+  bool rx_overflow_{false};
+  // Tail of a transmit frame longer than the FIFO
+  std::vector<uint8_t> tx_pending_;
+  size_t tx_pending_pos_{0};
+  // Type 3 and Type 4 NDEF data read so far, and the message length from the attribute block or
+  // NLEN
+  std::vector<uint8_t> read_data_;
+  size_t ndef_length_{0};
+  // TLV-based tags (Type 2, Type 5, Mifare Classic) stream their memory through the parser, which
+  // collects the NDEF message in ndef_buffer_; reserved once in setup().
+  static const uint16_t NDEF_BUFFER_SIZE = 1024;
+  ST25RTlvParser tlv_;
+  std::vector<uint8_t> ndef_buffer_;
+  // Bytes of tag memory read so far, and the first and last of them for the NDEF cache
+  size_t raw_read_{0};
+  uint8_t raw_head_[ST25RNdefCacheEntry::CHECK_SIZE]{};
+  uint8_t raw_tail_[ST25RNdefCacheEntry::CHECK_SIZE]{};
+
+  uint8_t ndef_cache_size_{4};
+  uint32_t ndef_cache_clock_{0};
+  std::vector<ST25RNdefCacheEntry> ndef_cache_;
+  // Entry under validation by STATE_CACHE_HEAD/STATE_CACHE_TAIL
+  int cache_index_{-1};
+
+  ST25RWriteMode write_mode_{WRITE_NONE};
+  std::vector<uint8_t> write_message_;
+  bool write_lock_{false};
+  // The tag being handled gets the pending write instead of a plain read
+  bool writing_{false};
+  bool write_locking_{false};
+  // Last tag a write was tried on; it is not tried again until it comes back into the field
+  ST25RUid write_attempted_uid_;
+  // User memory from the capability container (page 3) on, as read and as it is to be written
+  std::vector<uint8_t> write_memory_;
+  std::vector<uint8_t> write_image_;
+  // Pages still to program, in order, and the next one; the pages to verify
+  std::vector<uint8_t> write_pages_;
+  size_t write_index_{0};
+  uint8_t write_verify_page_{0};
+  uint8_t write_verify_last_{0};
 
   std::vector<ST25RTagTrigger *> on_tag_triggers_;
   std::vector<ST25RTagRemovedTrigger *> on_tag_removed_triggers_;
+  std::vector<ST25RTagTrigger *> on_authorized_triggers_;
+  std::vector<ST25RTagTrigger *> on_denied_triggers_;
+  std::vector<ST25RTagTrigger *> on_finished_write_triggers_;
   std::vector<ST25RBinarySensor *> binary_sensors_;
+  const uint8_t *allowlist_{nullptr};
+  size_t allowlist_count_{0};
   binary_sensor::BinarySensor *status_binary_sensor_{nullptr};
   sensor::Sensor *field_strength_sensor_{nullptr};
+
+  static const uint8_t REPORTED_TAGS_SIZE = 16;
+  bool event_filter_{false};
+  uint32_t event_filter_window_{0};
+  uint16_t event_filter_max_events_{0};
+  uint32_t event_filter_period_{0};
+  // Token bucket of the global cap in ms of period; each event costs period / max_events.
+  uint32_t event_filter_credit_{0};
+  uint32_t event_filter_last_{0};
+  // Last reported UIDs; the oldest entry is replaced when the table is full.
+  ST25RReportedTag reported_tags_[REPORTED_TAGS_SIZE];
+  uint8_t reported_count_{0};
+  uint32_t suppressed_taps_{0};
+  uint32_t suppressed_taps_published_{UINT32_MAX};
+  sensor::Sensor *suppressed_taps_sensor_{nullptr};
+
+  ST25RBusCounters bus_;
+  uint32_t stats_interval_{0};
+  std::unique_ptr<ST25RStats> stats_;
+  sensor::Sensor *round_time_sensor_{nullptr};
+  sensor::Sensor *tag_read_time_sensor_{nullptr};
+  sensor::Sensor *loop_time_sensor_{nullptr};
+  sensor::Sensor *bus_transactions_sensor_{nullptr};
+  sensor::Sensor *fifo_bytes_sensor_{nullptr};
+  sensor::Sensor *timeouts_sensor_{nullptr};
+  sensor::Sensor *irq_errors_sensor_{nullptr};
+  sensor::Sensor *collisions_sensor_{nullptr};
+
+#ifdef USE_ST25R_TRACE
+  ST25RTrace trace_;
+  size_t trace_size_{0};
+  bool trace_stop_when_full_{false};
+#endif
 };
 
 class ST25RBinarySensor : public binary_sensor::BinarySensor {
  public:
-  void set_uid(const std::vector<uint8_t> &uid) { uid_ = uid; }
-  bool process(const std::string &uid);
-  void on_scan_end() {
-    if (!this->found_) {
-      this->publish_state(false);
-    }
+  void set_uid(const std::vector<uint8_t> &uid) {
+    this->uid_.clear();
+    this->uid_.append(uid.data(), std::min<size_t>(uid.size(), ST25RUid::MAX_LENGTH));
+  }
+  bool process(const ST25RUid &uid);
+  /// End of a discovery round: true if whether the tag was found changed since the last report,
+  /// with the new state in `state`.
+  bool on_scan_end(bool &state) {
+    state = this->found_;
     this->found_ = false;
+    if (this->reported_ && state == this->reported_state_)
+      return false;
+    this->reported_ = true;
+    this->reported_state_ = state;
+    return true;
+  }
+  /// A tag was reported removed between rounds: true if this sensor reported it and now turns off.
+  bool on_removed(const ST25RUid &uid) {
+    if (uid != this->uid_ || !this->reported_ || !this->reported_state_)
+      return false;
+    this->reported_state_ = false;
+    return true;
   }
 
  protected:
-  std::vector<uint8_t> uid_;
+  ST25RUid uid_;
   bool found_{false};
+  bool reported_{false};
+  bool reported_state_{false};
+};
+
+template<typename... Ts> class ST25RWriteNdefAction : public Action<Ts...>, public Parented<ST25R> {
+ public:
+  TEMPLATABLE_VALUE(std::string, uri)
+  TEMPLATABLE_VALUE(std::string, text)
+
+  void set_lock(bool lock) { this->lock_ = lock; }
+
+  void play(Ts... x) override {
+    nfc::NdefMessage message;
+    if (this->uri_.has_value()) {
+      message.add_uri_record(this->uri_.value(x...));
+    } else {
+      message.add_text_record(this->text_.value(x...));
+    }
+    this->parent_->write_ndef(message.encode(), this->lock_);
+  }
+
+ protected:
+  bool lock_{false};
+};
+
+template<typename... Ts> class ST25RFormatAction : public Action<Ts...>, public Parented<ST25R> {
+ public:
+  void play(Ts... x) override { this->parent_->format_tag(); }
+};
+
+template<typename... Ts> class ST25REraseAction : public Action<Ts...>, public Parented<ST25R> {
+ public:
+  void play(Ts... x) override { this->parent_->erase_tag(); }
+};
+
+template<typename... Ts> class ST25RIsWritingCondition : public Condition<Ts...>, public Parented<ST25R> {
+ public:
+  bool check(Ts... x) override { return this->parent_->is_writing(); }
 };
 
 }  // namespace st25r
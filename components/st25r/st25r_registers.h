@@ -1,27 +1,115 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 namespace esphome {
 namespace st25r {
 
-enum ST25R3916Register {
-  ST25R3916_REG_IO_CONF1 = 0x00,
-  ST25R3916_REG_IO_CONF2 = 0x01,
-  ST25R3916_REG_OP_CONTROL = 0x02,
-  ST25R3916_REG_MODE = 0x03,
-  ST25R3916_REG_BIT_RATE = 0x04,
-  // ... other registers as needed
-  ST25R3916_REG_IC_IDENTITY = 0x3F,
+// ST25R3916 / ST25R3916B register map (space A). Both chips share it.
+enum ST25RRegister : uint8_t {
+  IO_CONF1 = 0x00,
+  IO_CONF2 = 0x01,
+  OP_CONTROL = 0x02,
+  MODE = 0x03,
+  BIT_RATE = 0x04,
+  ISO14443A_CONF = 0x05,
+  STREAM_MODE = 0x09,
+  AUX = 0x0A,
+  RX_CONF1 = 0x0B,
+  RX_CONF2 = 0x0C,
+  RX_CONF3 = 0x0D,
+  RX_CONF4 = 0x0E,
+  NO_RESPONSE_TIMER1 = 0x10,
+  NO_RESPONSE_TIMER2 = 0x11,
+  TIMER_EMV_CONTROL = 0x12,
+  MASK_MAIN = 0x16,
+  MASK_TIMER = 0x17,
+  MASK_ERROR = 0x18,
+  MASK_TARGET = 0x19,
+  IRQ_MAIN = 0x1A,
+  IRQ_TIMER = 0x1B,
+  IRQ_ERROR = 0x1C,
+  FIFO_STATUS1 = 0x1E,
+  FIFO_STATUS2 = 0x1F,
+  COLLISION_STATUS = 0x20,
+  NUM_TX_BYTES1 = 0x22,
+  NUM_TX_BYTES2 = 0x23,
+  AD_RESULT = 0x25,
+  TX_DRIVER_CONF = 0x28,
+  AUX_DISPLAY = 0x31,
+  WAKE_UP_TIMER_CONTROL = 0x32,
+  AMPLITUDE_MEASURE_CONF = 0x33,
+  AMPLITUDE_MEASURE_REF = 0x34,
+  PHASE_MEASURE_CONF = 0x37,
+  PHASE_MEASURE_REF = 0x38,
+  CAPACITANCE_MEASURE_CONF = 0x3B,
+  CAPACITANCE_MEASURE_REF = 0x3C,
+  IC_IDENTITY = 0x3F,
 };
 
-enum ST25R3916DirectCommand {
-  ST25R3916_CMD_SET_DEFAULT = 0xC1,
-  ST25R3916_CMD_CLEAR_FIFO = 0xC2,
-  ST25R3916_CMD_TRANSMIT_WITH_CRC = 0xC4,
-  ST25R3916_CMD_TRANSMIT_WITHOUT_CRC = 0xC5,
-  // ... other commands as needed
+// ST25R Commands
+enum ST25RCommand : uint8_t {
+  ST25R_CMD_SET_DEFAULT = 0xC1,
+  ST25R_CMD_STOP_ALL = 0xC2,
+  ST25R_CMD_CLEAR_FIFO = 0xDB,
+  ST25R_CMD_TRANSMIT_WITH_CRC = 0xC4,
+  ST25R_CMD_TRANSMIT_WITHOUT_CRC = 0xC5,
+  ST25R_CMD_TRANSMIT_REQA = 0xC6,
+  ST25R_CMD_TRANSMIT_WUPA = 0xC7,
+  ST25R_CMD_FIELD_ON = 0xC8,
+  ST25R_CMD_MEASURE_AMPLITUDE = 0xD3,
+  ST25R_CMD_MEASURE_PHASE = 0xD9,
+  ST25R_CMD_CALIBRATE_C_SENSOR = 0xDD,
+  ST25R_CMD_MEASURE_CAPACITANCE = 0xDE,
+  ST25R_CMD_START_NO_RESPONSE_TIMER = 0xE3,
 };
 
+// AUX_DISPLAY
+static const uint8_t AUX_DISPLAY_OSC_OK = 0x10;
+
+/// Chip the configuration is built for, checked against IC_IDENTITY when the chip is reset.
+enum ST25RVariant : uint8_t {
+  VARIANT_ST25R3916,
+  VARIANT_ST25R3916B,
+};
+
+/// Registers written in one auto-increment transfer, starting at reg.
+struct ST25RRegisterBurst {
+  uint8_t reg;
+  uint8_t len;
+  uint8_t values[6];
+};
+
+/// What reset_() needs to know about a chip: the ic_type field of IC_IDENTITY (bits 7:3) and the
+/// registers that differ from the SET_DEFAULT values.
+struct ST25RVariantInfo {
+  const char *name;
+  uint8_t ic_type;
+  const ST25RRegisterBurst *init;
+  size_t init_count;
+};
+
+static constexpr ST25RRegisterBurst ST25R3916_INIT[] = {
+    // IO_CONF1: single=0, differential antenna driving (full power). IO_CONF2: sup3V=0, 5V supply.
+    // OP_CONTROL stays off until the field is switched on. MODE: ISO14443A initiator, BIT_RATE
+    // 106 kbit/s both ways, ISO14443A_CONF: standard frames.
+    {IO_CONF1, 6, {0x00, 0x00, 0x00, 0x08, 0x00, 0x00}},
+    // STREAM_MODE, AUX, RX_CONF1, RX_CONF2
+    {STREAM_MODE, 4, {0x01, 0x10, 0x00, 0x68}},
+    // Unmasked: IRQ_MAIN water level and RXE, IRQ_TIMER no-response, IRQ_ERROR CRC/parity/framing
+    {MASK_MAIN, 4, {0xAF, 0xBF, 0x0F, 0xFF}},
+};
+
+// The ST25R3916B is register compatible with the ST25R3916 and runs the same setup.
+static constexpr ST25RVariantInfo ST25R_VARIANTS[] = {
+    {"ST25R3916", 0x05, ST25R3916_INIT, sizeof(ST25R3916_INIT) / sizeof(ST25R3916_INIT[0])},
+    {"ST25R3916B", 0x06, ST25R3916_INIT, sizeof(ST25R3916_INIT) / sizeof(ST25R3916_INIT[0])},
+};
+
+// ic_type of the ST25R3911B. It is only told apart in the log: its register map (IRQ and mask
+// registers, FIFO size, direct command codes) differs from the ST25R3916 one throughout.
+static const uint8_t ST25R3911B_IC_TYPE = 0x01;
+
 }  // namespace st25r
 }  // namespace esphome
@@ -0,0 +1,154 @@
+#include "st25r_tlv.h"
+#include <algorithm>
+
+namespace esphome {
+namespace st25r {
+
+void ST25RTlvParser::reset(std::vector<uint8_t> *out, uint32_t address, uint32_t size, bool control_tlvs) {
+  this->out_ = out;
+  this->out_->clear();
+  this->status_ = TLV_MORE;
+  this->state_ = STATE_TYPE;
+  this->address_ = address;
+  this->tlv_address_ = address;
+  this->end_ = size > 0 ? address + size : UINT32_MAX;
+  this->type_ = TLV_NULL;
+  this->position_ = 0;
+  this->control_tlvs_ = control_tlvs;
+  this->area_count_ = 0;
+}
+
+size_t ST25RTlvParser::remaining() const {
+  if (this->status_ != TLV_MORE || this->state_ != STATE_VALUE || this->type_ != TLV_NDEF)
+    return 0;
+  return this->length_ - this->value_pos_;
+}
+
+size_t ST25RTlvParser::run_length_(uint32_t address, size_t max, size_t &skip) const {
+  skip = 0;
+  size_t run = max;
+  for (uint8_t i = 0; i < this->area_count_; i++) {
+    const Area &area = this->areas_[i];
+    if (address >= area.start && address < area.end) {
+      skip = area.end - address;
+      return 0;
+    }
+    if (area.start > address)
+      run = std::min<size_t>(run, area.start - address);
+  }
+  return run;
+}
+
+ST25RTlvStatus ST25RTlvParser::feed(const uint8_t *data, size_t len, size_t &consumed) {
+  size_t i = 0;
+  while (i < len && this->status_ == TLV_MORE) {
+    size_t skip;
+    size_t run = this->run_length_(this->address_, len - i, skip);
+    if (run == 0) {
+      skip = std::min(skip, len - i);
+      i += skip;
+      this->address_ += skip;
+      continue;
+    }
+    if (this->state_ == STATE_VALUE) {
+      // Whole runs of the value at once
+      size_t count = std::min<size_t>(run, this->length_ - this->value_pos_);
+      if (this->type_ == TLV_NDEF) {
+        this->out_->insert(this->out_->end(), data + i, data + i + count);
+      } else {
+        for (size_t j = 0; j < count && this->value_pos_ + j < sizeof(this->control_); j++)
+          this->control_[this->value_pos_ + j] = data[i + j];
+      }
+      this->value_pos_ += count;
+      i += count;
+      this->address_ += count;
+      if (this->value_pos_ == this->length_)
+        this->end_value_();
+      continue;
+    }
+
+    uint8_t byte = data[i++];
+    this->address_++;
+    switch (this->state_) {
+      case STATE_TYPE:
+        if (byte == TLV_NULL)
+          break;
+        this->type_ = byte;
+        this->tlv_address_ = this->address_ - 1;
+        if (byte == TLV_TERMINATOR) {
+          this->status_ = TLV_NOT_FOUND;
+          break;
+        }
+        this->state_ = STATE_LENGTH;
+        break;
+      case STATE_LENGTH:
+        if (byte == 0xFF) {
+          this->state_ = STATE_LENGTH_HIGH;
+          break;
+        }
+        this->length_ = byte;
+        this->start_value_();
+        break;
+      case STATE_LENGTH_HIGH:
+        this->length_ = byte << 8;
+        this->state_ = STATE_LENGTH_LOW;
+        break;
+      case STATE_LENGTH_LOW:
+        this->length_ |= byte;
+        // The 3-byte form is only valid for lengths of 0xFF and up.
+        if (this->length_ < 0xFF) {
+          this->status_ = TLV_NOT_FOUND;
+          break;
+        }
+        this->start_value_();
+        break;
+      default:
+        break;
+    }
+  }
+  this->position_ += i;
+  consumed = i;
+  return this->status_;
+}
+
+void ST25RTlvParser::start_value_() {
+  this->value_pos_ = 0;
+  this->state_ = STATE_VALUE;
+  // A length the data area cannot hold is corrupt; nothing is buffered for it.
+  if (this->address_ > this->end_ || this->length_ > this->end_ - this->address_) {
+    this->status_ = TLV_NOT_FOUND;
+    return;
+  }
+  if (this->length_ == 0)
+    this->end_value_();
+}
+
+void ST25RTlvParser::end_value_() {
+  this->state_ = STATE_TYPE;
+  if (this->type_ == TLV_NDEF) {
+    this->status_ = TLV_FOUND;
+    return;
+  }
+  if ((this->type_ == TLV_LOCK_CONTROL || this->type_ == TLV_MEMORY_CONTROL) && this->control_tlvs_ &&
+      this->length_ == 3)
+    this->add_control_area_();
+}
+
+void ST25RTlvParser::add_control_area_() {
+  // Position: page address (bits 7:4) and byte offset (3:0), with 2^BytesPerPage bytes per page
+  // (bits 3:0 of the third byte). Size: lock bits for a Lock Control TLV, bytes for a Memory
+  // Control TLV, 0 meaning 256.
+  uint8_t page_address = this->control_[0] >> 4;
+  uint8_t byte_offset = this->control_[0] & 0x0F;
+  uint32_t page_size = 1UL << (this->control_[2] & 0x0F);
+  uint32_t size = this->control_[1] == 0 ? 256 : this->control_[1];
+  if (this->type_ == TLV_LOCK_CONTROL)
+    size = (size + 7) / 8;
+  if (this->area_count_ >= MAX_RESERVED_AREAS)
+    return;
+  uint32_t start = page_address * page_size + byte_offset;
+  this->areas_[this->area_count_++] = Area{start, start + size};
+}
+
+}  // namespace st25r
+}  // namespace esphome
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace st25r {
+
+/// TLV blocks of an NFC Forum tag data area (Type 2, Type 5, Mifare Classic MAD sectors).
+enum ST25RTlvType : uint8_t {
+  TLV_NULL = 0x00,
+  TLV_LOCK_CONTROL = 0x01,
+  TLV_MEMORY_CONTROL = 0x02,
+  TLV_NDEF = 0x03,
+  TLV_PROPRIETARY = 0xFD,
+  TLV_TERMINATOR = 0xFE,
+};
+
+enum ST25RTlvStatus : uint8_t {
+  TLV_MORE,       // fed everything, the NDEF TLV has not ended yet
+  TLV_FOUND,      // the first NDEF TLV is complete; its message is in the output buffer
+  TLV_NOT_FOUND,  // terminator, or a malformed TLV or one running past the data area, before any NDEF TLV
+};
+
+/// Incremental parser of a TLV area, fed as the tag memory arrives.
+///
+/// The value of the first NDEF TLV goes into an output buffer owned by the caller, which is only
+/// grown if the message is larger than its capacity. Every other TLV is skipped by its length,
+/// 1-byte or 3-byte (0xFF, then 16 bits) form. Lock and Memory Control TLVs mark areas of tag
+/// memory that are reserved; bytes inside them are not part of any TLV and are skipped as they
+/// arrive. Parsing stops at the end of the NDEF TLV or at the terminator, so the caller can stop
+/// reading there too.
+class ST25RTlvParser {
+ public:
+  static const uint8_t MAX_RESERVED_AREAS = 4;
+
+  /// Start over with the first byte fed at byte `address` of tag memory, in a data area of `size`
+  /// bytes from there (0 while unknown). Lock and Memory Control TLVs are only honoured with
+  /// control_tlvs, where their page addresses mean something.
+  void reset(std::vector<uint8_t> *out, uint32_t address, uint32_t size, bool control_tlvs);
+  /// Parse the next bytes; returns how many were consumed in `consumed`, which is less than len
+  /// only once the status is no longer TLV_MORE.
+  ST25RTlvStatus feed(const uint8_t *data, size_t len, size_t &consumed);
+  ST25RTlvStatus status() const { return this->status_; }
+  /// Bytes of the NDEF value still to come, or 0 while its length is not known yet.
+  size_t remaining() const;
+  /// Bytes consumed since reset(), reserved bytes included.
+  size_t position() const { return this->position_; }
+  /// Type and tag memory address of the last TLV other than NULL that was started.
+  uint8_t tlv_type() const { return this->type_; }
+  uint32_t tlv_address() const { return this->tlv_address_; }
+  /// Whether a Lock or Memory Control TLV parsed so far reserves the byte at `address`.
+  bool is_reserved(uint32_t address) const {
+    size_t skip;
+    return this->run_length_(address, 1, skip) == 0;
+  }
+
+ protected:
+  enum State : uint8_t {
+    STATE_TYPE,
+    STATE_LENGTH,
+    STATE_LENGTH_HIGH,
+    STATE_LENGTH_LOW,
+    STATE_VALUE,
+  };
+  struct Area {
+    uint32_t start;
+    uint32_t end;
+  };
+
+  /// Bytes from `address` on that are not reserved, at most `max`; 0 if `address` is reserved, in
+  /// which case `skip` is the length of the reserved run.
+  size_t run_length_(uint32_t address, size_t max, size_t &skip) const;
+  void start_value_();
+  void end_value_();
+  void add_control_area_();
+
+  std::vector<uint8_t> *out_{nullptr};
+  ST25RTlvStatus status_{TLV_MORE};
+  State state_{STATE_TYPE};
+  uint8_t type_{TLV_NULL};
+  uint16_t length_{0};
+  uint16_t value_pos_{0};
+  // Value of a Lock or Memory Control TLV: position, size, page/lock geometry
+  uint8_t control_[3]{};
+  uint32_t address_{0};
+  uint32_t tlv_address_{0};
+  uint32_t end_{0};
+  size_t position_{0};
+  bool control_tlvs_{false};
+  Area areas_[MAX_RESERVED_AREAS];
+  uint8_t area_count_{0};
+};
+
+}  // namespace st25r
+}  // namespace esphome
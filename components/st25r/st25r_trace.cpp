@@ -0,0 +1,112 @@
+#include "st25r_trace.h"
+#include "esphome/core/application.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+namespace esphome {
+namespace st25r {
+
+static const char *const TAG = "st25r.trace";
+
+void ST25RTrace::init(size_t size, bool stop_when_full) {
+  this->buffer_.assign(size, 0);
+  this->stop_when_full_ = stop_when_full;
+  this->clear();
+}
+
+void ST25RTrace::clear() {
+  this->tail_ = 0;
+  this->used_ = 0;
+  this->records_ = 0;
+  this->dropped_ = 0;
+}
+
+void ST25RTrace::record(ST25RTraceOp op, uint8_t addr, const uint8_t *data, size_t len) {
+  size_t capacity = this->buffer_.size();
+  if (capacity <= HEADER_SIZE)
+    return;
+  // A record larger than the whole buffer keeps its first bytes only.
+  len = std::min<size_t>({len, capacity - HEADER_SIZE, 0xFFFF});
+  size_t needed = HEADER_SIZE + len;
+  if (this->used_ + needed > capacity) {
+    if (this->stop_when_full_) {
+      this->dropped_++;
+      return;
+    }
+    while (this->used_ + needed > capacity)
+      this->drop_oldest_();
+  }
+
+  uint32_t now = micros();
+  const uint8_t header[HEADER_SIZE] = {
+      (uint8_t) now, (uint8_t) (now >> 8), (uint8_t) (now >> 16), (uint8_t) (now >> 24),
+      op,            addr,                 (uint8_t) len,         (uint8_t) (len >> 8),
+  };
+  size_t pos = (this->tail_ + this->used_) % capacity;
+  this->write_(pos, header, HEADER_SIZE);
+  if (len > 0)
+    this->write_((pos + HEADER_SIZE) % capacity, data, len);
+  this->used_ += needed;
+  this->records_++;
+}
+
+void ST25RTrace::write_(size_t pos, const uint8_t *data, size_t len) {
+  // Split in two where it wraps around the end of the buffer
+  size_t first = std::min(len, this->buffer_.size() - pos);
+  memcpy(&this->buffer_[pos], data, first);
+  memcpy(&this->buffer_[0], data + first, len - first);
+}
+
+void ST25RTrace::drop_oldest_() {
+  size_t len = this->at_(this->tail_ + 6) | (this->at_(this->tail_ + 7) << 8);
+  this->tail_ = (this->tail_ + HEADER_SIZE + len) % this->buffer_.size();
+  this->used_ -= HEADER_SIZE + len;
+  this->records_--;
+  this->dropped_++;
+}
+
+void ST25RTrace::serialize(std::vector<uint8_t> &out) const {
+  out.resize(this->used_);
+  for (size_t i = 0; i < this->used_; i++)
+    out[i] = this->at_(this->tail_ + i);
+}
+
+void ST25RTrace::dump() const {
+  static const char HEX_CHARS[] = "0123456789ABCDEF";
+  ESP_LOGI(TAG, "Trace: %u records, %" PRIu32 " dropped", (unsigned) this->records_, this->dropped_);
+  char hex[LINE_BYTES * 2 + 1];
+  size_t pos = this->tail_;
+  uint32_t previous = 0;
+  for (size_t r = 0; r < this->records_; r++) {
+    uint32_t time = this->at_(pos) | (this->at_(pos + 1) << 8) | (this->at_(pos + 2) << 16) |
+                    ((uint32_t) this->at_(pos + 3) << 24);
+    uint8_t op = this->at_(pos + 4);
+    uint8_t addr = this->at_(pos + 5);
+    size_t len = this->at_(pos + 6) | (this->at_(pos + 7) << 8);
+    pos += HEADER_SIZE;
+    for (size_t offset = 0; offset == 0 || offset < len; offset += LINE_BYTES) {
+      size_t count = std::min<size_t>(len - offset, LINE_BYTES);
+      for (size_t i = 0; i < count; i++) {
+        uint8_t byte = this->at_(pos + offset + i);
+        hex[i * 2] = HEX_CHARS[byte >> 4];
+        hex[i * 2 + 1] = HEX_CHARS[byte & 0x0F];
+      }
+      hex[count * 2] = '\0';
+      if (offset == 0) {
+        ESP_LOGI(TAG, "%" PRIu32 " %c %02X %s", r == 0 ? 0 : time - previous, op, addr, hex);
+      } else {
+        ESP_LOGI(TAG, "+ %s", hex);
+      }
+    }
+    pos += len;
+    previous = time;
+    // Thousands of lines go out in one go.
+    App.feed_wdt();
+  }
+}
+
+}  // namespace st25r
+}  // namespace esphome
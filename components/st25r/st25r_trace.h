@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace st25r {
+
+/// What a trace record stands for. The value is also the letter of the record in the text dump.
+enum ST25RTraceOp : uint8_t {
+  TRACE_READ_REGISTERS = 'R',   // addr: first register, data: values read
+  TRACE_WRITE_REGISTERS = 'W',  // addr: first register, data: values written
+  TRACE_COMMAND = 'C',          // addr: direct command
+  TRACE_WRITE_FIFO = 'T',       // data: bytes loaded for transmission
+  TRACE_READ_FIFO = 'F',        // data: bytes received
+  TRACE_IRQ = 'I',              // IRQ edge picked up by loop()
+  // Marks of the driver, so a replay knows where to start and when update() ran
+  TRACE_SETUP = 'S',   // reset_()
+  TRACE_UPDATE = 'U',  // update() called
+  TRACE_ROUND = 'N',   // discovery round starts; data: ST25R::round_snapshot_()
+};
+
+/// Fixed-size ring of transport records with microsecond timestamps.
+///
+/// A record is a header (time, op, addr, data length; 8 bytes little endian) followed by its data,
+/// stored back to back in one buffer that is allocated once. The oldest records are dropped to make
+/// room, unless stop_when_full is set, which keeps the beginning of a capture from boot instead.
+class ST25RTrace {
+ public:
+  static const uint8_t HEADER_SIZE = 8;
+  /// Data bytes per line of the text dump.
+  static const uint8_t LINE_BYTES = 32;
+
+  void init(size_t size, bool stop_when_full);
+  bool is_enabled() const { return !this->buffer_.empty(); }
+  void record(ST25RTraceOp op, uint8_t addr, const uint8_t *data, size_t len);
+  void clear();
+  size_t size() const { return this->records_; }
+  uint32_t get_dropped() const { return this->dropped_; }
+
+  /// Records oldest first, in the layout they are stored in.
+  void serialize(std::vector<uint8_t> &out) const;
+  /// Log the records as text, one per line: time since the previous record in us, op letter, addr
+  /// and data in hex. Longer data continues on "+" lines. st25r_replay reads this format back.
+  void dump() const;
+
+ protected:
+  uint8_t at_(size_t pos) const { return this->buffer_[pos % this->buffer_.size()]; }
+  void write_(size_t pos, const uint8_t *data, size_t len);
+  void drop_oldest_();
+
+  std::vector<uint8_t> buffer_;
+  // Oldest record, and bytes in use from there on
+  size_t tail_{0};
+  size_t used_{0};
+  size_t records_{0};
+  uint32_t dropped_{0};
+  bool stop_when_full_{false};
+};
+
+}  // namespace st25r
+}  // namespace esphome
@@ -16,26 +16,36 @@ void ST25RI2c::dump_config() {
   LOG_I2C_DEVICE(this);
 }
 
-uint8_t ST25RI2c::read_register(uint8_t reg) {
-  uint8_t value;
-  this->i2c::I2CDevice::read_register(reg, &value, 1);
+uint8_t ST25RI2c::bus_read_register(uint8_t reg) {
+  uint8_t value = 0;
+  this->bus_read_registers(reg, &value, 1);
   return value;
 }
 
-void ST25RI2c::write_register(uint8_t reg, uint8_t value) {
-  this->i2c::I2CDevice::write_register(reg, &value, 1);
+void ST25RI2c::bus_write_register(uint8_t reg, uint8_t value) {
+  this->bus_write_registers(reg, &value, 1);
 }
 
-void ST25RI2c::write_command(uint8_t command) {
+void ST25RI2c::bus_read_registers(uint8_t reg, uint8_t *data, size_t len) {
+  // Register read mode byte is 0x40 | address, same framing as SPI
+  this->i2c::I2CDevice::read_register(0x40 | (reg & 0x3F), data, len);
+}
+
+void ST25RI2c::bus_write_registers(uint8_t reg, const uint8_t *data, size_t len) {
+  // Register write mode byte is 0x00 | address
+  this->i2c::I2CDevice::write_register(reg & 0x3F, data, len);
+}
+
+void ST25RI2c::bus_write_command(uint8_t command) {
   this->i2c::I2CDevice::write(&command, 1);
 }
 
-void ST25RI2c::write_fifo(const uint8_t *data, size_t len) {
+void ST25RI2c::bus_write_fifo(const uint8_t *data, size_t len) {
   // FIFO load command is 0x80
   this->i2c::I2CDevice::write_register(0x80, data, len);
 }
 
-void ST25RI2c::read_fifo(uint8_t *data, size_t len) {
+void ST25RI2c::bus_read_fifo(uint8_t *data, size_t len) {
   // FIFO read command is 0x9F
   this->i2c::I2CDevice::read_register(0x9F, data, len);
 }
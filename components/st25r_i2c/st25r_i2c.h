@@ -16,11 +16,13 @@ class ST25RI2c : public st25r::ST25R, public i2c::I2CDevice {
   using i2c::I2CDevice::write_register;
 
  protected:
-  uint8_t read_register(uint8_t reg) override;
-  void write_register(uint8_t reg, uint8_t value) override;
-  void write_command(uint8_t command) override;
-  void write_fifo(const uint8_t *data, size_t len) override;
-  void read_fifo(uint8_t *data, size_t len) override;
+  uint8_t bus_read_register(uint8_t reg) override;
+  void bus_write_register(uint8_t reg, uint8_t value) override;
+  void bus_read_registers(uint8_t reg, uint8_t *data, size_t len) override;
+  void bus_write_registers(uint8_t reg, const uint8_t *data, size_t len) override;
+  void bus_write_command(uint8_t command) override;
+  void bus_write_fifo(const uint8_t *data, size_t len) override;
+  void bus_read_fifo(uint8_t *data, size_t len) override;
 };
 
 }  // namespace st25r_i2c
@@ -0,0 +1,90 @@
+import re
+
+import esphome.codegen as cg
+from esphome.components import st25r
+import esphome.config_validation as cv
+from esphome.const import CONF_ID, CONF_UPDATE_INTERVAL
+from esphome.core import CORE, HexInt
+
+AUTO_LOAD = ["st25r"]
+CODEOWNERS = ["@JohnMcLear"]
+MULTI_CONF = True
+
+CONF_TRACE_FILE = "trace_file"
+CONF_TRACE_DATA_ID = "trace_data_id"
+CONF_REALTIME = "realtime"
+CONF_EXIT_WHEN_DONE = "exit_when_done"
+
+st25r_replay_ns = cg.esphome_ns.namespace("st25r_replay")
+ST25RReplay = st25r_replay_ns.class_("ST25RReplay", st25r.ST25R)
+
+# One line of ST25RTrace::dump(), with or without the log prefix in front
+TRACE_LINE = re.compile(r"(\d+) ([RWCTFISUN]) ([0-9A-F]{2}) ?([0-9A-F]*)\s*$")
+TRACE_CONTINUATION = re.compile(r"\+ ([0-9A-F]+)\s*$")
+TRACE_HEADER = re.compile(r"Trace: \d+ records")
+# Colors of `esphome logs`
+ANSI_ESCAPE = re.compile(r"\x1b\[[0-9;]*m")
+
+
+def validate_trace_file(value):
+    """Parse a logged trace dump into the binary record layout of ST25RTrace::serialize()."""
+    value = cv.file_(value)
+    records = []
+    with open(CORE.relative_config_path(value), encoding="utf-8") as f:
+        for line_no, line in enumerate(f, 1):
+            line = ANSI_ESCAPE.sub("", line)
+            if TRACE_HEADER.search(line):
+                # A log with several dumps replays the last one
+                records = []
+                continue
+            match = TRACE_CONTINUATION.search(line)
+            if match and records:
+                records[-1][3].extend(bytes.fromhex(match.group(1)))
+                continue
+            match = TRACE_LINE.search(line)
+            if match is None:
+                continue
+            if len(match.group(4)) % 2:
+                raise cv.Invalid(f"{value}:{line_no}: odd number of hex digits")
+            time = int(match.group(1)) + (records[-1][0] if records else 0)
+            records.append(
+                (
+                    time & 0xFFFFFFFF,
+                    ord(match.group(2)),
+                    int(match.group(3), 16),
+                    bytearray.fromhex(match.group(4)),
+                )
+            )
+    if not records:
+        raise cv.Invalid(f"{value}: no trace records found")
+    data = []
+    for time, op, addr, payload in records:
+        header = time.to_bytes(4, "little") + bytes([op, addr]) + len(payload).to_bytes(2, "little")
+        data.extend(header)
+        data.extend(payload)
+    return data
+
+
+CONFIG_SCHEMA = st25r.ST25R_SCHEMA.extend(
+    {
+        cv.GenerateID(): cv.declare_id(ST25RReplay),
+        cv.Required(CONF_TRACE_FILE): validate_trace_file,
+        cv.GenerateID(CONF_TRACE_DATA_ID): cv.declare_id(cg.uint8),
+        # Play the trace back at its recorded pace, so timeouts fire where they did
+        cv.Optional(CONF_REALTIME, default=True): cv.boolean,
+        cv.Optional(CONF_EXIT_WHEN_DONE, default=False): cv.boolean,
+        # update() runs where the trace recorded it
+        cv.Optional(CONF_UPDATE_INTERVAL, default="never"): cv.update_interval,
+    }
+)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await st25r.setup_st25r(var, config)
+
+    data = [HexInt(x) for x in config[CONF_TRACE_FILE]]
+    arr = cg.progmem_array(config[CONF_TRACE_DATA_ID], data)
+    cg.add(var.set_trace_data(arr, len(data)))
+    cg.add(var.set_realtime(config[CONF_REALTIME]))
+    cg.add(var.set_exit_when_done(config[CONF_EXIT_WHEN_DONE]))
@@ -0,0 +1,254 @@
+#include "st25r_replay.h"
+#include "esphome/core/log.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+namespace esphome {
+namespace st25r_replay {
+
+static const char *const TAG = "st25r_replay";
+
+// The driver makes no transport call the trace has next for this long: it went its own way.
+static const uint32_t STALL_TIMEOUT_US = 1000000;
+
+using st25r::ST25RTrace;
+using st25r::ST25RTraceOp;
+
+void ST25RReplay::setup() {
+  ESP_LOGCONFIG(TAG, "Setting up ST25R trace replay...");
+  this->register_listener(this);
+
+  // Start at the reset of a capture from boot, or at the first discovery round of a ring capture.
+  Record record;
+  while (this->peek_(record) && record.op != st25r::TRACE_SETUP && record.op != st25r::TRACE_ROUND) {
+    this->pos_ += ST25RTrace::HEADER_SIZE + record.len;
+    this->records_++;
+  }
+  if (!this->peek_(record)) {
+    ESP_LOGE(TAG, "Trace has no reset or discovery round to start from");
+    this->mark_failed();
+    return;
+  }
+  this->start_us_ = micros();
+  this->trace_start_ = record.time;
+  if (record.op == st25r::TRACE_ROUND) {
+    // loop() starts the round itself; the driver state it depends on comes from the mark.
+    this->restore_round_snapshot_(record.data, record.len);
+    return;
+  }
+  this->pos_ += ST25RTrace::HEADER_SIZE + record.len;
+  this->records_++;
+  st25r::ST25R::setup();
+  // The reset does not depend on it, and whether the IRQ pin is used is only settled afterwards.
+  for (size_t pos = this->pos_; pos + ST25RTrace::HEADER_SIZE <= this->trace_len_;) {
+    const uint8_t *header = this->trace_data_ + pos;
+    if (header[4] == st25r::TRACE_ROUND && header[6] > 0) {
+      this->irq_polling_ = header[ST25RTrace::HEADER_SIZE] & 0x01;
+      break;
+    }
+    pos += ST25RTrace::HEADER_SIZE + (header[6] | (header[7] << 8));
+  }
+}
+
+void ST25RReplay::loop() {
+  if (this->done_ || this->is_failed())
+    return;
+  if (this->resyncing_) {
+    this->resync_();
+    return;
+  }
+  Record record;
+  if (!this->peek_(record)) {
+    this->finish_();
+    return;
+  }
+  // Played back at the recorded pace, the driver sees the same timeouts and polls as often.
+  if (this->realtime_ && record.time - this->trace_start_ > micros() - this->start_us_)
+    return;
+  if (this->pos_ != this->stall_pos_) {
+    this->stall_pos_ = this->pos_;
+    this->stall_start_ = micros();
+  } else if (micros() - this->stall_start_ > STALL_TIMEOUT_US) {
+    this->diverge_(record, "no call");
+    return;
+  }
+
+  switch (record.op) {
+    case st25r::TRACE_UPDATE:
+      this->pos_ += ST25RTrace::HEADER_SIZE + record.len;
+      this->records_++;
+      st25r::ST25R::update();
+      return;
+    case st25r::TRACE_IRQ:
+      this->pos_ += ST25RTrace::HEADER_SIZE + record.len;
+      this->records_++;
+      this->irq_triggered_ = true;
+      break;
+    case st25r::TRACE_ROUND:
+      // Fast poll rounds are started on the driver's own schedule; start them where the trace did.
+      if (this->state_ == STATE_IDLE) {
+        this->pos_ += ST25RTrace::HEADER_SIZE + record.len;
+        this->records_++;
+        this->start_discovery_();
+        return;
+      }
+      break;
+    default:
+      break;
+  }
+  st25r::ST25R::loop();
+}
+
+void ST25RReplay::dump_config() {
+  st25r::ST25R::dump_config();
+  ESP_LOGCONFIG(TAG, "  Trace: %u bytes, realtime: %s", (unsigned) this->trace_len_, YESNO(this->realtime_));
+}
+
+void ST25RReplay::tag_on(nfc::NfcTag &tag) {
+  this->tags_reported_++;
+  ESP_LOGI(TAG, "Tag reported: %s", nfc::format_uid(tag.get_uid()).c_str());
+}
+
+void ST25RReplay::tag_off(nfc::NfcTag &tag) {
+  ESP_LOGI(TAG, "Tag removed: %s", nfc::format_uid(tag.get_uid()).c_str());
+}
+
+// --- Transport -------------------------------------------------------------------------------
+
+uint8_t ST25RReplay::bus_read_register(uint8_t reg) {
+  uint8_t value;
+  this->read_(st25r::TRACE_READ_REGISTERS, reg, &value, 1);
+  return value;
+}
+
+void ST25RReplay::bus_write_register(uint8_t reg, uint8_t value) {
+  this->write_(st25r::TRACE_WRITE_REGISTERS, reg, &value, 1);
+}
+
+void ST25RReplay::bus_read_registers(uint8_t reg, uint8_t *data, size_t len) {
+  this->read_(st25r::TRACE_READ_REGISTERS, reg, data, len);
+}
+
+void ST25RReplay::bus_write_registers(uint8_t reg, const uint8_t *data, size_t len) {
+  this->write_(st25r::TRACE_WRITE_REGISTERS, reg, data, len);
+}
+
+void ST25RReplay::bus_write_command(uint8_t command) { this->write_(st25r::TRACE_COMMAND, command, nullptr, 0); }
+
+void ST25RReplay::bus_write_fifo(const uint8_t *data, size_t len) {
+  this->write_(st25r::TRACE_WRITE_FIFO, 0, data, len);
+}
+
+void ST25RReplay::bus_read_fifo(uint8_t *data, size_t len) { this->read_(st25r::TRACE_READ_FIFO, 0, data, len); }
+
+// --- Trace -----------------------------------------------------------------------------------
+
+bool ST25RReplay::peek_(Record &record) const {
+  if (this->pos_ + ST25RTrace::HEADER_SIZE > this->trace_len_)
+    return false;
+  const uint8_t *header = this->trace_data_ + this->pos_;
+  record.time = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t) header[3] << 24);
+  record.op = (ST25RTraceOp) header[4];
+  record.addr = header[5];
+  record.len = header[6] | (header[7] << 8);
+  record.data = header + ST25RTrace::HEADER_SIZE;
+  return this->pos_ + ST25RTrace::HEADER_SIZE + record.len <= this->trace_len_;
+}
+
+bool ST25RReplay::expect_(ST25RTraceOp op, uint8_t addr, size_t len, Record &record) {
+  // After a divergence the driver runs on with zeros until loop() resyncs it.
+  if (this->done_ || this->resyncing_)
+    return false;
+  while (this->peek_(record)) {
+    if (record.op == st25r::TRACE_IRQ) {
+      // The edge came in while the driver was busy; the flag stays set until it looks.
+      this->irq_triggered_ = true;
+    } else if (record.op != st25r::TRACE_SETUP && record.op != st25r::TRACE_ROUND &&
+               record.op != st25r::TRACE_UPDATE) {
+      break;
+    }
+    this->pos_ += ST25RTrace::HEADER_SIZE + record.len;
+    this->records_++;
+  }
+  if (this->pos_ >= this->trace_len_) {
+    // The driver went on past the end of the capture.
+    this->finish_();
+    return false;
+  }
+  if (record.op != op || record.addr != addr || record.len != len) {
+    this->diverge_(record, str_sprintf("%c %02X [%u]", op, addr, (unsigned) len));
+    return false;
+  }
+  this->pos_ += ST25RTrace::HEADER_SIZE + record.len;
+  this->records_++;
+  return true;
+}
+
+void ST25RReplay::read_(ST25RTraceOp op, uint8_t addr, uint8_t *data, size_t len) {
+  Record record;
+  if (this->expect_(op, addr, len, record)) {
+    memcpy(data, record.data, len);
+  } else {
+    memset(data, 0, len);
+  }
+}
+
+void ST25RReplay::write_(ST25RTraceOp op, uint8_t addr, const uint8_t *data, size_t len) {
+  Record record;
+  if (this->expect_(op, addr, len, record) && len > 0 && memcmp(record.data, data, len) != 0) {
+    this->diverge_(record,
+                   str_sprintf("%c %02X [%u] %s", op, addr, (unsigned) len, format_hex_pretty(data, len).c_str()));
+  }
+}
+
+void ST25RReplay::diverge_(const Record &expected, const std::string &driver) {
+  ESP_LOGE(TAG, "Diverged at record %" PRIu32 ", %.3f s into the trace", this->records_,
+           (expected.time - this->trace_start_) / 1e6f);
+  ESP_LOGE(TAG, "  trace:  %c %02X [%u] %s", expected.op, expected.addr, expected.len,
+           format_hex_pretty(expected.data, expected.len).c_str());
+  ESP_LOGE(TAG, "  driver: %s", driver.c_str());
+  this->divergences_++;
+  this->resyncing_ = true;
+}
+
+void ST25RReplay::resync_() {
+  this->resyncing_ = false;
+  Record record;
+  while (this->peek_(record) && record.op != st25r::TRACE_ROUND) {
+    this->pos_ += ST25RTrace::HEADER_SIZE + record.len;
+    this->records_++;
+  }
+  if (!this->peek_(record)) {
+    this->finish_();
+    return;
+  }
+  // Drop the exchange in flight; loop() starts the round at the mark like any other.
+  ESP_LOGW(TAG, "Resuming at the discovery round at record %" PRIu32, this->records_);
+  this->transceive_busy_ = false;
+  this->tx_pending_.clear();
+  this->skip_get_version_ = false;
+  this->state_ = STATE_IDLE;
+  this->restore_round_snapshot_(record.data, record.len);
+}
+
+void ST25RReplay::finish_() {
+  if (this->done_)
+    return;
+  this->done_ = true;
+  // Tags read or removed at the very end of the trace
+  this->flush_events_();
+  const st25r::ST25RBusCounters &bus = this->get_bus_counters();
+  ESP_LOGI(TAG,
+           "Replay complete: %" PRIu32 " records in %.3f s, %" PRIu32 " tags reported, %" PRIu32 " divergences",
+           this->records_, (micros() - this->start_us_) / 1e6f, this->tags_reported_, this->divergences_);
+  ESP_LOGI(TAG, "  Bus: %" PRIu32 " register reads, %" PRIu32 " register writes, %" PRIu32 " FIFO bytes",
+           bus.register_reads, bus.register_writes, bus.fifo_bytes);
+  if (this->exit_when_done_)
+    exit(this->divergences_ > 0 ? 1 : 0);
+}
+
+}  // namespace st25r_replay
+}  // namespace esphome
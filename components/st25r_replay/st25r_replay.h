@@ -0,0 +1,84 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/components/nfc/nfc.h"
+#include "esphome/components/st25r/st25r.h"
+#include <cstdint>
+#include <string>
+
+namespace esphome {
+namespace st25r_replay {
+
+/// Runs the regular ST25R state machine against a transport trace captured with `trace:`.
+///
+/// Register and FIFO reads are answered from the trace, writes and commands are compared with it,
+/// IRQ edges and update() calls happen where the trace has them. With realtime the trace is played
+/// back at its recorded pace so timeouts fire as they did. A call that does not match the trace is
+/// reported as a divergence, and the replay resumes at the next discovery round. Intended for the
+/// `host` platform.
+class ST25RReplay : public st25r::ST25R, public nfc::NfcTagListener {
+ public:
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+
+  /// Records in the layout of ST25RTrace::serialize(), times counted from the first one.
+  void set_trace_data(const uint8_t *data, size_t len) {
+    this->trace_data_ = data;
+    this->trace_len_ = len;
+  }
+  void set_realtime(bool realtime) { this->realtime_ = realtime; }
+  void set_exit_when_done(bool exit_when_done) { this->exit_when_done_ = exit_when_done; }
+
+  void tag_on(nfc::NfcTag &tag) override;
+  void tag_off(nfc::NfcTag &tag) override;
+
+ protected:
+  struct Record {
+    uint32_t time;
+    st25r::ST25RTraceOp op;
+    uint8_t addr;
+    uint16_t len;
+    const uint8_t *data;
+  };
+
+  uint8_t bus_read_register(uint8_t reg) override;
+  void bus_write_register(uint8_t reg, uint8_t value) override;
+  void bus_read_registers(uint8_t reg, uint8_t *data, size_t len) override;
+  void bus_write_registers(uint8_t reg, const uint8_t *data, size_t len) override;
+  void bus_write_command(uint8_t command) override;
+  void bus_write_fifo(const uint8_t *data, size_t len) override;
+  void bus_read_fifo(uint8_t *data, size_t len) override;
+
+  /// Record at pos_, false at the end of the trace.
+  bool peek_(Record &record) const;
+  /// The driver made a transport call: skip marks, take up a pending IRQ edge, and return the next
+  /// transport record if it is the same call, otherwise report the divergence.
+  bool expect_(st25r::ST25RTraceOp op, uint8_t addr, size_t len, Record &record);
+  void read_(st25r::ST25RTraceOp op, uint8_t addr, uint8_t *data, size_t len);
+  void write_(st25r::ST25RTraceOp op, uint8_t addr, const uint8_t *data, size_t len);
+  void diverge_(const Record &expected, const std::string &driver);
+  /// Skip to the next TRACE_ROUND and put the driver back into the state it records.
+  void resync_();
+  void finish_();
+
+  const uint8_t *trace_data_{nullptr};
+  size_t trace_len_{0};
+  size_t pos_{0};
+  uint32_t records_{0};
+  bool realtime_{true};
+  bool exit_when_done_{false};
+  bool done_{false};
+  bool resyncing_{false};
+  uint32_t divergences_{0};
+  // micros() when the replay started, and the trace time it started at
+  uint32_t start_us_{0};
+  uint32_t trace_start_{0};
+  // Record the driver was first waited on at, and since when
+  size_t stall_pos_{SIZE_MAX};
+  uint32_t stall_start_{0};
+  uint32_t tags_reported_{0};
+};
+
+}  // namespace st25r_replay
+}  // namespace esphome
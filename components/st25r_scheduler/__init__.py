@@ -0,0 +1,91 @@
+import esphome.codegen as cg
+from esphome.components import st25r
+import esphome.config_validation as cv
+import esphome.final_validate as fv
+from esphome.const import CONF_ID, CONF_MODE, CONF_PRIORITY
+
+AUTO_LOAD = ["st25r"]
+CODEOWNERS = ["@JohnMcLear"]
+# One scheduler per bus
+MULTI_CONF = True
+
+CONF_READERS = "readers"
+CONF_MAX_DUTY_CYCLE = "max_duty_cycle"
+CONF_FIELD_OFF = "field_off"
+
+# Lanes are tracked in a 32-bit mask while a turn is handed out
+MAX_READERS = 32
+
+st25r_scheduler_ns = cg.esphome_ns.namespace("st25r_scheduler")
+ST25RScheduler = st25r_scheduler_ns.class_("ST25RScheduler", cg.Component)
+
+ST25RScheduleMode = st25r_scheduler_ns.enum("ST25RScheduleMode")
+SCHEDULE_MODES = {
+    "round_robin": ST25RScheduleMode.SCHEDULE_ROUND_ROBIN,
+    "priority": ST25RScheduleMode.SCHEDULE_PRIORITY,
+}
+
+
+def validate_unique_readers(value):
+    ids = [reader[st25r.CONF_ST25R_ID] for reader in value]
+    for reader_id in ids:
+        if ids.count(reader_id) > 1:
+            raise cv.Invalid(f"Reader '{reader_id}' is listed more than once.")
+    return value
+
+
+READER_SCHEMA = cv.Schema(
+    {
+        cv.Required(st25r.CONF_ST25R_ID): cv.use_id(st25r.ST25R),
+        # Only used in priority mode; every turn a lane waits counts as one more
+        cv.Optional(CONF_PRIORITY, default=0): cv.int_range(min=0, max=255),
+    }
+)
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(ST25RScheduler),
+        cv.Required(CONF_READERS): cv.All(
+            cv.ensure_list(READER_SCHEMA),
+            cv.Length(min=1, max=MAX_READERS),
+            validate_unique_readers,
+        ),
+        cv.Optional(CONF_MODE, default="round_robin"): cv.enum(SCHEDULE_MODES, lower=True),
+        # Share of the time any of the readers may spend in a discovery round
+        cv.Optional(CONF_MAX_DUTY_CYCLE, default="50%"): cv.All(
+            cv.percentage, cv.float_range(min=0.01, max=1.0)
+        ),
+        # Switch the field of a reader off between its turns, so neighbouring antennas stay quiet
+        cv.Optional(CONF_FIELD_OFF, default=True): cv.boolean,
+    }
+).extend(cv.COMPONENT_SCHEMA)
+
+
+def _final_validate(config):
+    full_config = fv.full_config.get()
+    for reader in config[CONF_READERS]:
+        reader_id = reader[st25r.CONF_ST25R_ID]
+        path = full_config.get_path_for_id(reader_id)[:-1]
+        reader_config = full_config.get_config_for_path(path)
+        for key in (st25r.CONF_FAST_POLL, st25r.CONF_WAKE_UP):
+            if key in reader_config:
+                raise cv.Invalid(
+                    f"Reader '{reader_id}' starts its own discovery rounds with {key}:, "
+                    "remove it to schedule the reader."
+                )
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    cg.add(var.set_mode(config[CONF_MODE]))
+    cg.add(var.set_max_duty_cycle(config[CONF_MAX_DUTY_CYCLE]))
+
+    for conf in config[CONF_READERS]:
+        reader = await cg.get_variable(conf[st25r.CONF_ST25R_ID])
+        cg.add(reader.set_scheduled(config[CONF_FIELD_OFF]))
+        cg.add(var.add_reader(reader, conf[CONF_PRIORITY]))
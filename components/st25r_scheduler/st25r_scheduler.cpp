@@ -0,0 +1,98 @@
+#include "st25r_scheduler.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cinttypes>
+
+namespace esphome {
+namespace st25r_scheduler {
+
+static const char *const TAG = "st25r_scheduler";
+
+// Gaps longer than this are timed at the regular loop() interval instead of full loop rate.
+static const uint32_t HIGH_FREQUENCY_GAP_US = 20000;
+// How long to wait before trying again when no reader can take a turn
+static const uint32_t RETRY_US = 100000;
+
+void ST25RScheduler::setup() {
+  // The first turn goes to the first lane.
+  this->last_ = this->lanes_.size() - 1;
+  this->next_turn_ = micros();
+}
+
+void ST25RScheduler::loop() {
+  uint32_t now = micros();
+  if (this->active_ >= 0) {
+    if (this->lanes_[this->active_].reader->is_round_active())
+      return;
+    // A round that kept a reader busy for t is followed by t * (1 - duty) / duty with all of them idle.
+    uint32_t busy = now - this->turn_start_;
+    this->next_turn_ = now + (uint32_t) (busy * (1.0f - this->max_duty_cycle_) / this->max_duty_cycle_);
+    this->active_ = -1;
+  }
+  int32_t wait = (int32_t) (this->next_turn_ - now);
+  if (wait > 0) {
+    if ((uint32_t) wait > HIGH_FREQUENCY_GAP_US) {
+      this->high_freq_.stop();
+    } else {
+      this->high_freq_.start();
+    }
+    return;
+  }
+  if (!this->start_turn_(now))
+    this->next_turn_ = now + RETRY_US;
+}
+
+bool ST25RScheduler::start_turn_(uint32_t now) {
+  size_t count = this->lanes_.size();
+  // Lanes whose reader did not take the turn
+  uint32_t refused = 0;
+  for (size_t attempt = 0; attempt < count; attempt++) {
+    int best = -1;
+    uint32_t best_score = 0;
+    for (size_t i = 1; i <= count; i++) {
+      size_t index = (this->last_ + i) % count;
+      if (refused & (1UL << index))
+        continue;
+      const ST25RSchedulerLane &lane = this->lanes_[index];
+      uint32_t score = lane.waiting + (this->mode_ == SCHEDULE_PRIORITY ? lane.priority : 0);
+      if (best < 0 || score > best_score) {
+        best = index;
+        best_score = score;
+      }
+    }
+    ST25RSchedulerLane &lane = this->lanes_[best];
+    if (!lane.reader->start_scheduled_round()) {
+      refused |= 1UL << best;
+      continue;
+    }
+    uint32_t now_ms = millis();
+    if (lane.turns > 0)
+      lane.max_turn_interval = std::max(lane.max_turn_interval, now_ms - lane.last_turn);
+    lane.last_turn = now_ms;
+    lane.turns++;
+    for (auto &other : this->lanes_)
+      other.waiting++;
+    lane.waiting = 0;
+    ESP_LOGVV(TAG, "Turn of lane %d", best);
+    this->active_ = best;
+    this->last_ = best;
+    this->turn_start_ = now;
+    return true;
+  }
+  return false;
+}
+
+void ST25RScheduler::dump_config() {
+  ESP_LOGCONFIG(TAG, "ST25R Scheduler:");
+  ESP_LOGCONFIG(TAG, "  Mode: %s", this->mode_ == SCHEDULE_PRIORITY ? "priority" : "round robin");
+  ESP_LOGCONFIG(TAG, "  Max Duty Cycle: %.0f%%", this->max_duty_cycle_ * 100.0f);
+  for (size_t i = 0; i < this->lanes_.size(); i++) {
+    const ST25RSchedulerLane &lane = this->lanes_[i];
+    ESP_LOGCONFIG(TAG, "  Lane %u: priority %u, %" PRIu32 " turns, at most %" PRIu32 "ms between turns",
+                  (unsigned) i, lane.priority, lane.turns, lane.max_turn_interval);
+  }
+}
+
+}  // namespace st25r_scheduler
+}  // namespace esphome
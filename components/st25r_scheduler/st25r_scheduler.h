@@ -0,0 +1,72 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+#include "esphome/components/st25r/st25r.h"
+#include <vector>
+
+namespace esphome {
+namespace st25r_scheduler {
+
+enum ST25RScheduleMode : uint8_t {
+  SCHEDULE_ROUND_ROBIN,
+  SCHEDULE_PRIORITY,
+};
+
+/// A reader taking turns, and how its turns went so far.
+struct ST25RSchedulerLane {
+  st25r::ST25R *reader;
+  uint8_t priority;
+  // Turns given to other lanes since its last one. Added to the priority when picking the next
+  // lane, so a low priority lane still gets its turn.
+  uint32_t waiting{0};
+  uint32_t turns{0};
+  // millis() at the start of the last turn, and the longest time between two turns
+  uint32_t last_turn{0};
+  uint32_t max_turn_interval{0};
+};
+
+/// Time-slices discovery rounds across several ST25R readers on one bus, so only one of them
+/// drives its field and talks to its chip at a time.
+///
+/// The next lane is the one with the highest priority plus turns waited (every priority counts as
+/// 0 in round-robin mode), ties going in configuration order. After a round the scheduler waits in
+/// proportion to how long the round took, which keeps the time any reader is busy under
+/// max_duty_cycle.
+class ST25RScheduler : public Component {
+ public:
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  // After the readers, which switch their fields off in setup()
+  float get_setup_priority() const override { return setup_priority::DATA - 1.0f; }
+
+  void set_mode(ST25RScheduleMode mode) { this->mode_ = mode; }
+  /// Fraction of the time a reader may be in a round, 0 < duty <= 1.
+  void set_max_duty_cycle(float duty) { this->max_duty_cycle_ = duty; }
+  void add_reader(st25r::ST25R *reader, uint8_t priority) {
+    ST25RSchedulerLane lane;
+    lane.reader = reader;
+    lane.priority = priority;
+    this->lanes_.push_back(lane);
+  }
+  const std::vector<ST25RSchedulerLane> &get_lanes() const { return this->lanes_; }
+
+ protected:
+  /// Give the next lane that can take it a turn; false if every reader is busy or failed.
+  bool start_turn_(uint32_t now);
+
+  std::vector<ST25RSchedulerLane> lanes_;
+  ST25RScheduleMode mode_{SCHEDULE_ROUND_ROBIN};
+  float max_duty_cycle_{1.0f};
+  // Lane whose round runs, or -1; the lane that had the last turn
+  int active_{-1};
+  int last_{-1};
+  // micros() when the turn started, and the earliest the next one may start
+  uint32_t turn_start_{0};
+  uint32_t next_turn_{0};
+  HighFrequencyLoopRequester high_freq_;
+};
+
+}  // namespace st25r_scheduler
+}  // namespace esphome
@@ -0,0 +1,99 @@
+import esphome.codegen as cg
+from esphome.components import st25r
+import esphome.config_validation as cv
+from esphome.const import CONF_ID, CONF_TIMEOUT, CONF_TYPE, CONF_UID
+from esphome.core import HexInt
+
+AUTO_LOAD = ["st25r"]
+CODEOWNERS = ["@JohnMcLear"]
+MULTI_CONF = True
+
+CONF_TAGS = "tags"
+CONF_NDEF_URI = "ndef_uri"
+CONF_BENCHMARK = "benchmark"
+CONF_ITERATIONS = "iterations"
+CONF_DWELL_TIME = "dwell_time"
+CONF_GAP_TIME = "gap_time"
+CONF_EXIT_WHEN_DONE = "exit_when_done"
+
+st25r_sim_ns = cg.esphome_ns.namespace("st25r_sim")
+ST25RSim = st25r_sim_ns.class_("ST25RSim", st25r.ST25R)
+
+SimTagType = st25r_sim_ns.enum("SimTagType")
+TAG_TYPES = {
+    "mifare_classic_1k": SimTagType.SIM_TAG_MIFARE_CLASSIC_1K,
+    "ultralight": SimTagType.SIM_TAG_ULTRALIGHT,
+    "ntag213": SimTagType.SIM_TAG_NTAG213,
+    "ntag215": SimTagType.SIM_TAG_NTAG215,
+    "ntag216": SimTagType.SIM_TAG_NTAG216,
+    "icode_slix": SimTagType.SIM_TAG_ICODE_SLIX,
+    "st25dv04k": SimTagType.SIM_TAG_ST25DV04K,
+    "felica_lite_s": SimTagType.SIM_TAG_FELICA_LITE_S,
+    "felica_standard": SimTagType.SIM_TAG_FELICA_STANDARD,
+    "desfire_ev2": SimTagType.SIM_TAG_DESFIRE_EV2,
+}
+VICINITY_TAG_TYPES = ("icode_slix", "st25dv04k")
+FELICA_TAG_TYPES = ("felica_lite_s", "felica_standard")
+
+
+def validate_tag_uid_length(config):
+    length = len(config[CONF_UID].split("-"))
+    if config[CONF_TYPE] in VICINITY_TAG_TYPES:
+        if length != 8:
+            raise cv.Invalid("ISO15693 tag UIDs must be 8 bytes long.")
+    elif config[CONF_TYPE] in FELICA_TAG_TYPES:
+        if length != 8:
+            raise cv.Invalid("FeliCa IDm must be 8 bytes long.")
+    elif length not in (4, 7, 10):
+        raise cv.Invalid("Simulated ISO14443A tag UIDs must be 4, 7 or 10 bytes long.")
+    return config
+
+
+SIM_TAG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Required(CONF_UID): st25r.validate_uid,
+            cv.Optional(CONF_TYPE, default="ntag215"): cv.enum(TAG_TYPES, lower=True),
+            cv.Optional(CONF_NDEF_URI, default=""): cv.string,
+        }
+    ),
+    validate_tag_uid_length,
+)
+
+BENCHMARK_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_ITERATIONS, default=5): cv.positive_not_null_int,
+        cv.Optional(
+            CONF_DWELL_TIME, default="500ms"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_GAP_TIME, default="250ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_TIMEOUT, default="10s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_EXIT_WHEN_DONE, default=False): cv.boolean,
+    }
+)
+
+CONFIG_SCHEMA = st25r.ST25R_SCHEMA.extend(
+    {
+        cv.GenerateID(): cv.declare_id(ST25RSim),
+        cv.Optional(CONF_TAGS, default=[]): cv.ensure_list(SIM_TAG_SCHEMA),
+        cv.Optional(CONF_BENCHMARK): BENCHMARK_SCHEMA,
+    }
+)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await st25r.setup_st25r(var, config)
+
+    for tag in config[CONF_TAGS]:
+        uid = [HexInt(int(x, 16)) for x in tag[CONF_UID].split("-")]
+        cg.add(var.add_tag(uid, tag[CONF_TYPE], tag[CONF_NDEF_URI]))
+
+    if CONF_BENCHMARK in config:
+        bench = config[CONF_BENCHMARK]
+        cg.add(var.set_benchmark_enabled(True))
+        cg.add(var.set_iterations(bench[CONF_ITERATIONS]))
+        cg.add(var.set_dwell_time(bench[CONF_DWELL_TIME]))
+        cg.add(var.set_gap_time(bench[CONF_GAP_TIME]))
+        cg.add(var.set_timeout(bench[CONF_TIMEOUT]))
+        cg.add(var.set_exit_when_done(bench[CONF_EXIT_WHEN_DONE]))
@@ -0,0 +1,1738 @@
+#include "st25r_sim.h"
+#include "esphome/core/log.h"
+#include "esphome/core/hal.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+namespace esphome {
+namespace st25r_sim {
+
+static const char *const TAG = "st25r_sim";
+
+// How much each tag in the field shifts the antenna measurements used by the wake-up timer.
+static const uint8_t SIM_AMPLITUDE_IDLE = 0x80;
+static const uint8_t SIM_AMPLITUDE_PER_TAG = 0x08;
+static const uint8_t SIM_PHASE_IDLE = 0x60;
+static const uint8_t SIM_PHASE_PER_TAG = 0x06;
+static const uint8_t SIM_CAPACITANCE_IDLE = 0x40;
+static const uint8_t SIM_CAPACITANCE_PER_TAG = 0x04;
+
+// ST25R3916 register indices and bits modelled here that the core does not name.
+static const uint8_t SIM_REG_NRT1 = 0x10;
+static const uint8_t SIM_REG_NRT2 = 0x11;
+static const uint8_t SIM_REG_TIMER_EMV_CONTROL = 0x12;
+static const uint8_t SIM_REG_MASK_BASE = 0x16;
+static const uint8_t SIM_REG_IRQ_BASE = 0x1A;
+static const uint8_t SIM_REG_AD_RESULT = 0x25;
+static const uint8_t SIM_REG_WUT_CONTROL = 0x32;
+static const uint8_t SIM_REG_AMPLITUDE_CONF = 0x33;
+static const uint8_t SIM_REG_PHASE_CONF = 0x37;
+static const uint8_t SIM_REG_CAPACITANCE_CONF = 0x3B;
+static const uint8_t SIM_IC_REVISION = 0x02;
+
+static const uint8_t SIM_IRQ_MAIN = 0;
+static const uint8_t SIM_IRQ_TIMER = 1;
+static const uint8_t SIM_IRQ_ERROR = 2;
+static const uint8_t SIM_IRQ_MAIN_WL = 0x40;
+static const uint8_t SIM_IRQ_MAIN_RXS = 0x20;
+static const uint8_t SIM_IRQ_MAIN_RXE = 0x10;
+static const uint8_t SIM_IRQ_MAIN_TXE = 0x08;
+static const uint8_t SIM_IRQ_MAIN_COL = 0x04;
+static const uint8_t SIM_IRQ_TIMER_NRE = 0x40;
+static const uint8_t SIM_IRQ_TIMER_DCT = 0x80;
+static const uint8_t SIM_IRQ_ERROR_WAM = 0x04;
+static const uint8_t SIM_IRQ_ERROR_WPH = 0x02;
+static const uint8_t SIM_IRQ_ERROR_WCAP = 0x01;
+
+static const uint8_t SIM_OP_EN = 0x80;
+static const uint8_t SIM_OP_TX_EN = 0x08;
+static const uint8_t SIM_OP_WU = 0x04;
+
+static const uint8_t SIM_CMD_SET_DEFAULT = 0xC1;
+static const uint8_t SIM_CMD_STOP = 0xC2;
+static const uint8_t SIM_CMD_TRANSMIT_WITH_CRC = 0xC4;
+static const uint8_t SIM_CMD_TRANSMIT_WITHOUT_CRC = 0xC5;
+static const uint8_t SIM_CMD_TRANSMIT_REQA = 0xC6;
+static const uint8_t SIM_CMD_TRANSMIT_WUPA = 0xC7;
+static const uint8_t SIM_CMD_INITIAL_RF_COLLISION = 0xC8;
+static const uint8_t SIM_CMD_MEASURE_AMPLITUDE = 0xD3;
+static const uint8_t SIM_CMD_MEASURE_PHASE = 0xD9;
+static const uint8_t SIM_CMD_MEASURE_CAPACITANCE = 0xDE;
+static const uint8_t SIM_CMD_CLEAR_FIFO = 0xDB;
+static const uint8_t SIM_CMD_START_NO_RESPONSE_TIMER = 0xE3;
+static const uint8_t SIM_IRQ_ERROR_CRC = 0x80;
+
+// FeliCa system codes: NFC Forum Type 3 (NDEF) and a transit system
+static const uint16_t SIM_FELICA_SYSTEM_NDEF = 0x12FC;
+static const uint16_t SIM_FELICA_SYSTEM_TRANSIT = 0x0003;
+static const uint8_t SIM_FELICA_BLOCK_SIZE = 16;
+// FeliCa Lite-S: blocks of the NDEF service and blocks per Read Without Encryption
+static const uint8_t SIM_FELICA_LITE_S_BLOCKS = 14;
+static const uint8_t SIM_FELICA_LITE_S_NBR = 4;
+
+// Type 4: capability container (MLe/MLc 255, NDEF file E104 of 2 KiB, free read and write) and
+// the ATS (FSCI 5, DS/DR 2/4/8, FWI 8, SFGI 1)
+static const uint8_t SIM_T4_CC[] = {0x00, 0x0F, 0x20, 0x00, 0xFF, 0x00, 0xFF, 0x04,
+                                    0x06, 0xE1, 0x04, 0x08, 0x00, 0x00, 0x00};
+static const uint8_t SIM_T4_NDEF_APP[] = {0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01};
+static const uint16_t SIM_T4_CC_FILE = 0xE103;
+static const uint16_t SIM_T4_NDEF_FILE = 0xE104;
+static const uint16_t SIM_T4_NDEF_FILE_SIZE = 2048;
+static const uint8_t SIM_ATS[] = {0x06, 0x75, 0x77, 0x81, 0x02, 0x80};
+static const uint16_t SIM_FSD_TABLE[] = {16, 24, 32, 40, 48, 64, 96, 128, 256};
+
+// Mifare Classic 1K: sector 0 with the MAD behind key A A0A1A2A3A4A5, NDEF sectors behind the NFC
+// Forum key D3F7D3F7D3F7, the last sector behind a key no default dictionary has, the rest on
+// the factory key. Access bits FF0780: either key reads the data blocks.
+static const uint8_t SIM_CLASSIC_SECTORS = 16;
+static const uint8_t SIM_CLASSIC_KEY_MAD[6] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5};
+static const uint8_t SIM_CLASSIC_KEY_NDEF[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+static const uint8_t SIM_CLASSIC_KEY_FACTORY[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static const uint8_t SIM_CLASSIC_KEY_LOCKED[6] = {0x4B, 0x79, 0x1B, 0xEA, 0x7B, 0xCC};
+static const uint8_t SIM_CLASSIC_ACCESS[4] = {0xFF, 0x07, 0x80, 0x69};
+
+static uint16_t crc_a(const uint8_t *data, size_t len) {
+  uint16_t crc = 0x6363;
+  for (size_t i = 0; i < len; i++) {
+    uint8_t b = data[i] ^ (uint8_t) (crc & 0xFF);
+    b ^= (uint8_t) (b << 4);
+    crc = (crc >> 8) ^ ((uint16_t) b << 8) ^ ((uint16_t) b << 3) ^ (b >> 4);
+  }
+  return crc;
+}
+
+// CLn of a cascade level as sent in ANTICOLLISION/SELECT: UID bytes (after a cascade tag 0x88 if the
+// UID continues) and BCC. False if the UID has no such level.
+static bool cascade_bytes(const SimTag &tag, uint8_t level, uint8_t *cl) {
+  uint8_t levels = tag.uid.size() == 4 ? 1 : (tag.uid.size() == 7 ? 2 : 3);
+  if (level >= levels)
+    return false;
+  size_t offset = level * 3;
+  if (level + 1 < levels) {
+    cl[0] = 0x88;
+    cl[1] = tag.uid[offset];
+    cl[2] = tag.uid[offset + 1];
+    cl[3] = tag.uid[offset + 2];
+  } else {
+    for (int i = 0; i < 4; i++)
+      cl[i] = tag.uid[offset + i];
+  }
+  cl[4] = cl[0] ^ cl[1] ^ cl[2] ^ cl[3];
+  return true;
+}
+
+static bool is_vicinity(SimTagType type) { return type == SIM_TAG_ICODE_SLIX || type == SIM_TAG_ST25DV04K; }
+static bool is_felica(SimTagType type) { return type == SIM_TAG_FELICA_LITE_S || type == SIM_TAG_FELICA_STANDARD; }
+
+// CRC-16/ISO15693: reflected 0x1021, preset 0xFFFF, inverted
+static uint16_t crc_15693(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 0x0001) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+  }
+  return ~crc;
+}
+
+// CRC-16/CCITT as used by FeliCa: 0x1021, preset 0x0000, sent MSB first
+static uint16_t crc_felica(const uint8_t *data, size_t len) {
+  uint16_t crc = 0x0000;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t) data[i] << 8;
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// ISO15693 UIDs are written MSB first (E0 ...) but sent LSB first.
+static uint64_t vicc_uid(const SimTag &tag) {
+  uint64_t value = 0;
+  for (uint8_t byte : tag.uid)
+    value = (value << 8) | byte;
+  return value;
+}
+
+// Single URI record (identifier code 0x00, no abbreviation), empty without a URI.
+static std::vector<uint8_t> ndef_uri_message(const std::string &ndef_uri) {
+  std::vector<uint8_t> message;
+  if (!ndef_uri.empty()) {
+    size_t payload_len = ndef_uri.size() + 1;
+    message.push_back(payload_len < 256 ? 0xD1 : 0xC1);
+    message.push_back(0x01);
+    if (payload_len >= 256) {
+      message.push_back((payload_len >> 24) & 0xFF);
+      message.push_back((payload_len >> 16) & 0xFF);
+      message.push_back((payload_len >> 8) & 0xFF);
+    }
+    message.push_back(payload_len & 0xFF);
+    message.push_back('U');
+    message.push_back(0x00);
+    message.insert(message.end(), ndef_uri.begin(), ndef_uri.end());
+  }
+  return message;
+}
+
+// ndef_uri_message() wrapped in an NDEF TLV.
+static std::vector<uint8_t> ndef_uri_tlv(const std::string &ndef_uri) {
+  std::vector<uint8_t> message = ndef_uri_message(ndef_uri);
+  std::vector<uint8_t> tlv;
+  tlv.push_back(0x03);
+  if (message.size() < 0xFF) {
+    tlv.push_back(message.size());
+  } else {
+    tlv.push_back(0xFF);
+    tlv.push_back((message.size() >> 8) & 0xFF);
+    tlv.push_back(message.size() & 0xFF);
+  }
+  tlv.insert(tlv.end(), message.begin(), message.end());
+  tlv.push_back(0xFE);
+  return tlv;
+}
+
+static uint8_t crc_mad(const uint8_t *data, size_t len) {
+  uint8_t crc = 0xC7;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1;
+  }
+  return crc;
+}
+
+static uint32_t be32(const uint8_t *data) {
+  return ((uint32_t) data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+// Bits go over the air LSB first.
+static bool frame_bit(const uint8_t *frame, size_t pos) { return (frame[pos / 8] >> (pos % 8)) & 0x01; }
+
+static const char *tag_type_to_string(SimTagType type) {
+  switch (type) {
+    case SIM_TAG_MIFARE_CLASSIC_1K:
+      return "Mifare Classic 1K";
+    case SIM_TAG_ULTRALIGHT:
+      return "Ultralight";
+    case SIM_TAG_NTAG213:
+      return "NTAG213";
+    case SIM_TAG_NTAG215:
+      return "NTAG215";
+    case SIM_TAG_NTAG216:
+      return "NTAG216";
+    case SIM_TAG_ICODE_SLIX:
+      return "ICODE SLIX";
+    case SIM_TAG_ST25DV04K:
+      return "ST25DV04K";
+    case SIM_TAG_FELICA_LITE_S:
+      return "FeliCa Lite-S";
+    case SIM_TAG_FELICA_STANDARD:
+      return "FeliCa Standard";
+    case SIM_TAG_DESFIRE_EV2:
+      return "DESFire EV2";
+    default:
+      return "Unknown";
+  }
+}
+
+static void log_stat_ms(const char *name, const SimStat &stat) {
+  if (stat.count == 0) {
+    ESP_LOGI(TAG, "    %s: n/a", name);
+    return;
+  }
+  ESP_LOGI(TAG, "    %s min/avg/max: %.1f / %.1f / %.1f ms", name, stat.min / 1000.0f, stat.avg() / 1000.0f,
+           stat.max / 1000.0f);
+}
+
+void SimStat::add(uint32_t value) {
+  if (this->count == 0 || value < this->min)
+    this->min = value;
+  if (value > this->max)
+    this->max = value;
+  this->sum += value;
+  this->count++;
+}
+
+void ST25RSim::add_tag(const std::vector<uint8_t> &uid, SimTagType type, const std::string &ndef_uri) {
+  SimTag tag;
+  tag.uid = uid;
+  tag.type = type;
+  tag.has_ndef = !ndef_uri.empty();
+
+  if (is_vicinity(type)) {
+    // Block 0 holds the capability container (data area size / 8, READ_MULTIPLE_BLOCKS supported),
+    // the TLV area follows.
+    size_t blocks = type == SIM_TAG_ICODE_SLIX ? 28 : 128;
+    tag.memory.assign(blocks * 4, 0x00);
+    tag.memory[0] = 0xE1;
+    tag.memory[1] = 0x40;
+    tag.memory[2] = (tag.memory.size() - 4) / 8;
+    tag.memory[3] = 0x01;
+    std::vector<uint8_t> tlv = ndef_uri_tlv(ndef_uri);
+    if (4 + tlv.size() > tag.memory.size()) {
+      ESP_LOGW(TAG, "NDEF message does not fit into %s, truncating", tag_type_to_string(type));
+      tlv.resize(tag.memory.size() - 4);
+    }
+    std::memcpy(&tag.memory[4], tlv.data(), tlv.size());
+  } else if (type == SIM_TAG_FELICA_LITE_S) {
+    // NDEF service of a Type 3 formatted Lite-S: the attribute information block, then the message
+    // itself without a TLV.
+    tag.memory.assign(SIM_FELICA_LITE_S_BLOCKS * SIM_FELICA_BLOCK_SIZE, 0x00);
+    std::vector<uint8_t> message = ndef_uri_message(ndef_uri);
+    if (SIM_FELICA_BLOCK_SIZE + message.size() > tag.memory.size()) {
+      ESP_LOGW(TAG, "NDEF message does not fit into %s, truncating", tag_type_to_string(type));
+      message.resize(tag.memory.size() - SIM_FELICA_BLOCK_SIZE);
+    }
+    // Version 1.0, Nbr, Nbw, Nmaxb, 4 reserved, WriteF, RWFlag, Ln, checksum
+    uint8_t *attr = tag.memory.data();
+    attr[0] = 0x10;
+    attr[1] = SIM_FELICA_LITE_S_NBR;
+    attr[2] = 0x01;
+    attr[4] = SIM_FELICA_LITE_S_BLOCKS - 1;
+    attr[10] = 0x01;
+    attr[11] = (message.size() >> 16) & 0xFF;
+    attr[12] = (message.size() >> 8) & 0xFF;
+    attr[13] = message.size() & 0xFF;
+    uint16_t sum = 0;
+    for (int i = 0; i < 14; i++)
+      sum += attr[i];
+    attr[14] = sum >> 8;
+    attr[15] = sum & 0xFF;
+    std::memcpy(&tag.memory[SIM_FELICA_BLOCK_SIZE], message.data(), message.size());
+  } else if (type == SIM_TAG_MIFARE_CLASSIC_1K) {
+    tag.memory.assign(SIM_CLASSIC_SECTORS * 4 * 16, 0x00);
+    // Manufacturer block: UID, BCC (4-byte UIDs), SAK, ATQA
+    std::memcpy(&tag.memory[0], uid.data(), std::min<size_t>(uid.size(), 7));
+    if (uid.size() == 4) {
+      tag.memory[4] = uid[0] ^ uid[1] ^ uid[2] ^ uid[3];
+      tag.memory[5] = 0x08;
+      tag.memory[6] = 0x04;
+    }
+    std::vector<uint8_t> tlv = ndef_uri_tlv(ndef_uri);
+    // 48 data bytes per NDEF sector, sectors 1-14
+    uint8_t ndef_sectors = ndef_uri.empty() ? 0 : std::min<size_t>((tlv.size() + 47) / 48, SIM_CLASSIC_SECTORS - 2);
+    if (tlv.size() > ndef_sectors * 48u) {
+      ESP_LOGW(TAG, "NDEF message does not fit into %s, truncating", tag_type_to_string(type));
+      tlv.resize(ndef_sectors * 48u);
+    }
+    for (uint8_t sector = 0; sector < SIM_CLASSIC_SECTORS; sector++) {
+      const uint8_t *key = SIM_CLASSIC_KEY_FACTORY;
+      if (sector == 0 && ndef_sectors > 0) {
+        key = SIM_CLASSIC_KEY_MAD;
+      } else if (sector >= 1 && sector <= ndef_sectors) {
+        key = SIM_CLASSIC_KEY_NDEF;
+        // MAD1 entry: the NFC Forum NDEF application
+        tag.memory[16 + 2 * sector] = 0x03;
+        tag.memory[16 + 2 * sector + 1] = 0xE1;
+        for (int block = 0; block < 3; block++) {
+          size_t offset = ((sector - 1) * 3 + block) * 16;
+          if (offset < tlv.size())
+            std::memcpy(&tag.memory[(sector * 4 + block) * 16], &tlv[offset], std::min<size_t>(16, tlv.size() - offset));
+        }
+      } else if (sector == SIM_CLASSIC_SECTORS - 1) {
+        key = SIM_CLASSIC_KEY_LOCKED;
+      }
+      uint8_t *trailer = &tag.memory[(sector * 4 + 3) * 16];
+      std::memcpy(trailer, key, 6);
+      std::memcpy(trailer + 6, SIM_CLASSIC_ACCESS, 4);
+      std::memcpy(trailer + 10, key, 6);
+    }
+    if (ndef_sectors > 0) {
+      // MAD1: CRC, info byte, AIDs of sectors 1-15
+      tag.memory[17] = 0x01;
+      tag.memory[16] = crc_mad(&tag.memory[17], 31);
+    }
+  } else if (type == SIM_TAG_DESFIRE_EV2) {
+    // NDEF file: NLEN, then the message
+    tag.memory.assign(SIM_T4_NDEF_FILE_SIZE, 0x00);
+    std::vector<uint8_t> message = ndef_uri_message(ndef_uri);
+    if (2 + message.size() > tag.memory.size()) {
+      ESP_LOGW(TAG, "NDEF message does not fit into %s, truncating", tag_type_to_string(type));
+      message.resize(tag.memory.size() - 2);
+    }
+    tag.memory[0] = message.size() >> 8;
+    tag.memory[1] = message.size() & 0xFF;
+    std::memcpy(&tag.memory[2], message.data(), message.size());
+  } else if (type != SIM_TAG_FELICA_STANDARD) {
+    uint16_t pages;
+    uint8_t cc_size;
+    switch (type) {
+      case SIM_TAG_ULTRALIGHT:
+        pages = 16;
+        cc_size = 0x06;
+        break;
+      case SIM_TAG_NTAG213:
+        pages = 45;
+        cc_size = 0x12;
+        break;
+      case SIM_TAG_NTAG215:
+        pages = 135;
+        cc_size = 0x3E;
+        break;
+      default:
+        pages = 231;
+        cc_size = 0x6D;
+        break;
+    }
+    tag.memory.assign(pages * 4, 0x00);
+    // Pages 0..2 hold the 7-byte UID with its check bytes, page 3 the capability container.
+    if (uid.size() == 7) {
+      tag.memory[0] = uid[0];
+      tag.memory[1] = uid[1];
+      tag.memory[2] = uid[2];
+      tag.memory[3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];
+      for (int i = 0; i < 4; i++)
+        tag.memory[4 + i] = uid[3 + i];
+      tag.memory[8] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+    }
+    tag.memory[12] = 0xE1;
+    tag.memory[13] = 0x10;
+    tag.memory[14] = cc_size;
+    tag.memory[15] = 0x00;
+
+    std::vector<uint8_t> tlv = ndef_uri_tlv(ndef_uri);
+    if (16 + tlv.size() > tag.memory.size()) {
+      ESP_LOGW(TAG, "NDEF message does not fit into %s, truncating", tag_type_to_string(type));
+      tlv.resize(tag.memory.size() - 16);
+    }
+    std::memcpy(&tag.memory[16], tlv.data(), tlv.size());
+  }
+
+  this->tags_.push_back(tag);
+  this->results_.emplace_back();
+}
+
+void ST25RSim::setup() {
+  ESP_LOGCONFIG(TAG, "Setting up ST25R simulator...");
+  this->set_default_();
+  this->register_listener(this);
+  // Without a benchmark schedule every configured tag simply sits in the field.
+  if (this->bench_phase_ == BENCH_DISABLED) {
+    for (auto &tag : this->tags_)
+      tag.present = true;
+  }
+  st25r::ST25R::setup();
+  // The model raises the ISR on IRQ line edges itself, as if the pin were wired.
+  this->irq_polling_ = false;
+  this->setup_counters_ = this->counters_;
+  this->phase_start_ = millis();
+  this->run_start_us_ = micros();
+  this->field_on_us_ = 0;
+  if (this->field_on_())
+    this->field_since_us_ = this->run_start_us_;
+}
+
+void ST25RSim::update() {
+  this->polls_++;
+  st25r::ST25R::update();
+}
+
+void ST25RSim::loop() {
+  this->service_timers_();
+  if (this->bench_phase_ != BENCH_DISABLED && this->bench_phase_ != BENCH_DONE)
+    this->bench_step_();
+  st25r::ST25R::loop();
+}
+
+void ST25RSim::dump_config() {
+  st25r::ST25R::dump_config();
+  ESP_LOGCONFIG(TAG, "  Simulated tags: %u", (unsigned) this->tags_.size());
+  for (auto &tag : this->tags_) {
+    ESP_LOGCONFIG(TAG, "    %s (%s, %u bytes memory)", nfc::format_uid(tag.uid).c_str(), tag_type_to_string(tag.type),
+                  (unsigned) tag.memory.size());
+  }
+  if (this->bench_phase_ != BENCH_DISABLED) {
+    ESP_LOGCONFIG(TAG, "  Benchmark: %" PRIu32 " iterations, dwell %" PRIu32 "ms, gap %" PRIu32 "ms", this->iterations_,
+                  this->dwell_time_, this->gap_time_);
+  }
+}
+
+// --- Transport -------------------------------------------------------------------------------
+
+uint8_t ST25RSim::bus_read_register(uint8_t reg) {
+  this->counters_.reg_reads++;
+  return this->load_register_(reg);
+}
+
+void ST25RSim::bus_write_register(uint8_t reg, uint8_t value) {
+  this->counters_.reg_writes++;
+  this->store_register_(reg, value);
+}
+
+void ST25RSim::bus_read_registers(uint8_t reg, uint8_t *data, size_t len) {
+  this->counters_.reg_reads++;
+  for (size_t i = 0; i < len; i++)
+    data[i] = this->load_register_(reg + i);
+}
+
+void ST25RSim::bus_write_registers(uint8_t reg, const uint8_t *data, size_t len) {
+  this->counters_.reg_writes++;
+  for (size_t i = 0; i < len; i++)
+    this->store_register_(reg + i, data[i]);
+}
+
+void ST25RSim::bus_write_command(uint8_t command) {
+  this->counters_.commands++;
+  switch (command) {
+    case SIM_CMD_SET_DEFAULT:
+      this->set_default_();
+      break;
+    case SIM_CMD_STOP:
+      this->nre_pending_ = false;
+      this->tx_streaming_ = false;
+      this->rx_pending_.clear();
+      this->felica_slots_.clear();
+      break;
+    case SIM_CMD_START_NO_RESPONSE_TIMER:
+      // The receiver listens on after a frame: the next SENSF_RES slot, if there is one.
+      this->start_no_response_timer_();
+      this->felica_next_slot_();
+      break;
+    case SIM_CMD_CLEAR_FIFO:
+      this->fifo_len_ = 0;
+      this->fifo_underflow_ = false;
+      this->fifo_last_bits_ = 0;
+      this->rx_pending_.clear();
+      break;
+    case SIM_CMD_TRANSMIT_WITH_CRC:
+    case SIM_CMD_TRANSMIT_WITHOUT_CRC:
+    case SIM_CMD_TRANSMIT_REQA:
+    case SIM_CMD_TRANSMIT_WUPA:
+      if (command == SIM_CMD_TRANSMIT_WUPA)
+        this->wupas_++;
+      this->transmit_(command);
+      break;
+    case SIM_CMD_INITIAL_RF_COLLISION:
+      this->set_op_control_(this->regs_[st25r::OP_CONTROL] | SIM_OP_TX_EN);
+      break;
+    case SIM_CMD_MEASURE_AMPLITUDE:
+    case SIM_CMD_MEASURE_PHASE:
+    case SIM_CMD_MEASURE_CAPACITANCE:
+      // Measurements need the oscillator running.
+      this->regs_[SIM_REG_AD_RESULT] =
+          (this->regs_[st25r::OP_CONTROL] & SIM_OP_EN) ? this->measure_(command) : 0x00;
+      this->raise_irq_(SIM_IRQ_TIMER, SIM_IRQ_TIMER_DCT);
+      break;
+    default:
+      // Undefined direct commands are ignored by the chip.
+      break;
+  }
+}
+
+void ST25RSim::bus_write_fifo(const uint8_t *data, size_t len) {
+  this->counters_.fifo_writes++;
+  this->counters_.fifo_bytes += len;
+  if (this->tx_streaming_) {
+    // Refill during a long transmission: the bytes go straight out on air.
+    size_t count = std::min(len, this->tx_expected_ - this->tx_frame_.size());
+    this->tx_frame_.insert(this->tx_frame_.end(), data, data + count);
+    if (this->tx_frame_.size() >= this->tx_expected_) {
+      this->finish_transmit_();
+    } else {
+      this->raise_irq_(SIM_IRQ_MAIN, SIM_IRQ_MAIN_WL);
+    }
+    return;
+  }
+  for (size_t i = 0; i < len && this->fifo_len_ < sizeof(this->fifo_); i++)
+    this->fifo_[this->fifo_len_++] = data[i];
+}
+
+void ST25RSim::bus_read_fifo(uint8_t *data, size_t len) {
+  this->counters_.fifo_reads++;
+  this->counters_.fifo_bytes += len;
+  size_t n = std::min(len, this->fifo_len_);
+  std::memcpy(data, this->fifo_, n);
+  std::memset(data + n, 0, len - n);
+  std::memmove(this->fifo_, this->fifo_ + n, this->fifo_len_ - n);
+  this->fifo_len_ -= n;
+  if (len > n)
+    this->fifo_underflow_ = true;
+  if (!this->rx_pending_.empty())
+    this->feed_rx_();
+}
+
+// --- Chip model ------------------------------------------------------------------------------
+
+uint8_t ST25RSim::load_register_(uint8_t reg) {
+  reg &= 0x3F;
+  this->service_timers_();
+  if (reg >= SIM_REG_IRQ_BASE && reg < SIM_REG_IRQ_BASE + 4) {
+    // Interrupt registers are cleared by reading them.
+    uint8_t index = reg - SIM_REG_IRQ_BASE;
+    uint8_t value = this->irq_[index];
+    this->irq_[index] = 0;
+    this->update_irq_line_();
+    return value;
+  }
+  if (reg == st25r::FIFO_STATUS1)
+    return this->fifo_len_ & 0xFF;
+  if (reg == st25r::AUX_DISPLAY) {
+    // The modelled oscillator is stable as soon as it is enabled.
+    return (this->regs_[st25r::OP_CONTROL] & SIM_OP_EN) ? st25r::AUX_DISPLAY_OSC_OK : 0x00;
+  }
+  if (reg == st25r::FIFO_STATUS2) {
+    // fifo_b[9:8], fifo_unf and fifo_lb, the bits of an incomplete last byte
+    uint8_t value = (((this->fifo_len_ >> 8) & 0x03) << 6) | (this->fifo_underflow_ ? 0x20 : 0x00) |
+                    ((this->fifo_last_bits_ & 0x07) << 1);
+    this->fifo_underflow_ = false;
+    return value;
+  }
+  return this->regs_[reg];
+}
+
+void ST25RSim::store_register_(uint8_t reg, uint8_t value) {
+  reg &= 0x3F;
+  if (reg == st25r::IC_IDENTITY)
+    return;
+  if (reg == st25r::OP_CONTROL) {
+    this->set_op_control_(value);
+    return;
+  }
+  this->regs_[reg] = value;
+  if (reg >= SIM_REG_MASK_BASE && reg < SIM_REG_MASK_BASE + 4)
+    this->update_irq_line_();
+}
+
+void ST25RSim::set_default_() {
+  this->set_op_control_(0x00);
+  std::memset(this->regs_, 0, sizeof(this->regs_));
+  std::memset(this->irq_, 0, sizeof(this->irq_));
+  // The chip the configuration is built for
+  this->regs_[st25r::IC_IDENTITY] = (st25r::ST25R_VARIANTS[this->variant_].ic_type << 3) | SIM_IC_REVISION;
+  this->fifo_len_ = 0;
+  this->fifo_underflow_ = false;
+  this->fifo_last_bits_ = 0;
+  this->tx_streaming_ = false;
+  this->rx_pending_.clear();
+  this->irq_line_ = false;
+  this->nre_pending_ = false;
+  for (auto &tag : this->tags_)
+    tag.state = SimTag::IDLE;
+}
+
+void ST25RSim::set_op_control_(uint8_t value) {
+  bool was_on = this->field_on_();
+  bool was_wake_up = this->wake_up_active_();
+  this->regs_[st25r::OP_CONTROL] = value;
+  uint32_t now = micros();
+  if (was_on && !this->field_on_())
+    this->field_on_us_ += now - this->field_since_us_;
+  if (!was_on && this->field_on_())
+    this->field_since_us_ = now;
+  if (!was_wake_up && this->wake_up_active_())
+    this->wake_up_last_us_ = now;
+}
+
+uint8_t ST25RSim::measure_(uint8_t command) {
+  uint8_t tags = 0;
+  for (auto &tag : this->tags_) {
+    if (tag.present)
+      tags++;
+  }
+  switch (command) {
+    case SIM_CMD_MEASURE_PHASE:
+      return SIM_PHASE_IDLE + tags * SIM_PHASE_PER_TAG;
+    case SIM_CMD_MEASURE_CAPACITANCE:
+      return SIM_CAPACITANCE_IDLE + tags * SIM_CAPACITANCE_PER_TAG;
+    default:
+      return SIM_AMPLITUDE_IDLE - tags * SIM_AMPLITUDE_PER_TAG;
+  }
+}
+
+void ST25RSim::wake_up_measure_() {
+  struct Channel {
+    uint8_t enable;
+    uint8_t conf_reg;
+    uint8_t command;
+    uint8_t irq;
+  };
+  static const Channel CHANNELS[] = {
+      {0x04, SIM_REG_AMPLITUDE_CONF, SIM_CMD_MEASURE_AMPLITUDE, SIM_IRQ_ERROR_WAM},
+      {0x02, SIM_REG_PHASE_CONF, SIM_CMD_MEASURE_PHASE, SIM_IRQ_ERROR_WPH},
+      {0x01, SIM_REG_CAPACITANCE_CONF, SIM_CMD_MEASURE_CAPACITANCE, SIM_IRQ_ERROR_WCAP},
+  };
+  uint8_t control = this->regs_[SIM_REG_WUT_CONTROL];
+  for (auto &ch : CHANNELS) {
+    if (!(control & ch.enable))
+      continue;
+    // Configuration, reference, auto-average and last result registers follow each other.
+    uint8_t value = this->measure_(ch.command);
+    this->regs_[ch.conf_reg + 3] = value;
+    this->wake_up_measurements_++;
+    uint8_t delta = this->regs_[ch.conf_reg] >> 4;
+    uint8_t reference = this->regs_[ch.conf_reg + 1];
+    if (std::abs((int) value - (int) reference) > delta) {
+      this->wake_ups_++;
+      this->raise_irq_(SIM_IRQ_ERROR, ch.irq);
+    }
+  }
+}
+
+void ST25RSim::raise_irq_(uint8_t index, uint8_t bits) {
+  this->irq_[index] |= bits;
+  this->update_irq_line_();
+}
+
+void ST25RSim::update_irq_line_() {
+  bool line = false;
+  for (uint8_t i = 0; i < 4; i++) {
+    if (this->irq_[i] & ~this->regs_[SIM_REG_MASK_BASE + i])
+      line = true;
+  }
+  // The core attaches its ISR to the rising edge of the IRQ pin.
+  if (line && !this->irq_line_)
+    st25r::ST25R::isr(this);
+  this->irq_line_ = line;
+}
+
+void ST25RSim::service_timers_() {
+  if (this->wake_up_active_()) {
+    uint8_t control = this->regs_[SIM_REG_WUT_CONTROL];
+    uint32_t period_us = (((control >> 4) & 0x07) + 1) * ((control & 0x80) ? 10000 : 100000);
+    while (this->wake_up_active_() && micros() - this->wake_up_last_us_ >= period_us) {
+      this->wake_up_last_us_ += period_us;
+      this->wake_up_measure_();
+    }
+  }
+  if (this->nre_pending_ && (int32_t) (micros() - this->nre_at_us_) >= 0) {
+    this->nre_pending_ = false;
+    this->raise_irq_(SIM_IRQ_TIMER, SIM_IRQ_TIMER_NRE);
+  }
+}
+
+void ST25RSim::transmit_(uint8_t command) {
+  this->tx_frame_.clear();
+  this->felica_slots_.clear();
+  this->fifo_last_bits_ = 0;
+  this->tx_short_ = command == SIM_CMD_TRANSMIT_REQA || command == SIM_CMD_TRANSMIT_WUPA;
+
+  if (this->tx_short_) {
+    this->tx_frame_.push_back(command == SIM_CMD_TRANSMIT_WUPA ? 0x52 : 0x26);
+  } else {
+    size_t ntx = ((size_t) this->regs_[st25r::NUM_TX_BYTES1] << 5) | (this->regs_[st25r::NUM_TX_BYTES2] >> 3);
+    if ((this->regs_[st25r::NUM_TX_BYTES2] & 0x07) != 0)
+      ntx++;
+    size_t len = std::min(ntx, this->fifo_len_);
+    this->tx_frame_.assign(this->fifo_, this->fifo_ + len);
+    std::memmove(this->fifo_, this->fifo_ + len, this->fifo_len_ - len);
+    this->fifo_len_ -= len;
+    if (len < ntx) {
+      // The frame is longer than what was loaded: keep sending as the host refills the FIFO.
+      this->tx_expected_ = ntx;
+      this->tx_streaming_ = true;
+      this->raise_irq_(SIM_IRQ_MAIN, SIM_IRQ_MAIN_WL);
+      return;
+    }
+  }
+  this->finish_transmit_();
+}
+
+void ST25RSim::finish_transmit_() {
+  this->tx_streaming_ = false;
+  this->raise_irq_(SIM_IRQ_MAIN, SIM_IRQ_MAIN_TXE);
+  // The no-response timer starts at the end of transmission and is stopped by a reception.
+  this->start_no_response_timer_();
+
+  if (!this->field_on_() || this->tx_frame_.empty())
+    return;
+
+  // MODE om=0011: FeliCa
+  if ((this->regs_[st25r::MODE] & 0x78) == 0x18) {
+    this->felica_frame_();
+    return;
+  }
+
+  // MODE om=1110: subcarrier stream, i.e. ISO15693 coded by the host
+  if ((this->regs_[st25r::MODE] & 0x78) == 0x70) {
+    this->vicc_frame_();
+    return;
+  }
+
+  // ISO14443A_CONF no_tx_par: the host sends the parity bits itself, i.e. Mifare Classic crypto
+  if (!this->tx_short_ && (this->regs_[st25r::ISO14443A_CONF] & 0x80)) {
+    this->classic_frame_();
+    return;
+  }
+
+  uint8_t cmd = this->tx_frame_[0];
+  if (!this->tx_short_ && (cmd == 0x93 || cmd == 0x95 || cmd == 0x97) && this->tx_frame_.size() >= 2 &&
+      this->tx_frame_[1] != 0x70) {
+    this->anticollision_();
+    return;
+  }
+
+  std::vector<uint8_t> response;
+  bool with_crc = false;
+  uint8_t responders = 0;
+  for (auto &tag : this->tags_) {
+    if (!tag.present)
+      continue;
+    std::vector<uint8_t> resp;
+    bool crc = false;
+    if (this->tag_respond_(tag, this->tx_frame_.data(), this->tx_frame_.size(), this->tx_short_, resp, crc)) {
+      if (responders == 0) {
+        response = resp;
+        with_crc = crc;
+      }
+      responders++;
+    }
+  }
+  if (responders == 0)
+    return;
+  this->nre_pending_ = false;
+
+  if (with_crc) {
+    // The ST25R3916 hands the received CRC bytes to the FIFO along with the payload.
+    uint16_t crc = crc_a(response.data(), response.size());
+    response.push_back(crc & 0xFF);
+    response.push_back(crc >> 8);
+  }
+  // ACK and NAK of a Type 2 WRITE are 4-bit frames.
+  if (cmd == 0xA2)
+    this->fifo_last_bits_ = 4;
+  this->rx_pending_ = std::move(response);
+  this->rx_pending_pos_ = 0;
+  this->rx_end_irq_ = SIM_IRQ_MAIN_RXS | SIM_IRQ_MAIN_RXE;
+  if (responders > 1)
+    this->rx_end_irq_ |= SIM_IRQ_MAIN_COL;
+  this->feed_rx_();
+}
+
+void ST25RSim::classic_frame_() {
+  size_t bits = (((size_t) this->regs_[st25r::NUM_TX_BYTES1] << 5) | (this->regs_[st25r::NUM_TX_BYTES2] >> 3)) * 8 +
+                (this->regs_[st25r::NUM_TX_BYTES2] & 0x07);
+  bits = std::min(bits, this->tx_frame_.size() * 8);
+  // 9 bits per byte: data LSB first, then parity (not checked)
+  std::vector<uint8_t> frame(bits / 9, 0x00);
+  for (size_t i = 0; i < frame.size(); i++) {
+    for (int b = 0; b < 8; b++) {
+      size_t bit = i * 9 + b;
+      frame[i] |= ((this->tx_frame_[bit / 8] >> (bit % 8)) & 1) << b;
+    }
+  }
+  std::vector<uint8_t> resp;
+  std::vector<uint8_t> parity;
+  bool answered = false;
+  for (auto &tag : this->tags_) {
+    if (tag.present && tag.type == SIM_TAG_MIFARE_CLASSIC_1K && tag.state == SimTag::ACTIVE && !frame.empty())
+      answered = this->classic_respond_(tag, frame.data(), frame.size(), resp, parity) || answered;
+  }
+  if (!answered)
+    return;
+  this->nre_pending_ = false;
+  std::vector<uint8_t> packed((resp.size() * 9 + 7) / 8, 0x00);
+  size_t out = 0;
+  for (size_t i = 0; i < resp.size(); i++) {
+    uint16_t value = resp[i] | ((parity[i] & 1) << 8);
+    for (int b = 0; b < 9; b++, out++)
+      packed[out / 8] |= ((value >> b) & 1) << (out % 8);
+  }
+  this->rx_pending_ = std::move(packed);
+  this->rx_pending_pos_ = 0;
+  this->fifo_last_bits_ = out % 8;
+  this->rx_end_irq_ = SIM_IRQ_MAIN_RXS | SIM_IRQ_MAIN_RXE;
+  this->feed_rx_();
+}
+
+bool ST25RSim::classic_respond_(SimTag &tag, const uint8_t *frame, size_t len, std::vector<uint8_t> &resp,
+                                std::vector<uint8_t> &parity) {
+  SimClassic &mfc = tag.classic;
+  const uint8_t *uid = tag.uid.data() + tag.uid.size() - 4;
+  uint32_t cuid = be32(uid);
+
+  if (mfc.auth_pending) {
+    // Reader nonce (fed into the cipher) and the answer to our nonce
+    mfc.auth_pending = false;
+    if (len != 8) {
+      tag.state = SimTag::IDLE;
+      return false;
+    }
+    mfc.crypto.word(be32(frame), true);
+    uint8_t ar[4];
+    std::memcpy(ar, frame + 4, 4);
+    mfc.crypto.decrypt(ar, sizeof(ar));
+    if (be32(ar) != st25r::Crypto1::prng_successor(mfc.nt, 64)) {
+      tag.state = SimTag::IDLE;
+      return false;
+    }
+    uint32_t at = st25r::Crypto1::prng_successor(mfc.nt, 96);
+    const uint8_t plain[4] = {(uint8_t) (at >> 24), (uint8_t) (at >> 16), (uint8_t) (at >> 8), (uint8_t) at};
+    resp.resize(4);
+    parity.resize(4);
+    mfc.crypto.encrypt(plain, resp.data(), parity.data(), 4);
+    mfc.authenticated = true;
+    return true;
+  }
+
+  std::vector<uint8_t> cmd(frame, frame + len);
+  if (mfc.authenticated)
+    mfc.crypto.decrypt(cmd.data(), cmd.size());
+  uint16_t crc = len >= 3 ? crc_a(cmd.data(), len - 2) : 0;
+  if (len < 4 || cmd[len - 2] != (crc & 0xFF) || cmd[len - 1] != (crc >> 8)) {
+    tag.state = SimTag::IDLE;
+    return false;
+  }
+  size_t blocks = tag.memory.size() / 16;
+  if ((cmd[0] == 0x60 || cmd[0] == 0x61) && cmd[1] < blocks) {
+    uint8_t sector = cmd[1] / 4;
+    const uint8_t *key_bytes = &tag.memory[(sector * 4 + 3) * 16 + (cmd[0] == 0x60 ? 0 : 10)];
+    uint64_t key = 0;
+    for (int i = 0; i < 6; i++)
+      key = (key << 8) | key_bytes[i];
+    this->classic_nonce_ = st25r::Crypto1::prng_successor(this->classic_nonce_, 97);
+    uint32_t nt = this->classic_nonce_;
+    bool nested = mfc.authenticated;
+    mfc.crypto.init(key);
+    resp.resize(4);
+    parity.resize(4);
+    for (int i = 0; i < 4; i++) {
+      uint8_t plain = nt >> (24 - 8 * i);
+      if (nested) {
+        // Nested: the nonce goes out encrypted under the new key.
+        resp[i] = plain ^ mfc.crypto.byte(uid[i] ^ plain, false);
+        parity[i] = st25r::Crypto1::odd_parity(plain) ^ mfc.crypto.peek();
+      } else {
+        resp[i] = plain;
+        parity[i] = st25r::Crypto1::odd_parity(plain);
+      }
+    }
+    if (!nested)
+      mfc.crypto.word(cuid ^ nt, false);
+    mfc.authenticated = false;
+    mfc.auth_pending = true;
+    mfc.nt = nt;
+    mfc.sector = sector;
+    return true;
+  }
+  if (mfc.authenticated && cmd[0] == 0x30 && cmd[1] < blocks && cmd[1] / 4 == mfc.sector) {
+    uint8_t plain[18];
+    std::memcpy(plain, &tag.memory[cmd[1] * 16], 16);
+    // Keys never read back
+    if (cmd[1] % 4 == 3) {
+      std::memset(plain, 0, 6);
+      std::memset(plain + 10, 0, 6);
+    }
+    uint16_t block_crc = crc_a(plain, 16);
+    plain[16] = block_crc & 0xFF;
+    plain[17] = block_crc >> 8;
+    resp.resize(sizeof(plain));
+    parity.resize(sizeof(plain));
+    mfc.crypto.encrypt(plain, resp.data(), parity.data(), sizeof(plain));
+    return true;
+  }
+  if (mfc.authenticated && cmd[0] == 0x50 && cmd[1] == 0x00) {
+    tag.state = SimTag::HALT;
+    mfc = SimClassic();
+    return false;
+  }
+  tag.state = SimTag::IDLE;
+  mfc = SimClassic();
+  return false;
+}
+
+void ST25RSim::start_no_response_timer_() {
+  uint16_t nrt = ((uint16_t) this->regs_[SIM_REG_NRT1] << 8) | this->regs_[SIM_REG_NRT2];
+  this->nre_pending_ = nrt != 0;
+  uint32_t step_ns = (this->regs_[SIM_REG_TIMER_EMV_CONTROL] & 0x01) ? 302065 : 4720;
+  this->nre_at_us_ = micros() + (uint32_t) ((uint64_t) nrt * step_ns / 1000);
+}
+
+void ST25RSim::anticollision_() {
+  const uint8_t *frame = this->tx_frame_.data();
+  uint8_t level = (frame[0] - 0x93) / 2;
+  // NVB: complete bytes including SEL and NVB in the upper nibble, bits of a split byte in the lower
+  size_t known = (frame[1] >> 4) * 8 + (frame[1] & 0x07);
+  const size_t frame_bits = 7 * 8;
+  if (known < 16 || known > frame_bits || this->tx_frame_.size() * 8 < known)
+    return;
+
+  // Every READY tag whose CLn starts with the bits sent answers with the rest of it, all at once.
+  std::vector<std::array<uint8_t, 7>> answers;
+  for (auto &tag : this->tags_) {
+    if (!tag.present || tag.state != SimTag::READY || is_vicinity(tag.type) || is_felica(tag.type))
+      continue;
+    std::array<uint8_t, 7> full{frame[0], frame[1]};
+    if (!cascade_bytes(tag, level, full.data() + 2))
+      continue;
+    bool match = true;
+    for (size_t pos = 16; pos < known && match; pos++)
+      match = frame_bit(full.data(), pos) == frame_bit(frame, pos);
+    if (match)
+      answers.push_back(full);
+  }
+  if (answers.empty())
+    return;
+  this->nre_pending_ = false;
+
+  // The reader sees a bit as long as all tags agree on it, up to the first collision.
+  size_t end = known;
+  while (end < frame_bits) {
+    bool bit = frame_bit(answers[0].data(), end);
+    bool agree = true;
+    for (auto &answer : answers)
+      agree = agree && frame_bit(answer.data(), end) == bit;
+    if (!agree)
+      break;
+    end++;
+  }
+  // Received bits land at their position in the frame, the first byte completing the split byte.
+  std::vector<uint8_t> response;
+  for (size_t byte = known / 8; byte * 8 < end; byte++) {
+    uint8_t value = 0;
+    for (size_t pos = std::max(byte * 8, known); pos < std::min(byte * 8 + 8, end); pos++)
+      value |= frame_bit(answers[0].data(), pos) << (pos % 8);
+    response.push_back(value);
+  }
+  this->rx_pending_ = std::move(response);
+  this->rx_pending_pos_ = 0;
+  this->rx_end_irq_ = SIM_IRQ_MAIN_RXS | SIM_IRQ_MAIN_RXE;
+  this->fifo_last_bits_ = end % 8;
+  if (end < frame_bits) {
+    this->regs_[st25r::COLLISION_STATUS] = ((end / 8) << 4) | ((end % 8) << 1);
+    this->rx_end_irq_ |= SIM_IRQ_MAIN_COL;
+  }
+  this->feed_rx_();
+}
+
+void ST25RSim::vicc_frame_() {
+  const std::vector<uint8_t> &coded = this->tx_frame_;
+  // A lone EOF opens the next inventory slot.
+  if (coded.size() == 1 && coded[0] == 0x04) {
+    if (this->vicc_inventory_ && this->vicc_slot_ + 1 < this->vicc_slots_) {
+      this->vicc_slot_++;
+      this->vicc_inventory_slot_();
+    }
+    return;
+  }
+  this->vicc_inventory_ = false;
+
+  // 1-out-of-4: SOF 0x21, one byte per bit pair with the pause in slot 1, 3, 5 or 7, EOF 0x04
+  if (coded.size() < 2 || coded.front() != 0x21 || coded.back() != 0x04 || (coded.size() - 2) % 4 != 0)
+    return;
+  std::vector<uint8_t> frame;
+  for (size_t i = 1; i + 4 < coded.size(); i += 4) {
+    uint8_t byte = 0;
+    for (int pair = 0; pair < 4; pair++) {
+      uint8_t code = coded[i + pair];
+      uint8_t value = code == 0x02 ? 0 : code == 0x08 ? 1 : code == 0x20 ? 2 : code == 0x80 ? 3 : 0xFF;
+      if (value == 0xFF)
+        return;
+      byte |= value << (pair * 2);
+    }
+    frame.push_back(byte);
+  }
+  if (frame.size() < 4 || crc_15693(frame.data(), frame.size()) != (uint16_t) ~0xF0B8)
+    return;
+  frame.resize(frame.size() - 2);
+  uint8_t flags = frame[0];
+  uint8_t cmd = frame[1];
+
+  if (flags & 0x04) {
+    // INVENTORY: mask length in bits and the mask, LSB first
+    if (cmd != 0x01 || frame.size() < 3 || frame[2] > 60)
+      return;
+    uint8_t mask_length = frame[2];
+    size_t mask_bytes = (mask_length + 7) / 8;
+    if (frame.size() < 3 + mask_bytes)
+      return;
+    uint64_t mask = 0;
+    for (size_t i = 0; i < mask_bytes; i++)
+      mask |= (uint64_t) frame[3 + i] << (i * 8);
+    this->vicc_mask_ = mask & ((1ULL << mask_length) - 1);
+    this->vicc_mask_length_ = mask_length;
+    this->vicc_slots_ = (flags & 0x20) ? 1 : 16;
+    this->vicc_slot_ = 0;
+    this->vicc_inventory_ = true;
+    this->vicc_inventory_slot_();
+    return;
+  }
+
+  // Only addressed READ_MULTIPLE_BLOCKS is modelled.
+  if (!(flags & 0x20) || frame.size() < 10)
+    return;
+  uint64_t uid = 0;
+  for (int i = 0; i < 8; i++)
+    uid |= (uint64_t) frame[2 + i] << (i * 8);
+  for (auto &tag : this->tags_) {
+    if (!tag.present || !is_vicinity(tag.type) || vicc_uid(tag) != uid)
+      continue;
+    std::vector<uint8_t> resp;
+    size_t blocks = tag.memory.size() / 4;
+    if (cmd == 0x23 && frame.size() >= 12 && frame[10] + frame[11] + 1u <= blocks) {
+      resp.push_back(0x00);
+      resp.insert(resp.end(), tag.memory.begin() + frame[10] * 4, tag.memory.begin() + (frame[10] + frame[11] + 1) * 4);
+    } else {
+      // Error flag with "block not available" or "command not supported"
+      resp = {0x01, (uint8_t) (cmd == 0x23 ? 0x10 : 0x01)};
+    }
+    this->vicc_respond_({resp});
+    return;
+  }
+}
+
+void ST25RSim::vicc_inventory_slot_() {
+  std::vector<std::vector<uint8_t>> answers;
+  SimTag *single = nullptr;
+  for (auto &tag : this->tags_) {
+    if (!tag.present || !is_vicinity(tag.type))
+      continue;
+    uint64_t uid = vicc_uid(tag);
+    if ((uid & ((1ULL << this->vicc_mask_length_) - 1)) != this->vicc_mask_)
+      continue;
+    // With 16 slots the 4 UID bits after the mask pick the slot.
+    if (this->vicc_slots_ == 16 && ((uid >> this->vicc_mask_length_) & 0x0F) != this->vicc_slot_)
+      continue;
+    // Flags, DSFID, UID LSB first
+    std::vector<uint8_t> resp = {0x00, 0x00};
+    for (int i = 0; i < 8; i++)
+      resp.push_back((uid >> (i * 8)) & 0xFF);
+    answers.push_back(resp);
+    single = &tag;
+  }
+  if (answers.size() == 1 && this->bench_phase_ == BENCH_WAIT_DETECT && !this->uid_resolved_ &&
+      single == &this->tags_[this->bench_tag_]) {
+    this->uid_resolved_ = true;
+    this->uid_us_ = micros();
+  }
+  this->vicc_respond_(answers);
+}
+
+void ST25RSim::vicc_respond_(const std::vector<std::vector<uint8_t>> &answers) {
+  if (answers.empty())
+    return;
+  this->nre_pending_ = false;
+  // One stream bit per 256/fc half bit, 1 = subcarrier: SOF, Manchester data LSB first, EOF
+  std::vector<uint8_t> stream;
+  size_t bits = 0;
+  for (auto &answer : answers) {
+    std::vector<uint8_t> frame = answer;
+    uint16_t crc = crc_15693(frame.data(), frame.size());
+    frame.push_back(crc & 0xFF);
+    frame.push_back(crc >> 8);
+    size_t pos = 0;
+    auto push = [&stream, &pos](bool on) {
+      if (pos / 8 >= stream.size())
+        stream.push_back(0x00);
+      if (on)
+        stream[pos / 8] |= 1 << (pos % 8);
+      pos++;
+    };
+    for (bool on : {true, true, true, false, true})
+      push(on);
+    for (uint8_t byte : frame) {
+      for (int bit = 0; bit < 8; bit++) {
+        bool one = (byte >> bit) & 0x01;
+        push(!one);
+        push(one);
+      }
+    }
+    for (bool on : {true, false, true, true, true})
+      push(on);
+    bits = std::max(bits, pos);
+  }
+  this->rx_pending_ = std::move(stream);
+  this->rx_pending_pos_ = 0;
+  this->rx_end_irq_ = SIM_IRQ_MAIN_RXS | SIM_IRQ_MAIN_RXE;
+  this->fifo_last_bits_ = bits % 8;
+  this->feed_rx_();
+}
+
+void ST25RSim::felica_frame_() {
+  const std::vector<uint8_t> &frame = this->tx_frame_;
+  // The LEN byte counts itself.
+  if (frame.size() < 2 || frame[0] != frame.size())
+    return;
+
+  if (frame[1] == 0x00 && frame.size() >= 6) {
+    // SENSF_REQ: system code, request code, time slot number (slots - 1)
+    uint8_t slots = std::min<uint8_t>(frame[5], 15) + 1;
+    std::vector<std::vector<std::vector<uint8_t>>> answers(slots);
+    std::vector<SimTag *> single(slots, nullptr);
+    for (auto &tag : this->tags_) {
+      if (!tag.present || !is_felica(tag.type))
+        continue;
+      uint16_t system_code = tag.type == SIM_TAG_FELICA_LITE_S ? SIM_FELICA_SYSTEM_NDEF : SIM_FELICA_SYSTEM_TRANSIT;
+      // 0xFF in either byte of the requested code is a wildcard.
+      if ((frame[2] != 0xFF && frame[2] != (system_code >> 8)) || (frame[3] != 0xFF && frame[3] != (system_code & 0xFF)))
+        continue;
+      // Cards draw their slot at random for every request.
+      this->felica_seed_ = this->felica_seed_ * 1103515245 + 12345;
+      uint8_t slot = (this->felica_seed_ >> 16) % slots;
+      // LEN, SENSF_RES, IDm, PMm, system code if asked for by request code 1
+      std::vector<uint8_t> resp = {0x00, 0x01};
+      resp.insert(resp.end(), tag.uid.begin(), tag.uid.end());
+      if (tag.type == SIM_TAG_FELICA_LITE_S) {
+        resp.insert(resp.end(), {0x00, 0xF1, 0x00, 0x00, 0x00, 0x01, 0x43, 0x00});
+      } else {
+        resp.insert(resp.end(), {0x01, 0x20, 0x22, 0x04, 0x27, 0x67, 0x4E, 0xFF});
+      }
+      if (frame[4] == 0x01) {
+        resp.push_back(system_code >> 8);
+        resp.push_back(system_code & 0xFF);
+      }
+      resp[0] = resp.size();
+      answers[slot].push_back(resp);
+      single[slot] = &tag;
+    }
+    for (uint8_t slot = 0; slot < slots; slot++) {
+      if (answers[slot].empty())
+        continue;
+      // Cards in the same slot overlap; the reader sees a CRC error.
+      std::vector<uint8_t> merged;
+      for (auto &answer : answers[slot]) {
+        merged.resize(std::max(merged.size(), answer.size()), 0x00);
+        for (size_t i = 0; i < answer.size(); i++)
+          merged[i] |= answer[i];
+      }
+      uint16_t crc = crc_felica(merged.data(), merged.size());
+      merged.push_back(crc >> 8);
+      merged.push_back(crc & 0xFF);
+      bool collided = answers[slot].size() > 1;
+      this->felica_slots_.emplace_back(merged, collided);
+      if (!collided && this->bench_phase_ == BENCH_WAIT_DETECT && !this->uid_resolved_ &&
+          single[slot] == &this->tags_[this->bench_tag_]) {
+        this->uid_resolved_ = true;
+        this->uid_us_ = micros();
+      }
+    }
+    this->felica_next_slot_();
+    return;
+  }
+
+  if (frame[1] != 0x06 || frame.size() < 14)
+    return;
+  // Read Without Encryption: IDm, service codes, block count, block list elements
+  for (auto &tag : this->tags_) {
+    if (!tag.present || !is_felica(tag.type) || !std::equal(tag.uid.begin(), tag.uid.end(), frame.begin() + 2))
+      continue;
+    std::vector<uint8_t> resp = {0x00, 0x07};
+    resp.insert(resp.end(), tag.uid.begin(), tag.uid.end());
+    uint8_t services = frame[10];
+    size_t pos = 11 + services * 2;
+    uint8_t status = 0x00;
+    std::vector<uint8_t> data;
+    if (tag.type != SIM_TAG_FELICA_LITE_S || services != 1 || frame[11] != 0x0B || frame[12] != 0x00) {
+      status = 0xA6;  // illegal service code
+    } else if (pos >= frame.size() || frame[pos] == 0 || frame[pos] > SIM_FELICA_LITE_S_NBR) {
+      status = 0xA2;  // illegal number of blocks
+    } else {
+      uint8_t count = frame[pos++];
+      for (uint8_t i = 0; i < count && status == 0x00; i++) {
+        size_t block = pos + 1 < frame.size() ? frame[pos + 1] : SIM_FELICA_LITE_S_BLOCKS;
+        if (frame[pos] != 0x80 || block >= tag.memory.size() / SIM_FELICA_BLOCK_SIZE) {
+          status = 0xA8;  // illegal block list
+          break;
+        }
+        data.insert(data.end(), tag.memory.begin() + block * SIM_FELICA_BLOCK_SIZE,
+                    tag.memory.begin() + (block + 1) * SIM_FELICA_BLOCK_SIZE);
+        pos += 2;
+      }
+    }
+    if (status == 0x00) {
+      resp.insert(resp.end(), {0x00, 0x00, (uint8_t) (data.size() / SIM_FELICA_BLOCK_SIZE)});
+      resp.insert(resp.end(), data.begin(), data.end());
+    } else {
+      resp.insert(resp.end(), {0xFF, status});
+    }
+    resp[0] = resp.size();
+    uint16_t crc = crc_felica(resp.data(), resp.size());
+    resp.push_back(crc >> 8);
+    resp.push_back(crc & 0xFF);
+    this->felica_slots_.emplace_back(resp, false);
+    this->felica_next_slot_();
+    return;
+  }
+}
+
+void ST25RSim::felica_next_slot_() {
+  if (this->felica_slots_.empty())
+    return;
+  this->nre_pending_ = false;
+  this->rx_pending_ = std::move(this->felica_slots_.front().first);
+  this->rx_pending_pos_ = 0;
+  this->rx_end_irq_ = SIM_IRQ_MAIN_RXS | SIM_IRQ_MAIN_RXE;
+  this->rx_end_error_irq_ = this->felica_slots_.front().second ? SIM_IRQ_ERROR_CRC : 0x00;
+  this->felica_slots_.erase(this->felica_slots_.begin());
+  this->feed_rx_();
+}
+
+void ST25RSim::feed_rx_() {
+  size_t count = std::min(sizeof(this->fifo_) - this->fifo_len_, this->rx_pending_.size() - this->rx_pending_pos_);
+  std::memcpy(this->fifo_ + this->fifo_len_, this->rx_pending_.data() + this->rx_pending_pos_, count);
+  this->fifo_len_ += count;
+  this->rx_pending_pos_ += count;
+  if (this->rx_pending_pos_ < this->rx_pending_.size()) {
+    // Reception stalls at a full FIFO until the host drains it; a real chip would overflow.
+    this->raise_irq_(SIM_IRQ_MAIN, SIM_IRQ_MAIN_RXS | SIM_IRQ_MAIN_WL);
+    return;
+  }
+  this->rx_pending_.clear();
+  this->rx_pending_pos_ = 0;
+  if (this->rx_end_error_irq_ != 0) {
+    this->raise_irq_(SIM_IRQ_ERROR, this->rx_end_error_irq_);
+    this->rx_end_error_irq_ = 0;
+  }
+  this->raise_irq_(SIM_IRQ_MAIN, this->rx_end_irq_);
+}
+
+bool ST25RSim::tag_respond_(SimTag &tag, const uint8_t *frame, size_t len, bool short_frame,
+                            std::vector<uint8_t> &resp, bool &with_crc) {
+  with_crc = false;
+  const size_t uid_len = tag.uid.size();
+  if (is_vicinity(tag.type) || is_felica(tag.type))
+    return false;
+
+  if (short_frame) {
+    // REQA wakes idle tags only, WUPA also halted ones. Both are tolerated in READY so a reader
+    // that restarts discovery without cycling the field still gets an answer.
+    bool wupa = frame[0] == 0x52;
+    if (tag.state == SimTag::IDLE || tag.state == SimTag::READY || (wupa && tag.state == SimTag::HALT)) {
+      tag.state = SimTag::READY;
+      uint8_t atqa0 = uid_len == 4 ? 0x04 : (uid_len == 7 ? 0x44 : 0x84);
+      resp = {atqa0, 0x00};
+      return true;
+    }
+    // Any unexpected frame sends an ACTIVE tag back to IDLE, so it answers the next poll.
+    if (tag.state == SimTag::ACTIVE)
+      tag.state = SimTag::IDLE;
+    return false;
+  }
+
+  uint8_t cmd = frame[0];
+  if (cmd == 0x93 || cmd == 0x95 || cmd == 0x97) {
+    if (tag.state != SimTag::READY || len < 2)
+      return false;
+    uint8_t level = (cmd - 0x93) / 2;
+    uint8_t levels = uid_len == 4 ? 1 : (uid_len == 7 ? 2 : 3);
+    uint8_t cl[5];
+    if (!cascade_bytes(tag, level, cl))
+      return false;
+    // ANTICOLLISION frames are answered bit by bit in anticollision_(); this is SELECT.
+    if (frame[1] == 0x70 && len >= 7 && std::memcmp(frame + 2, cl, 5) == 0) {
+      with_crc = true;
+      if (level + 1 < levels) {
+        resp = {0x04};
+        return true;
+      }
+      tag.state = SimTag::ACTIVE;
+      tag.iso_dep = SimIsoDep();
+      tag.classic = SimClassic();
+      uint8_t sak = 0x00;
+      if (tag.type == SIM_TAG_MIFARE_CLASSIC_1K) {
+        sak = 0x08;
+      } else if (tag.type == SIM_TAG_DESFIRE_EV2) {
+        sak = 0x20;
+      }
+      resp = {sak};
+      if (this->bench_phase_ == BENCH_WAIT_DETECT && !this->uid_resolved_ &&
+          &tag == &this->tags_[this->bench_tag_]) {
+        this->uid_resolved_ = true;
+        this->uid_us_ = micros();
+      }
+      return true;
+    }
+    // SELECT of another tag: the losers of the anticollision wait for the next REQA.
+    if (frame[1] == 0x70)
+      tag.state = SimTag::IDLE;
+    return false;
+  }
+
+  if (tag.state != SimTag::ACTIVE)
+    return false;
+
+  if (tag.type == SIM_TAG_DESFIRE_EV2) {
+    with_crc = true;
+    if (tag.iso_dep.active)
+      return this->iso_dep_respond_(tag, frame, len, resp);
+    if (cmd == 0xE0 && len >= 2) {
+      tag.iso_dep.active = true;
+      tag.iso_dep.fsd = SIM_FSD_TABLE[std::min<uint8_t>(frame[1] >> 4, sizeof(SIM_FSD_TABLE) / sizeof(uint16_t) - 1)];
+      resp.assign(SIM_ATS, SIM_ATS + sizeof(SIM_ATS));
+      return true;
+    }
+  }
+
+  if (cmd == 0x50 && len >= 2 && frame[1] == 0x00) {
+    tag.state = SimTag::HALT;
+    return false;
+  }
+  if (cmd == 0x30 && len >= 2 && !tag.memory.empty()) {
+    size_t pages = tag.memory.size() / 4;
+    if (frame[1] >= pages)
+      return false;
+    for (size_t i = 0; i < 16; i++)
+      resp.push_back(tag.memory[(frame[1] * 4 + i) % tag.memory.size()]);
+    with_crc = true;
+    return true;
+  }
+  if (cmd == 0xA2 && len >= 6 && !tag.memory.empty()) {
+    // WRITE: the UID pages are read-only, the lock bytes and the capability container are one-time
+    // programmable (bits are ORed in), and the static lock bits protect pages 3-15 one by one.
+    uint8_t page = frame[1];
+    uint16_t lock = tag.memory[10] | (tag.memory[11] << 8);
+    bool locked = page >= 3 && page < 16 && (lock & (1 << page)) != 0;
+    if (page < 2 || page >= tag.memory.size() / 4 || locked) {
+      resp = {0x00};
+      return true;
+    }
+    uint8_t *data = &tag.memory[page * 4];
+    for (size_t i = 0; i < 4; i++) {
+      if (page == 2) {
+        if (i >= 2)
+          data[i] |= frame[2 + i];
+      } else if (page == 3) {
+        data[i] |= frame[2 + i];
+      } else {
+        data[i] = frame[2 + i];
+      }
+    }
+    resp = {0x0A};
+    return true;
+  }
+  // GET_VERSION and FAST_READ exist on NTAG21x only; the original Ultralight does not know them.
+  bool ntag = tag.type == SIM_TAG_NTAG213 || tag.type == SIM_TAG_NTAG215 || tag.type == SIM_TAG_NTAG216;
+  if (cmd == 0x60 && ntag) {
+    uint8_t storage = tag.type == SIM_TAG_NTAG213 ? 0x0F : (tag.type == SIM_TAG_NTAG215 ? 0x11 : 0x13);
+    resp = {0x00, 0x04, 0x04, 0x02, 0x01, 0x00, storage, 0x03};
+    with_crc = true;
+    return true;
+  }
+  if (cmd == 0x3A && len >= 3 && ntag) {
+    size_t pages = tag.memory.size() / 4;
+    if (frame[1] <= frame[2] && frame[2] < pages) {
+      resp.assign(tag.memory.begin() + frame[1] * 4, tag.memory.begin() + (frame[2] + 1) * 4);
+      with_crc = true;
+      return true;
+    }
+  }
+  // Unknown or invalid commands are NAKed and send the tag back to IDLE.
+  tag.state = SimTag::IDLE;
+  return false;
+}
+
+bool ST25RSim::iso_dep_respond_(SimTag &tag, const uint8_t *frame, size_t len, std::vector<uint8_t> &resp) {
+  SimIsoDep &dep = tag.iso_dep;
+  uint8_t pcb = frame[0];
+  if (pcb == 0xD0 && len >= 3) {
+    // PPS: the simulated air interface does not care about the bit rate.
+    resp = {0xD0};
+    return true;
+  }
+  if (pcb == 0xC2) {
+    // S(DESELECT) is confirmed, then the tag sleeps like after HLTA.
+    resp = {0xC2};
+    tag.state = SimTag::HALT;
+    dep.active = false;
+    return true;
+  }
+  if ((pcb & 0xF7) == 0xF2 && dep.wtx_sent && dep.last_block.size() == 2 && dep.last_block[0] == 0xF2) {
+    // WTX confirmed: the response is ready now.
+    this->iso_dep_next_block_(tag, resp);
+    return true;
+  }
+  uint8_t block_number = pcb & 0x01;
+  if ((pcb & 0xE2) == 0x02) {
+    if (block_number != dep.block_number) {
+      // Our answer to this block got lost.
+      resp = dep.last_block;
+      return !resp.empty();
+    }
+    dep.block_number ^= 1;
+    dep.command.insert(dep.command.end(), frame + 1, frame + len);
+    if (pcb & 0x10) {
+      resp = {(uint8_t) (0xA2 | block_number)};
+      dep.last_block = resp;
+      return true;
+    }
+    dep.response = this->t4_apdu_(tag, dep.command);
+    dep.response_pos = 0;
+    dep.command.clear();
+    // The first READ BINARY of the NDEF message takes a while on this card.
+    if (!dep.wtx_sent && dep.file == SIM_T4_NDEF_FILE && dep.response.size() > 4) {
+      dep.wtx_sent = true;
+      resp = {0xF2, 0x01};
+      dep.last_block = resp;
+      return true;
+    }
+    this->iso_dep_next_block_(tag, resp);
+    return true;
+  }
+  if ((pcb & 0xF6) == 0xA2) {
+    bool nak = (pcb & 0x10) != 0;
+    if (!nak && block_number == dep.block_number && dep.response_pos < dep.response.size()) {
+      dep.block_number ^= 1;
+      this->iso_dep_next_block_(tag, resp);
+      return true;
+    }
+    resp = dep.last_block;
+    return !resp.empty();
+  }
+  return false;
+}
+
+void ST25RSim::iso_dep_next_block_(SimTag &tag, std::vector<uint8_t> &resp) {
+  SimIsoDep &dep = tag.iso_dep;
+  // The card answers with the block number of the block it received.
+  uint8_t block_number = dep.block_number ^ 1;
+  size_t chunk = std::min<size_t>(dep.response.size() - dep.response_pos, dep.fsd - 3);
+  bool more = dep.response_pos + chunk < dep.response.size();
+  resp.clear();
+  resp.push_back(0x02 | block_number | (more ? 0x10 : 0x00));
+  resp.insert(resp.end(), dep.response.begin() + dep.response_pos, dep.response.begin() + dep.response_pos + chunk);
+  dep.response_pos += chunk;
+  dep.last_block = resp;
+}
+
+std::vector<uint8_t> ST25RSim::t4_apdu_(SimTag &tag, const std::vector<uint8_t> &apdu) {
+  SimIsoDep &dep = tag.iso_dep;
+  if (apdu.size() < 4)
+    return {0x67, 0x00};
+  uint8_t ins = apdu[1];
+  if (ins == 0xA4 && apdu[2] == 0x04 && apdu.size() >= 5 + sizeof(SIM_T4_NDEF_APP) &&
+      apdu[4] == sizeof(SIM_T4_NDEF_APP) && std::memcmp(&apdu[5], SIM_T4_NDEF_APP, sizeof(SIM_T4_NDEF_APP)) == 0) {
+    dep.ndef_selected = true;
+    dep.file = 0;
+    return {0x90, 0x00};
+  }
+  if (ins == 0xA4 && apdu[2] == 0x00 && apdu.size() >= 7 && dep.ndef_selected) {
+    uint16_t file = (apdu[5] << 8) | apdu[6];
+    if (file != SIM_T4_CC_FILE && file != SIM_T4_NDEF_FILE)
+      return {0x6A, 0x82};
+    dep.file = file;
+    return {0x90, 0x00};
+  }
+  if (ins == 0xB0 && apdu.size() >= 5 && dep.file != 0) {
+    size_t offset = (apdu[2] << 8) | apdu[3];
+    size_t le = apdu[4] == 0 ? 256 : apdu[4];
+    const uint8_t *data = dep.file == SIM_T4_CC_FILE ? SIM_T4_CC : tag.memory.data();
+    size_t size = dep.file == SIM_T4_CC_FILE ? sizeof(SIM_T4_CC) : tag.memory.size();
+    if (offset > size)
+      return {0x6B, 0x00};
+    std::vector<uint8_t> resp(data + offset, data + std::min(size, offset + le));
+    resp.push_back(0x90);
+    resp.push_back(0x00);
+    return resp;
+  }
+  return {0x6D, 0x00};
+}
+
+// --- Benchmark -------------------------------------------------------------------------------
+
+void ST25RSim::bench_place_() {
+  SimTag &tag = this->tags_[this->bench_tag_];
+  tag.present = true;
+  tag.state = SimTag::IDLE;
+  this->uid_resolved_ = false;
+  this->placed_us_ = micros();
+  this->placed_counters_ = this->counters_;
+  this->bench_phase_ = BENCH_WAIT_DETECT;
+  this->phase_start_ = millis();
+}
+
+void ST25RSim::bench_remove_() {
+  this->tags_[this->bench_tag_].present = false;
+  this->removed_us_ = micros();
+  this->bench_phase_ = BENCH_WAIT_REMOVE;
+  this->phase_start_ = millis();
+}
+
+void ST25RSim::bench_inventory_place_() {
+  for (auto &tag : this->tags_) {
+    tag.present = true;
+    tag.state = SimTag::IDLE;
+  }
+  this->inventory_seen_.assign(this->tags_.size(), false);
+  this->inventory_found_ = 0;
+  this->inventory_wupas_ = this->wupas_;
+  this->placed_us_ = micros();
+  this->bench_phase_ = BENCH_INVENTORY;
+  this->phase_start_ = millis();
+}
+
+void ST25RSim::bench_inventory_remove_() {
+  for (auto &tag : this->tags_)
+    tag.present = false;
+  this->removed_us_ = micros();
+  this->bench_phase_ = BENCH_INVENTORY_REMOVE;
+  this->phase_start_ = millis();
+}
+
+void ST25RSim::bench_step_() {
+  if (this->tags_.empty()) {
+    this->bench_phase_ = BENCH_DONE;
+    return;
+  }
+  uint32_t elapsed = millis() - this->phase_start_;
+
+  switch (this->bench_phase_) {
+    case BENCH_INVENTORY_GAP:
+      if (elapsed >= this->gap_time_)
+        this->bench_inventory_place_();
+      return;
+    case BENCH_INVENTORY:
+      if (elapsed >= this->timeout_) {
+        this->inventory_failures_++;
+        this->bench_inventory_remove_();
+      }
+      return;
+    case BENCH_INVENTORY_REMOVE:
+      if (elapsed < this->timeout_ && this->is_tag_present())
+        return;
+      if (elapsed < this->timeout_) {
+        this->inventory_removal_.add(micros() - this->removed_us_);
+      } else {
+        this->inventory_failures_++;
+      }
+      if (++this->bench_iteration_ >= this->iterations_) {
+        this->bench_report_();
+        return;
+      }
+      this->bench_phase_ = BENCH_INVENTORY_GAP;
+      this->phase_start_ = millis();
+      return;
+    default:
+      break;
+  }
+
+  SimTagResult &result = this->results_[this->bench_tag_];
+
+  switch (this->bench_phase_) {
+    case BENCH_GAP:
+      if (elapsed >= this->gap_time_)
+        this->bench_place_();
+      break;
+    case BENCH_WAIT_DETECT:
+      if (elapsed >= this->timeout_) {
+        result.detect_failures++;
+        this->bench_remove_();
+      }
+      break;
+    case BENCH_DWELL:
+      if (elapsed >= this->dwell_time_)
+        this->bench_remove_();
+      break;
+    case BENCH_WAIT_REMOVE:
+      if (elapsed >= this->timeout_) {
+        result.removal_failures++;
+      } else if (this->is_tag_present()) {
+        break;
+      } else {
+        // The driver dropped the tag; tag_off() follows from a later loop().
+        result.removal.add(micros() - this->removed_us_);
+      }
+      if (++this->bench_iteration_ >= this->iterations_) {
+        this->bench_iteration_ = 0;
+        if (++this->bench_tag_ >= this->tags_.size()) {
+          // Then every tag at once, which takes a full inventory per discovery round.
+          if (this->tags_.size() < 2) {
+            this->bench_report_();
+          } else {
+            this->bench_phase_ = BENCH_INVENTORY_GAP;
+            this->phase_start_ = millis();
+          }
+          return;
+        }
+      }
+      this->bench_phase_ = BENCH_GAP;
+      this->phase_start_ = millis();
+      break;
+    default:
+      break;
+  }
+}
+
+void ST25RSim::tag_on(nfc::NfcTag &tag) {
+  auto &uid = tag.get_uid();
+  if (this->bench_phase_ == BENCH_INVENTORY) {
+    for (size_t i = 0; i < this->tags_.size(); i++) {
+      auto &sim_uid = this->tags_[i].uid;
+      if (this->inventory_seen_[i] || uid.size() != sim_uid.size() ||
+          !std::equal(uid.begin(), uid.end(), sim_uid.begin()))
+        continue;
+      this->inventory_seen_[i] = true;
+      if (++this->inventory_found_ == this->tags_.size()) {
+        this->inventory_time_.add(micros() - this->placed_us_);
+        this->inventory_rounds_.add(this->wupas_ - this->inventory_wupas_);
+        this->bench_inventory_remove_();
+      }
+      break;
+    }
+    return;
+  }
+  if (this->bench_phase_ != BENCH_WAIT_DETECT)
+    return;
+  SimTag &sim_tag = this->tags_[this->bench_tag_];
+  if (uid.size() != sim_tag.uid.size() || !std::equal(uid.begin(), uid.end(), sim_tag.uid.begin()))
+    return;
+
+  uint32_t now = micros();
+  SimTagResult &result = this->results_[this->bench_tag_];
+  result.reads++;
+  result.time_to_uid.add((this->uid_resolved_ ? this->uid_us_ : now) - this->placed_us_);
+  if (tag.has_ndef_message()) {
+    result.time_to_ndef.add(now - this->placed_us_);
+  } else {
+    result.ndef_missing++;
+  }
+  result.transactions.add(this->counters_.transactions() - this->placed_counters_.transactions());
+  result.fifo_bytes.add(this->counters_.fifo_bytes - this->placed_counters_.fifo_bytes);
+
+  this->bench_phase_ = BENCH_DWELL;
+  this->phase_start_ = millis();
+}
+
+void ST25RSim::bench_report_() {
+  this->bench_phase_ = BENCH_DONE;
+  ESP_LOGI(TAG, "Benchmark results (update interval %" PRIu32 "ms):", this->get_update_interval());
+  uint32_t failures = this->inventory_failures_;
+  for (size_t i = 0; i < this->tags_.size(); i++) {
+    SimTag &tag = this->tags_[i];
+    SimTagResult &r = this->results_[i];
+    failures += r.detect_failures + r.removal_failures;
+    if (tag.has_ndef)
+      failures += r.ndef_missing;
+    ESP_LOGI(TAG, "  %s (%s): %" PRIu32 "/%" PRIu32 " reads, %" PRIu32 " detect / %" PRIu32 " removal failures",
+             nfc::format_uid(tag.uid).c_str(), tag_type_to_string(tag.type), r.reads, this->iterations_,
+             r.detect_failures, r.removal_failures);
+    log_stat_ms("time-to-UID ", r.time_to_uid);
+    log_stat_ms("time-to-NDEF", r.time_to_ndef);
+    if (r.ndef_missing > 0)
+      ESP_LOGI(TAG, "    %" PRIu32 " reads delivered no NDEF message", r.ndef_missing);
+    log_stat_ms("removal     ", r.removal);
+    ESP_LOGI(TAG, "    bus per read: %.1f transactions, %.1f FIFO bytes", r.transactions.avg(), r.fifo_bytes.avg());
+  }
+  if (this->tags_.size() > 1) {
+    ESP_LOGI(TAG, "  All %u tags at once: %" PRIu32 "/%" PRIu32 " inventories, %" PRIu32 " failures",
+             (unsigned) this->tags_.size(), this->inventory_time_.count, this->iterations_, this->inventory_failures_);
+    log_stat_ms("all reported", this->inventory_time_);
+    if (this->inventory_rounds_.count > 0) {
+      ESP_LOGI(TAG, "    discovery rounds min/avg/max: %" PRIu32 " / %.1f / %" PRIu32, this->inventory_rounds_.min,
+               this->inventory_rounds_.avg(), this->inventory_rounds_.max);
+    }
+    log_stat_ms("all removed ", this->inventory_removal_);
+  }
+  uint64_t field_us = this->field_on_us_;
+  if (this->field_on_())
+    field_us += micros() - this->field_since_us_;
+  uint32_t run_us = micros() - this->run_start_us_;
+  ESP_LOGI(TAG, "  RF field on %.1f%% of %.1f s, %" PRIu32 " wake-ups from %" PRIu32 " wake-up measurements",
+           run_us == 0 ? 0.0f : 100.0f * field_us / run_us, run_us / 1e6f, this->wake_ups_,
+           this->wake_up_measurements_);
+  if (this->polls_ > 0) {
+    ESP_LOGI(TAG, "  Bus per poll: %.1f transactions over %" PRIu32 " polls",
+             (float) (this->counters_.transactions() - this->setup_counters_.transactions()) / this->polls_,
+             this->polls_);
+  }
+  // The driver's own view of the same run, with `stats:` configured
+  if (this->get_stats() != nullptr)
+    st25r::ST25R::dump_config();
+  if (this->exit_when_done_) {
+    ESP_LOGI(TAG, "Benchmark complete, %" PRIu32 " failures, exiting", failures);
+    exit(failures > 0 ? 1 : 0);
+  }
+}
+
+}  // namespace st25r_sim
+}  // namespace esphome
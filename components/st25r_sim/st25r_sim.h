@@ -0,0 +1,270 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/components/nfc/nfc.h"
+#include "esphome/components/st25r/st25r.h"
+#include "esphome/components/st25r/crypto1.h"
+#include <array>
+#include <vector>
+#include <string>
+
+namespace esphome {
+namespace st25r_sim {
+
+enum SimTagType : uint8_t {
+  SIM_TAG_MIFARE_CLASSIC_1K,
+  SIM_TAG_ULTRALIGHT,
+  SIM_TAG_NTAG213,
+  SIM_TAG_NTAG215,
+  SIM_TAG_NTAG216,
+  // ISO15693, 8-byte UIDs, 4-byte blocks
+  SIM_TAG_ICODE_SLIX,
+  SIM_TAG_ST25DV04K,
+  // FeliCa, 8-byte IDm, 16-byte blocks
+  SIM_TAG_FELICA_LITE_S,
+  SIM_TAG_FELICA_STANDARD,
+  // ISO14443-4A, 7-byte UID, NFC Forum Type 4 NDEF application
+  SIM_TAG_DESFIRE_EV2,
+};
+
+// ISO-DEP session of a Type 4 tag between RATS and S(DESELECT).
+struct SimIsoDep {
+  bool active{false};
+  uint16_t fsd{16};
+  // Block number expected in the next I-block or R-block from the reader
+  uint8_t block_number{0};
+  std::vector<uint8_t> command;
+  std::vector<uint8_t> response;
+  size_t response_pos{0};
+  std::vector<uint8_t> last_block;
+  bool ndef_selected{false};
+  uint16_t file{0};
+  bool wtx_sent{false};
+};
+
+// Crypto1 session of a Mifare Classic tag.
+struct SimClassic {
+  st25r::Crypto1 crypto;
+  bool authenticated{false};
+  // Nonce sent, waiting for the reader's answer
+  bool auth_pending{false};
+  uint32_t nt{0};
+  uint8_t sector{0};
+};
+
+// A scripted ISO14443-3A/-4A, ISO15693 or FeliCa tag sitting (or not) in the simulated RF field.
+struct SimTag {
+  enum State : uint8_t { IDLE, READY, ACTIVE, HALT };
+
+  std::vector<uint8_t> uid;
+  SimTagType type;
+  std::vector<uint8_t> memory;  // Type 2 pages or ISO15693 blocks, 4 bytes each; FeliCa blocks, 16 bytes;
+                               // Type 4 NDEF file; Mifare Classic blocks, 16 bytes
+  SimIsoDep iso_dep;
+  SimClassic classic;
+  bool has_ndef{false};  // added with an NDEF message, so every read is expected to deliver it
+  State state{IDLE};
+  bool present{false};
+};
+
+// Running min/avg/max over unsigned samples, no allocation.
+struct SimStat {
+  uint32_t count{0};
+  uint32_t min{0};
+  uint32_t max{0};
+  uint64_t sum{0};
+
+  void add(uint32_t value);
+  float avg() const { return this->count == 0 ? 0.0f : (float) this->sum / this->count; }
+};
+
+// Bus traffic as seen by the transport layer of the simulated chip.
+struct SimBusCounters {
+  uint32_t reg_reads{0};
+  uint32_t reg_writes{0};
+  uint32_t commands{0};
+  uint32_t fifo_writes{0};
+  uint32_t fifo_reads{0};
+  uint32_t fifo_bytes{0};
+
+  uint32_t transactions() const {
+    return this->reg_reads + this->reg_writes + this->commands + this->fifo_writes + this->fifo_reads;
+  }
+};
+
+struct SimTagResult {
+  uint32_t reads{0};
+  uint32_t detect_failures{0};
+  uint32_t removal_failures{0};
+  uint32_t ndef_missing{0};
+  SimStat time_to_uid;
+  SimStat time_to_ndef;
+  SimStat removal;
+  SimStat transactions;
+  SimStat fifo_bytes;
+};
+
+/// ST25R3916 chip model behind the regular ST25R state machine.
+///
+/// Implements the transport primitives against an in-memory register file, FIFO and IRQ line,
+/// answers ISO14443-3A/-4A, ISO15693 and FeliCa frames on behalf of the configured virtual tags and, when a benchmark
+/// is configured, places/removes those tags on a schedule while measuring read latency and
+/// bus traffic. Runs on any platform but is intended for the `host` platform.
+class ST25RSim : public st25r::ST25R, public nfc::NfcTagListener {
+ public:
+  enum BenchPhase : uint8_t {
+    BENCH_DISABLED,
+    BENCH_GAP,
+    BENCH_WAIT_DETECT,
+    BENCH_DWELL,
+    BENCH_WAIT_REMOVE,
+    // All tags in the field together, each iteration
+    BENCH_INVENTORY_GAP,
+    BENCH_INVENTORY,
+    BENCH_INVENTORY_REMOVE,
+    BENCH_DONE,
+  };
+
+  void setup() override;
+  void update() override;
+  void loop() override;
+  void dump_config() override;
+
+  void add_tag(const std::vector<uint8_t> &uid, SimTagType type, const std::string &ndef_uri);
+  void set_benchmark_enabled(bool enabled) { this->bench_phase_ = enabled ? BENCH_GAP : BENCH_DISABLED; }
+  void set_iterations(uint32_t iterations) { this->iterations_ = iterations; }
+  void set_dwell_time(uint32_t dwell_time) { this->dwell_time_ = dwell_time; }
+  void set_gap_time(uint32_t gap_time) { this->gap_time_ = gap_time; }
+  void set_timeout(uint32_t timeout) { this->timeout_ = timeout; }
+  void set_exit_when_done(bool exit_when_done) { this->exit_when_done_ = exit_when_done; }
+
+  void tag_on(nfc::NfcTag &tag) override;
+  void tag_off(nfc::NfcTag &tag) override {}
+
+ protected:
+  uint8_t bus_read_register(uint8_t reg) override;
+  void bus_write_register(uint8_t reg, uint8_t value) override;
+  void bus_read_registers(uint8_t reg, uint8_t *data, size_t len) override;
+  void bus_write_registers(uint8_t reg, const uint8_t *data, size_t len) override;
+  void bus_write_command(uint8_t command) override;
+  void bus_write_fifo(const uint8_t *data, size_t len) override;
+  void bus_read_fifo(uint8_t *data, size_t len) override;
+
+  uint8_t load_register_(uint8_t reg);
+  void store_register_(uint8_t reg, uint8_t value);
+  void set_default_();
+  void set_op_control_(uint8_t value);
+  uint8_t measure_(uint8_t command);
+  void wake_up_measure_();
+  void raise_irq_(uint8_t index, uint8_t bits);
+  void update_irq_line_();
+  void service_timers_();
+  void transmit_(uint8_t command);
+  void finish_transmit_();
+  /// Bit-oriented ANTICOLLISION answered by every matching tag at once.
+  void anticollision_();
+  void feed_rx_();
+  /// Frame sent in subcarrier stream mode: 1-out-of-4 coded ISO15693 request or a lone EOF.
+  void vicc_frame_();
+  void vicc_inventory_slot_();
+  /// Manchester-code the answers into the stream the chip would receive; tags answering at the
+  /// same time overlap bit by bit.
+  void vicc_respond_(const std::vector<std::vector<uint8_t>> &answers);
+  /// Frame sent in FeliCa mode: SENSF_REQ answered slot by slot, or Read Without Encryption.
+  void felica_frame_();
+  /// Next SENSF_RES slot of the pending request, once the reader listens again.
+  void felica_next_slot_();
+  void start_no_response_timer_();
+  /// ISO-DEP block for an activated Type 4 tag; false when it stays silent.
+  bool iso_dep_respond_(SimTag &tag, const uint8_t *frame, size_t len, std::vector<uint8_t> &resp);
+  /// Next block of the pending response, chained when it is longer than the reader's FSD.
+  void iso_dep_next_block_(SimTag &tag, std::vector<uint8_t> &resp);
+  std::vector<uint8_t> t4_apdu_(SimTag &tag, const std::vector<uint8_t> &apdu);
+  /// Frame sent with parity bits from the FIFO (no_tx_par): Mifare Classic authentication and
+  /// encrypted commands.
+  void classic_frame_();
+  bool classic_respond_(SimTag &tag, const uint8_t *frame, size_t len, std::vector<uint8_t> &resp,
+                        std::vector<uint8_t> &parity);
+  bool tag_respond_(SimTag &tag, const uint8_t *frame, size_t len, bool short_frame, std::vector<uint8_t> &resp,
+                    bool &with_crc);
+  bool field_on_() const { return (this->regs_[st25r::OP_CONTROL] & 0x08) != 0; }
+  // wu=1 with the oscillator off: the wake-up timer runs its periodic measurements.
+  bool wake_up_active_() const { return (this->regs_[st25r::OP_CONTROL] & 0x84) == 0x04; }
+
+  void bench_step_();
+  void bench_place_();
+  void bench_remove_();
+  void bench_inventory_place_();
+  void bench_inventory_remove_();
+  void bench_report_();
+
+  // Chip model
+  uint8_t regs_[64]{};
+  uint8_t irq_[4]{};
+  uint8_t fifo_[512];
+  size_t fifo_len_{0};
+  bool fifo_underflow_{false};
+  uint8_t fifo_last_bits_{0};
+  // ISO15693 inventory in progress
+  bool vicc_inventory_{false};
+  uint64_t vicc_mask_{0};
+  uint8_t vicc_mask_length_{0};
+  uint8_t vicc_slot_{0};
+  uint8_t vicc_slots_{16};
+  // SENSF_RES slots of the last SENSF_REQ not received yet: frame and whether cards collided in it
+  std::vector<std::pair<std::vector<uint8_t>, bool>> felica_slots_;
+  uint32_t felica_seed_{1};
+  uint32_t classic_nonce_{0x01200145};
+  // Frame being transmitted, possibly still arriving through FIFO refills
+  std::vector<uint8_t> tx_frame_;
+  size_t tx_expected_{0};
+  bool tx_short_{false};
+  bool tx_streaming_{false};
+  // Response bytes that did not fit into the FIFO yet
+  std::vector<uint8_t> rx_pending_;
+  size_t rx_pending_pos_{0};
+  uint8_t rx_end_irq_{0};
+  uint8_t rx_end_error_irq_{0};
+  bool irq_line_{false};
+  bool nre_pending_{false};
+  uint32_t nre_at_us_{0};
+  SimBusCounters counters_;
+  SimBusCounters setup_counters_;
+  uint32_t polls_{0};
+  uint32_t wupas_{0};
+  uint32_t run_start_us_{0};
+  uint32_t field_since_us_{0};
+  uint64_t field_on_us_{0};
+  uint32_t wake_up_last_us_{0};
+  uint32_t wake_ups_{0};
+  uint32_t wake_up_measurements_{0};
+
+  std::vector<SimTag> tags_;
+
+  // Benchmark
+  BenchPhase bench_phase_{BENCH_DISABLED};
+  uint32_t iterations_{5};
+  uint32_t dwell_time_{500};
+  uint32_t gap_time_{250};
+  uint32_t timeout_{10000};
+  bool exit_when_done_{false};
+  size_t bench_tag_{0};
+  uint32_t bench_iteration_{0};
+  uint32_t phase_start_{0};
+  uint32_t placed_us_{0};
+  uint32_t removed_us_{0};
+  uint32_t uid_us_{0};
+  bool uid_resolved_{false};
+  SimBusCounters placed_counters_;
+  std::vector<SimTagResult> results_;
+  std::vector<bool> inventory_seen_;
+  size_t inventory_found_{0};
+  uint32_t inventory_wupas_{0};
+  uint32_t inventory_failures_{0};
+  SimStat inventory_time_;
+  SimStat inventory_rounds_;
+  SimStat inventory_removal_;
+};
+
+}  // namespace st25r_sim
+}  // namespace esphome
@@ -1,7 +1,7 @@
 import esphome.codegen as cg
 from esphome.components import st25r, spi
 import esphome.config_validation as cv
-from esphome.const import CONF_ID
+from esphome.const import CONF_DATA_RATE, CONF_ID
 
 AUTO_LOAD = ["st25r"]
 CODEOWNERS = ["@JohnMcLear"]
@@ -11,12 +11,23 @@ MULTI_CONF = True
 st25r_spi_ns = cg.esphome_ns.namespace("st25r_spi")
 ST25RSpi = st25r_spi_ns.class_("ST25RSpi", st25r.ST25R, spi.SPIDevice)
 
+# Highest SPI clock in the ST25R3916 datasheet
+MAX_DATA_RATE = 10e6
+
+
+def validate_data_rate(config):
+    if config[CONF_DATA_RATE] > MAX_DATA_RATE:
+        raise cv.Invalid("The ST25R SPI interface runs at up to 10MHz.", [CONF_DATA_RATE])
+    return config
+
+
 CONFIG_SCHEMA = cv.All(
     st25r.ST25R_SCHEMA.extend(
         {
             cv.GenerateID(): cv.declare_id(ST25RSpi),
         }
-    ).extend(spi.spi_device_schema(cs_pin_required=True))
+    ).extend(spi.spi_device_schema(cs_pin_required=True, default_data_rate="5MHz")),
+    validate_data_rate,
 )
 
 
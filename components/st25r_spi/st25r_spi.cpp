@@ -1,5 +1,6 @@
 #include "st25r_spi.h"
 #include "esphome/core/log.h"
+#include <cinttypes>
 
 namespace esphome {
 namespace st25r_spi {
@@ -15,44 +16,58 @@ void ST25RSpi::setup() {
 void ST25RSpi::dump_config() {
   st25r::ST25R::dump_config();
   LOG_PIN("  CS Pin: ", this->cs_);
+  ESP_LOGCONFIG(TAG, "  Data Rate: %" PRIu32 " kHz", (uint32_t) (this->data_rate_ / 1000));
 }
 
-uint8_t ST25RSpi::read_register(uint8_t reg) {
+// Mode byte first, then the data as one array transfer: the SPI driver moves it in a single
+// (DMA-backed where the platform has it) transaction instead of one call per byte.
+
+uint8_t ST25RSpi::bus_read_register(uint8_t reg) {
+  uint8_t buf[2] = {(uint8_t) (0x40 | (reg & 0x3F)), 0x00};
+  this->enable();
+  this->transfer_array(buf, sizeof(buf));
+  this->disable();
+  return buf[1];
+}
+
+void ST25RSpi::bus_write_register(uint8_t reg, uint8_t value) {
+  const uint8_t buf[2] = {(uint8_t) (0x00 | (reg & 0x3F)), value};
+  this->enable();
+  this->write_array(buf, sizeof(buf));
+  this->disable();
+}
+
+void ST25RSpi::bus_read_registers(uint8_t reg, uint8_t *data, size_t len) {
   this->enable();
   this->write_byte(0x40 | (reg & 0x3F));
-  uint8_t value = this->read_byte();
+  this->read_array(data, len);
   this->disable();
-  return value;
 }
 
-void ST25RSpi::write_register(uint8_t reg, uint8_t value) {
+void ST25RSpi::bus_write_registers(uint8_t reg, const uint8_t *data, size_t len) {
   this->enable();
   this->write_byte(0x00 | (reg & 0x3F));
-  this->write_byte(value);
+  this->write_array(data, len);
   this->disable();
 }
 
-void ST25RSpi::write_command(uint8_t command) {
+void ST25RSpi::bus_write_command(uint8_t command) {
   this->enable();
   this->write_byte(command);
   this->disable();
 }
 
-void ST25RSpi::write_fifo(const uint8_t *data, size_t len) {
+void ST25RSpi::bus_write_fifo(const uint8_t *data, size_t len) {
   this->enable();
   this->write_byte(0x80);
-  for (size_t i = 0; i < len; i++) {
-    this->write_byte(data[i]);
-  }
+  this->write_array(data, len);
   this->disable();
 }
 
-void ST25RSpi::read_fifo(uint8_t *data, size_t len) {
+void ST25RSpi::bus_read_fifo(uint8_t *data, size_t len) {
   this->enable();
   this->write_byte(0x9F);
-  for (size_t i = 0; i < len; i++) {
-    data[i] = this->read_byte();
-  }
+  this->read_array(data, len);
   this->disable();
 }
 
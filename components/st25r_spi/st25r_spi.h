@@ -9,17 +9,19 @@ namespace st25r_spi {
 
 class ST25RSpi : public st25r::ST25R,
                  public spi::SPIDevice<spi::BIT_ORDER_MSB_FIRST, spi::CLOCK_POLARITY_LOW,
-                                       spi::CLOCK_PHASE_LEADING, spi::DATA_RATE_200KHZ> {
+                                       spi::CLOCK_PHASE_LEADING, spi::DATA_RATE_5MHZ> {
  public:
   void setup() override;
   void dump_config() override;
 
  protected:
-  uint8_t read_register(uint8_t reg) override;
-  void write_register(uint8_t reg, uint8_t value) override;
-  void write_command(uint8_t command) override;
-  void write_fifo(const uint8_t *data, size_t len) override;
-  void read_fifo(uint8_t *data, size_t len) override;
+  uint8_t bus_read_register(uint8_t reg) override;
+  void bus_write_register(uint8_t reg, uint8_t value) override;
+  void bus_read_registers(uint8_t reg, uint8_t *data, size_t len) override;
+  void bus_write_registers(uint8_t reg, const uint8_t *data, size_t len) override;
+  void bus_write_command(uint8_t command) override;
+  void bus_write_fifo(const uint8_t *data, size_t len) override;
+  void bus_read_fifo(uint8_t *data, size_t len) override;
 };
 
 }  // namespace st25r_spi